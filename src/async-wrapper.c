@@ -15,16 +15,19 @@
 
 void
 _libwc_blocking_task_init(LibWCBlockingTask *task) {
-    g_cond_init(&task->cond);
-    g_mutex_init(&task->mutex);
+    task->context = g_main_context_new();
+    task->res = NULL;
 
-    g_mutex_lock(&task->mutex);
+    g_main_context_push_thread_default(task->context);
 }
 
 void
 _libwc_blocking_task_wait_until_finish(LibWCBlockingTask *task) {
-    g_cond_wait(&task->cond, &task->mutex);
-    g_mutex_unlock(&task->mutex);
+    while (!task->res)
+        g_main_context_iteration(task->context, TRUE);
+
+    g_main_context_pop_thread_default(task->context);
+    g_main_context_unref(task->context);
 }
 
 void
@@ -34,6 +37,4 @@ _libwc_unblock_on_finish(GObject *source_object,
     LibWCBlockingTask *task = user_data;
 
     task->res = g_object_ref(res);
-
-    g_cond_broadcast(&task->cond);
 }
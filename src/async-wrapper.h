@@ -19,9 +19,12 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+/* Blocking calls run their async counterparts with a private main context
+ * pushed as the thread default, and iterate it until they're done. That way
+ * the result gets delivered to us no matter which thread completes it, and we
+ * don't depend on anyone else running the caller's main context */
 struct _LibWCBlockingTask {
-    GCond cond;
-    GMutex mutex;
+    GMainContext *context;
     GAsyncResult *res;
 };
 
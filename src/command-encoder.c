@@ -0,0 +1,187 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "command-encoder.h"
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Big enough for nearly every command we send */
+#define COMMAND_BUFFER_INITIAL_SIZE ((gsize)256)
+
+/* Buffers that grew past this for some huge command don't get kept around */
+#define COMMAND_BUFFER_MAX_POOLED_SIZE ((gsize)64 * 1024)
+
+#define COMMAND_POOL_MAX_BUFFERS 64
+
+void
+_libwc_command_pool_init(LibWCCommandPool *pool) {
+    *pool = (LibWCCommandPool) { 0 };
+    g_mutex_init(&pool->mutex);
+}
+
+/* Frees the buffers sitting in the pool. Any buffer still out there would
+ * come back to a pool that doesn't exist anymore, so they all need to have
+ * been released first */
+void
+_libwc_command_pool_clear(LibWCCommandPool *pool) {
+    LibWCCommandBuffer *buffer;
+
+    while ((buffer = pool->free_list)) {
+        pool->free_list = buffer->next;
+        g_free(buffer->data);
+        g_free(buffer);
+    }
+
+    pool->n_free = 0;
+    g_mutex_clear(&pool->mutex);
+}
+
+LibWCCommandBuffer *
+_libwc_command_buffer_get(LibWCCommandPool *pool) {
+    LibWCCommandBuffer *buffer;
+
+    g_mutex_lock(&pool->mutex);
+
+    buffer = pool->free_list;
+    if (buffer) {
+        pool->free_list = buffer->next;
+        pool->n_free--;
+    }
+
+    g_mutex_unlock(&pool->mutex);
+
+    if (!buffer) {
+        buffer = g_new(LibWCCommandBuffer, 1);
+        buffer->pool = pool;
+        buffer->data = g_malloc(COMMAND_BUFFER_INITIAL_SIZE);
+        buffer->capacity = COMMAND_BUFFER_INITIAL_SIZE;
+    }
+
+    buffer->next = NULL;
+    buffer->len = 0;
+    buffer->invalid = FALSE;
+
+    return buffer;
+}
+
+static inline void
+command_buffer_reserve(LibWCCommandBuffer *buffer,
+                       gsize len) {
+    if (G_LIKELY(buffer->capacity - buffer->len >= len))
+        return;
+
+    while (buffer->capacity - buffer->len < len)
+        buffer->capacity *= 2;
+
+    buffer->data = g_realloc(buffer->data, buffer->capacity);
+}
+
+void
+_libwc_command_buffer_append(LibWCCommandBuffer *buffer,
+                             const gchar *data,
+                             gsize len) {
+    command_buffer_reserve(buffer, len);
+
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+}
+
+/* Appends a space followed by arg */
+void
+_libwc_command_buffer_append_arg(LibWCCommandBuffer *buffer,
+                                 const gchar *arg) {
+    gsize len = strlen(arg);
+
+    if (strcspn(arg, "\r\n") != len)
+        buffer->invalid = TRUE;
+
+    command_buffer_reserve(buffer, len + 1);
+
+    buffer->data[buffer->len++] = ' ';
+    memcpy(buffer->data + buffer->len, arg, len);
+    buffer->len += len;
+}
+
+void
+_libwc_command_buffer_append_vprintf(LibWCCommandBuffer *buffer,
+                                     const gchar *format_string,
+                                     va_list va_args) {
+    va_list args;
+    gint len;
+
+    /* Try to fit it in whatever room we have left first, most of the time
+     * that's enough */
+    va_copy(args, va_args);
+    len = g_vsnprintf(buffer->data + buffer->len,
+                      buffer->capacity - buffer->len, format_string, args);
+    va_end(args);
+
+    g_return_if_fail(len >= 0);
+
+    if ((gsize)len >= buffer->capacity - buffer->len) {
+        command_buffer_reserve(buffer, len + 1);
+
+        va_copy(args, va_args);
+        g_vsnprintf(buffer->data + buffer->len,
+                    buffer->capacity - buffer->len, format_string, args);
+        va_end(args);
+    }
+
+    if (memchr(buffer->data + buffer->len, '\n', len) ||
+        memchr(buffer->data + buffer->len, '\r', len))
+        buffer->invalid = TRUE;
+
+    buffer->len += len;
+}
+
+/* Ends the command, and hands back its data. Once the last reference to it is
+ * gone, the buffer goes back to its pool. If one of the arguments had a line
+ * break in it, the buffer is released and NULL is returned */
+GBytes *
+_libwc_command_buffer_finish(LibWCCommandBuffer *buffer) {
+    if (buffer->invalid) {
+        _libwc_command_buffer_release(buffer);
+        return NULL;
+    }
+
+    _libwc_command_buffer_append_c(buffer, '\n');
+
+    return g_bytes_new_with_free_func(
+        buffer->data, buffer->len,
+        (GDestroyNotify)_libwc_command_buffer_release, buffer);
+}
+
+void
+_libwc_command_buffer_release(LibWCCommandBuffer *buffer) {
+    LibWCCommandPool *pool = buffer->pool;
+
+    if (buffer->capacity <= COMMAND_BUFFER_MAX_POOLED_SIZE) {
+        g_mutex_lock(&pool->mutex);
+
+        if (pool->n_free < COMMAND_POOL_MAX_BUFFERS) {
+            buffer->next = pool->free_list;
+            pool->free_list = buffer;
+            pool->n_free++;
+
+            g_mutex_unlock(&pool->mutex);
+            return;
+        }
+
+        g_mutex_unlock(&pool->mutex);
+    }
+
+    g_free(buffer->data);
+    g_free(buffer);
+}
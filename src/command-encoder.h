@@ -0,0 +1,89 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef COMMAND_ENCODER_H
+#define COMMAND_ENCODER_H
+
+#include <glib.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* Commands get written straight into buffers that go back to their pool once
+ * the command has made it onto the wire, so sending one doesn't leave any
+ * temporary strings behind, and busy relays end up reusing the same few
+ * buffers over and over. Buffers can be taken from the pool on any thread.
+ *
+ * Relay commands are a single line, so arguments can't contain line breaks.
+ * If one does, finishing the buffer fails instead of sending something the
+ * relay would take as two commands */
+
+typedef struct _LibWCCommandBuffer LibWCCommandBuffer;
+
+typedef struct {
+    GMutex mutex;
+    LibWCCommandBuffer *free_list;
+    guint n_free;
+} LibWCCommandPool;
+
+struct _LibWCCommandBuffer {
+    LibWCCommandBuffer *next;
+    LibWCCommandPool *pool;
+
+    gchar *data;
+    gsize len;
+    gsize capacity;
+    gboolean invalid;
+};
+
+void _libwc_command_pool_init(LibWCCommandPool *pool)
+G_GNUC_INTERNAL;
+
+void _libwc_command_pool_clear(LibWCCommandPool *pool)
+G_GNUC_INTERNAL;
+
+LibWCCommandBuffer * _libwc_command_buffer_get(LibWCCommandPool *pool)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_command_buffer_append(LibWCCommandBuffer *buffer,
+                                  const gchar *data,
+                                  gsize len)
+G_GNUC_INTERNAL;
+
+void _libwc_command_buffer_append_arg(LibWCCommandBuffer *buffer,
+                                      const gchar *arg)
+G_GNUC_INTERNAL;
+
+void _libwc_command_buffer_append_vprintf(LibWCCommandBuffer *buffer,
+                                          const gchar *format_string,
+                                          va_list va_args)
+G_GNUC_INTERNAL G_GNUC_PRINTF(2, 0);
+
+GBytes * _libwc_command_buffer_finish(LibWCCommandBuffer *buffer)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_command_buffer_release(LibWCCommandBuffer *buffer)
+G_GNUC_INTERNAL;
+
+static inline void
+_libwc_command_buffer_append_c(LibWCCommandBuffer *buffer,
+                               gchar c) {
+    _libwc_command_buffer_append(buffer, &c, 1);
+}
+
+static inline void
+_libwc_command_buffer_append_str(LibWCCommandBuffer *buffer,
+                                 const gchar *str) {
+    _libwc_command_buffer_append(buffer, str, strlen(str));
+}
+
+#endif /* !COMMAND_ENCODER_H */
@@ -0,0 +1,231 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "command-slab.h"
+
+#include <glib.h>
+#include <stdatomic.h>
+
+#define FREE_HEAD_INDEX(head_) ((guint32)((head_) & G_MAXUINT32))
+#define FREE_HEAD_TAG(head_)   ((guint32)((head_) >> 32))
+#define FREE_HEAD(tag_, index_) (((guint64)(tag_) << 32) | (guint32)(index_))
+
+#define ID_INDEX(id_)      ((id_) & LIBWC_COMMAND_SLAB_INDEX_MASK)
+#define ID_GENERATION(id_) ((guint16)((id_) >> LIBWC_COMMAND_SLAB_INDEX_BITS))
+
+static inline LibWCCommandSlot *
+get_slot(LibWCCommandSlab *slab,
+         guint32 index) {
+    LibWCCommandSlot *chunk;
+    guint chunk_index = index / LIBWC_COMMAND_SLAB_CHUNK_SIZE;
+
+    if (G_UNLIKELY(chunk_index >= LIBWC_COMMAND_SLAB_MAX_CHUNKS))
+        return NULL;
+
+    chunk = atomic_load_explicit(&slab->chunks[chunk_index],
+                                 memory_order_acquire);
+    if (G_UNLIKELY(!chunk))
+        return NULL;
+
+    return &chunk[index % LIBWC_COMMAND_SLAB_CHUNK_SIZE];
+}
+
+/* Pushes the chain of free slots from first to last onto the free list */
+static void
+push_free_chain(LibWCCommandSlab *slab,
+                guint32 first,
+                LibWCCommandSlot *last) {
+    guint64 head = atomic_load_explicit(&slab->free_head,
+                                        memory_order_relaxed),
+            new_head;
+
+    do {
+        atomic_store_explicit(&last->next_free, FREE_HEAD_INDEX(head),
+                              memory_order_relaxed);
+        new_head = FREE_HEAD(FREE_HEAD_TAG(head) + 1, first + 1);
+    } while (!atomic_compare_exchange_weak_explicit(&slab->free_head, &head,
+                                                    new_head,
+                                                    memory_order_acq_rel,
+                                                    memory_order_relaxed));
+}
+
+/* Must be called with grow_mutex held, and with room for another chunk */
+static void
+add_chunk(LibWCCommandSlab *slab) {
+    LibWCCommandSlot *chunk;
+    guint32 first;
+
+    chunk = g_new0(LibWCCommandSlot, LIBWC_COMMAND_SLAB_CHUNK_SIZE);
+    first = slab->chunk_count * LIBWC_COMMAND_SLAB_CHUNK_SIZE;
+
+    for (guint i = 0; i < LIBWC_COMMAND_SLAB_CHUNK_SIZE; i++) {
+        chunk[i].generation = 1;
+        atomic_init(&chunk[i].next_free, first + i + 2);
+    }
+
+    atomic_store_explicit(&slab->chunks[slab->chunk_count], chunk,
+                          memory_order_release);
+    slab->chunk_count++;
+
+    push_free_chain(slab, first, &chunk[LIBWC_COMMAND_SLAB_CHUNK_SIZE - 1]);
+}
+
+static gboolean
+grow(LibWCCommandSlab *slab) {
+    g_mutex_lock(&slab->grow_mutex);
+
+    /* Someone else might have beaten us to it */
+    if (FREE_HEAD_INDEX(atomic_load(&slab->free_head))) {
+        g_mutex_unlock(&slab->grow_mutex);
+        return TRUE;
+    }
+
+    if (slab->chunk_count >= LIBWC_COMMAND_SLAB_MAX_CHUNKS) {
+        g_mutex_unlock(&slab->grow_mutex);
+        return FALSE;
+    }
+
+    add_chunk(slab);
+    g_mutex_unlock(&slab->grow_mutex);
+
+    return TRUE;
+}
+
+void
+_libwc_command_slab_init(LibWCCommandSlab *slab) {
+    atomic_init(&slab->free_head, 0);
+
+    for (guint i = 0; i < LIBWC_COMMAND_SLAB_MAX_CHUNKS; i++)
+        atomic_init(&slab->chunks[i], NULL);
+
+    slab->chunk_count = 0;
+    g_mutex_init(&slab->grow_mutex);
+}
+
+/* Frees the slab's memory. Every slot should have been released by now */
+void
+_libwc_command_slab_clear(LibWCCommandSlab *slab) {
+    for (guint i = 0; i < slab->chunk_count; i++)
+        g_free(atomic_load_explicit(&slab->chunks[i], memory_order_relaxed));
+
+    g_mutex_clear(&slab->grow_mutex);
+}
+
+guint
+_libwc_command_slab_alloc(LibWCCommandSlab *slab) {
+    LibWCCommandSlot *slot;
+    guint64 head, new_head;
+    guint32 index;
+
+    head = atomic_load_explicit(&slab->free_head, memory_order_acquire);
+    for (;;) {
+        if (G_UNLIKELY(!FREE_HEAD_INDEX(head))) {
+            if (!grow(slab))
+                return 0;
+
+            head = atomic_load_explicit(&slab->free_head,
+                                        memory_order_acquire);
+            continue;
+        }
+
+        /* The slot might get popped out from under us before the CAS, but
+         * since slots are never freed reading it is harmless, and the tag will
+         * make sure the CAS fails */
+        index = FREE_HEAD_INDEX(head) - 1;
+        slot = get_slot(slab, index);
+        new_head = FREE_HEAD(FREE_HEAD_TAG(head) + 1,
+                             atomic_load_explicit(&slot->next_free,
+                                                  memory_order_relaxed));
+
+        if (atomic_compare_exchange_weak_explicit(&slab->free_head, &head,
+                                                  new_head,
+                                                  memory_order_acq_rel,
+                                                  memory_order_acquire))
+            break;
+    }
+
+    return ((guint)slot->generation << LIBWC_COMMAND_SLAB_INDEX_BITS) | index;
+}
+
+void
+_libwc_command_slab_release(LibWCCommandSlab *slab,
+                            guint id) {
+    LibWCCommandSlot *slot = _libwc_command_slab_lookup(slab, id);
+
+    if (!slot)
+        return;
+
+    slot->task = NULL;
+
+    /* Generation 0 is never used, that way an ID can never be 0 */
+    if (++slot->generation == 0)
+        slot->generation = 1;
+
+    push_free_chain(slab, ID_INDEX(id), slot);
+}
+
+/* Keeps id from being handed out again until its slot has gone through every
+ * other generation, for IDs that were handed out by some other slab. The slot
+ * id would go in can't be in use */
+void
+_libwc_command_slab_reserve(LibWCCommandSlab *slab,
+                            guint id) {
+    LibWCCommandSlot *slot;
+    guint chunk_index = ID_INDEX(id) / LIBWC_COMMAND_SLAB_CHUNK_SIZE;
+
+    g_mutex_lock(&slab->grow_mutex);
+    while (slab->chunk_count <= chunk_index)
+        add_chunk(slab);
+    g_mutex_unlock(&slab->grow_mutex);
+
+    slot = get_slot(slab, ID_INDEX(id));
+
+    slot->generation = ID_GENERATION(id) + 1;
+    if (slot->generation == 0)
+        slot->generation = 1;
+}
+
+LibWCCommandSlot *
+_libwc_command_slab_lookup(LibWCCommandSlab *slab,
+                           guint id) {
+    LibWCCommandSlot *slot = get_slot(slab, ID_INDEX(id));
+
+    if (!slot || slot->generation != ID_GENERATION(id))
+        return NULL;
+
+    return slot;
+}
+
+void
+_libwc_command_slab_foreach(LibWCCommandSlab *slab,
+                            LibWCCommandSlabFunc func,
+                            void *user_data) {
+    for (guint i = 0; i < LIBWC_COMMAND_SLAB_MAX_CHUNKS; i++) {
+        LibWCCommandSlot *chunk =
+            atomic_load_explicit(&slab->chunks[i], memory_order_acquire);
+
+        if (!chunk)
+            break;
+
+        for (guint j = 0; j < LIBWC_COMMAND_SLAB_CHUNK_SIZE; j++) {
+            LibWCCommandSlot *slot = &chunk[j];
+            guint index = i * LIBWC_COMMAND_SLAB_CHUNK_SIZE + j;
+
+            if (!slot->task)
+                continue;
+
+            func(((guint)slot->generation << LIBWC_COMMAND_SLAB_INDEX_BITS) |
+                 index, slot, user_data);
+        }
+    }
+}
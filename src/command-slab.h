@@ -0,0 +1,95 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef COMMAND_SLAB_H
+#define COMMAND_SLAB_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdatomic.h>
+
+#include "timer-wheel.h"
+
+/* A slab of slots for commands that are waiting on a response from the relay.
+ * The ID of a command encodes both the index of its slot and the generation of
+ * that slot at the time the ID was handed out, so looking a command up is just
+ * an array index, and responses for IDs that have since been reused get
+ * rejected instead of completing the wrong command.
+ *
+ * IDs can be allocated from any thread without locking. Everything else is
+ * only meant to be used from the libweechat thread. */
+
+#define LIBWC_COMMAND_SLAB_INDEX_BITS  16
+#define LIBWC_COMMAND_SLAB_INDEX_MASK  ((1u << LIBWC_COMMAND_SLAB_INDEX_BITS) - 1)
+#define LIBWC_COMMAND_SLAB_CHUNK_SIZE  256
+#define LIBWC_COMMAND_SLAB_MAX_CHUNKS \
+    ((1u << LIBWC_COMMAND_SLAB_INDEX_BITS) / LIBWC_COMMAND_SLAB_CHUNK_SIZE)
+
+typedef struct _LibWCCommandSlot LibWCCommandSlot;
+typedef struct _LibWCCommandSlab LibWCCommandSlab;
+
+struct _LibWCCommandSlot {
+    /* Index + 1 of the next slot in the free list, 0 terminates it */
+    _Atomic guint32 next_free;
+    guint16 generation;
+
+    guint id;
+    GTask *task;
+    LibWCTimer deadline;
+
+    /* Set for commands that can be sent again on another connection */
+    GBytes *replay_data;
+};
+
+struct _LibWCCommandSlab {
+    /* The top 32 bits are a tag that gets bumped on every change to the free
+     * list so that we don't fall victim to ABA, the bottom 32 are the index + 1
+     * of the first free slot */
+    _Atomic guint64 free_head;
+
+    LibWCCommandSlot *_Atomic chunks[LIBWC_COMMAND_SLAB_MAX_CHUNKS];
+    guint chunk_count;
+    GMutex grow_mutex;
+};
+
+typedef void (*LibWCCommandSlabFunc)(guint id,
+                                     LibWCCommandSlot *slot,
+                                     void *user_data);
+
+void _libwc_command_slab_init(LibWCCommandSlab *slab)
+G_GNUC_INTERNAL;
+
+void _libwc_command_slab_clear(LibWCCommandSlab *slab)
+G_GNUC_INTERNAL;
+
+guint _libwc_command_slab_alloc(LibWCCommandSlab *slab)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_command_slab_release(LibWCCommandSlab *slab,
+                                 guint id)
+G_GNUC_INTERNAL;
+
+void _libwc_command_slab_reserve(LibWCCommandSlab *slab,
+                                 guint id)
+G_GNUC_INTERNAL;
+
+LibWCCommandSlot * _libwc_command_slab_lookup(LibWCCommandSlab *slab,
+                                              guint id)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_command_slab_foreach(LibWCCommandSlab *slab,
+                                 LibWCCommandSlabFunc func,
+                                 void *user_data)
+G_GNUC_INTERNAL;
+
+#endif /* !COMMAND_SLAB_H */
@@ -0,0 +1,202 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+
+#include "hdata-query.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* Builds the arguments for an hdata command one piece at a time, e.g.
+ *
+ *     buffer:0x1234/own_lines/last_line(-50)/data date,prefix,message
+ *
+ * Each piece is checked as it's added, but errors don't come out until the
+ * query is built: the first thing that was wrong with it is kept, and handed
+ * back from libwc_hdata_query_build() instead of a command the relay would've
+ * rejected or, worse, misread */
+struct _LibWCHdataQuery {
+    GString *path;
+    GString *keys;
+    GError *error;
+};
+
+/* Names of hdata, lists, variables and keys all end up unquoted in the
+ * command, so they're limited to what WeeChat uses for them */
+static gboolean
+validate_name(LibWCHdataQuery *query,
+              const gchar *what,
+              const gchar *name) {
+    if (query->error)
+        return FALSE;
+
+    if (!name || !*name) {
+        g_set_error(&query->error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Missing %s in hdata query", what);
+        return FALSE;
+    }
+
+    for (const gchar *c = name; *c; c++) {
+        if (g_ascii_isalnum(*c) || *c == '_')
+            continue;
+
+        g_set_error(&query->error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Invalid %s in hdata query: \"%s\"", what, name);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+append_count(LibWCHdataQuery *query,
+             gint count) {
+    if (count == LIBWC_HDATA_COUNT_NONE)
+        return;
+    else if (count == LIBWC_HDATA_COUNT_ALL)
+        g_string_append(query->path, "(*)");
+    else
+        g_string_append_printf(query->path, "(%d)", count);
+}
+
+static LibWCHdataQuery *
+hdata_query_new(const gchar *hdata) {
+    LibWCHdataQuery *query = g_slice_new0(LibWCHdataQuery);
+
+    query->path = g_string_new(NULL);
+    query->keys = g_string_new(NULL);
+
+    if (validate_name(query, "hdata name", hdata))
+        g_string_append(query->path, hdata);
+
+    return query;
+}
+
+/* Starts a query at a list WeeChat keeps for the hdata, like gui_buffers for
+ * the buffer hdata */
+LibWCHdataQuery *
+libwc_hdata_query_new(const gchar *hdata,
+                      const gchar *list,
+                      gint count) {
+    LibWCHdataQuery *query = hdata_query_new(hdata);
+
+    if (validate_name(query, "list name", list)) {
+        g_string_append_printf(query->path, ":%s", list);
+        append_count(query, count);
+    }
+
+    return query;
+}
+
+/* Starts a query at an object we already have a pointer to */
+LibWCHdataQuery *
+libwc_hdata_query_new_pointer(const gchar *hdata,
+                              guint64 pointer,
+                              gint count) {
+    LibWCHdataQuery *query = hdata_query_new(hdata);
+
+    if (!query->error && !pointer) {
+        g_set_error_literal(&query->error, G_IO_ERROR,
+                            G_IO_ERROR_INVALID_ARGUMENT,
+                            "NULL pointer in hdata query");
+    }
+
+    if (!query->error) {
+        g_string_append_printf(query->path, ":0x%" G_GINT64_MODIFIER "x",
+                               pointer);
+        append_count(query, count);
+    }
+
+    return query;
+}
+
+/* Follows variable from wherever the path currently ends */
+void
+libwc_hdata_query_path(LibWCHdataQuery *query,
+                       const gchar *variable,
+                       gint count) {
+    if (!validate_name(query, "variable", variable))
+        return;
+
+    g_string_append_printf(query->path, "/%s", variable);
+    append_count(query, count);
+}
+
+/* Limits the response to the given keys of each object, instead of every
+ * variable it has. Takes a NULL terminated list, and can be called more than
+ * once */
+void
+libwc_hdata_query_keys(LibWCHdataQuery *query,
+                       ...) {
+    va_list args;
+    const gchar *key;
+
+    va_start(args, query);
+
+    while ((key = va_arg(args, const gchar*))) {
+        if (!validate_name(query, "key", key))
+            break;
+
+        /* The relay sends the key once for each time it's listed */
+        for (const gchar *pos = query->keys->str;
+             (pos = strstr(pos, key)); pos++) {
+            gsize len = strlen(key);
+
+            if ((pos == query->keys->str || pos[-1] == ',') &&
+                (pos[len] == ',' || pos[len] == '\0')) {
+                g_set_error(&query->error, G_IO_ERROR,
+                            G_IO_ERROR_INVALID_ARGUMENT,
+                            "Key \"%s\" listed twice in hdata query", key);
+                break;
+            }
+        }
+
+        if (query->error)
+            break;
+
+        if (query->keys->len)
+            g_string_append_c(query->keys, ',');
+
+        g_string_append(query->keys, key);
+    }
+
+    va_end(args);
+}
+
+/* Returns the arguments for an hdata command, or NULL with error set if
+ * anything that went into the query wasn't valid. The query can be built more
+ * than once */
+gchar *
+libwc_hdata_query_build(LibWCHdataQuery *query,
+                        GError **error) {
+    if (query->error) {
+        g_propagate_error(error, g_error_copy(query->error));
+        return NULL;
+    }
+
+    if (!query->keys->len)
+        return g_strdup(query->path->str);
+
+    return g_strdup_printf("%s %s", query->path->str, query->keys->str);
+}
+
+void
+libwc_hdata_query_free(LibWCHdataQuery *query) {
+    g_string_free(query->path, TRUE);
+    g_string_free(query->keys, TRUE);
+    g_clear_error(&query->error);
+
+    g_slice_free(LibWCHdataQuery, query);
+}
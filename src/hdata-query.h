@@ -0,0 +1,51 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+
+#ifndef HDATA_QUERY_H
+#define HDATA_QUERY_H
+
+#include <glib.h>
+
+/* Counts for a step in an hdata path. A positive count walks forwards through
+ * the list from that step, a negative one walks backwards */
+#define LIBWC_HDATA_COUNT_NONE (0)
+#define LIBWC_HDATA_COUNT_ALL  (G_MAXINT)
+
+typedef struct _LibWCHdataQuery LibWCHdataQuery;
+
+LibWCHdataQuery * libwc_hdata_query_new(const gchar *hdata,
+                                        const gchar *list,
+                                        gint count)
+G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+
+LibWCHdataQuery * libwc_hdata_query_new_pointer(const gchar *hdata,
+                                                guint64 pointer,
+                                                gint count)
+G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+
+void libwc_hdata_query_path(LibWCHdataQuery *query,
+                            const gchar *variable,
+                            gint count);
+
+void libwc_hdata_query_keys(LibWCHdataQuery *query,
+                            ...)
+G_GNUC_NULL_TERMINATED;
+
+gchar * libwc_hdata_query_build(LibWCHdataQuery *query,
+                                GError **error)
+G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+
+void libwc_hdata_query_free(LibWCHdataQuery *query);
+
+#endif /* !HDATA_QUERY_H */
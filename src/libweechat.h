@@ -17,12 +17,21 @@
 #include <glib.h>
 
 #include "relay.h"
+#include "reactor-pool.h"
+#include "shm-subscriber.h"
+#include "relay-aggregator.h"
+#include "hdata-query.h"
 
 #define LIBWC_ERROR_RELAY (g_quark_from_static_string("libwc-relay-error"))
 
 typedef enum {
     LIBWC_ERROR_RELAY_UNEXPECTED_EOM,
-    LIBWC_ERROR_RELAY_INVALID_DATA
+    LIBWC_ERROR_RELAY_INVALID_DATA,
+    LIBWC_ERROR_RELAY_CLOSED,
+    LIBWC_ERROR_RELAY_TOO_MANY_COMMANDS,
+    LIBWC_ERROR_RELAY_TIMED_OUT,
+    LIBWC_ERROR_RELAY_NOT_SUPPORTED,
+    LIBWC_ERROR_RELAY_HANDED_OFF
 } LibWCRelayError;
 
 #endif /* !LIBWEECHAT_H */
@@ -14,8 +14,35 @@
 #ifndef MISC_H
 #define MISC_H
 
+#include <glib.h>
+#include <time.h>
+
 #define LIBWC_CONSTRUCTOR __attribute__ ((constructor))
 
 #define LIBWC_GET_FIELD(data_, offset_, type_) (*((type_*)(&((gint8*)data_)[offset_])))
 
+#define LIBWC_CONTAINER_OF(ptr_, type_, member_) \
+    ((type_*)((gint8*)(ptr_) - G_STRUCT_OFFSET(type_, member_)))
+
+/* Nanoseconds since the epoch, on the same clock the kernel uses for socket
+ * receive timestamps */
+static inline gint64
+_libwc_realtime_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return now.tv_sec * G_GINT64_CONSTANT(1000000000) + now.tv_nsec;
+}
+
+/* CPU time the calling thread has used, in nanoseconds */
+static inline gint64
+_libwc_thread_cpu_time_ns() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+
+    return now.tv_sec * G_GINT64_CONSTANT(1000000000) + now.tv_nsec;
+}
+
 #endif /* !MISC_H */
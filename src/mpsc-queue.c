@@ -0,0 +1,78 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "mpsc-queue.h"
+
+#include <glib.h>
+#include <stdatomic.h>
+
+void
+_libwc_mpsc_queue_init(LibWCMpscQueue *queue) {
+    atomic_init(&queue->stub.next, NULL);
+    atomic_init(&queue->head, &queue->stub);
+    queue->tail = &queue->stub;
+}
+
+void
+_libwc_mpsc_queue_push(LibWCMpscQueue *queue,
+                       LibWCMpscNode *node) {
+    LibWCMpscNode *prev;
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+
+    /* Swing the head over to the new node, then link the old head to it. Until
+     * the second store lands the consumer will just see the queue as being
+     * empty past the old head */
+    prev = atomic_exchange_explicit(&queue->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+LibWCMpscNode *
+_libwc_mpsc_queue_pop(LibWCMpscQueue *queue) {
+    LibWCMpscNode *tail = queue->tail,
+                  *next = atomic_load_explicit(&tail->next,
+                                               memory_order_acquire),
+                  *head;
+
+    if (tail == &queue->stub) {
+        if (!next)
+            return NULL;
+
+        queue->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&next->next, memory_order_acquire);
+    }
+
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    /* A producer is in the middle of pushing something, we'll get woken up
+     * again once it's done */
+    head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail != head)
+        return NULL;
+
+    /* tail is the last node in the queue, put the stub back behind it so we
+     * can hand it out */
+    _libwc_mpsc_queue_push(queue, &queue->stub);
+
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
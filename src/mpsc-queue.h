@@ -0,0 +1,49 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <glib.h>
+#include <stdatomic.h>
+
+/* An intrusive, lock-free queue that any number of threads can push onto, but
+ * only one thread can pop from. Pushing costs a single atomic exchange.
+ *
+ * Nodes are meant to be embedded as the first member of whatever structure is
+ * being queued, so that popped nodes can just be cast back to it */
+
+typedef struct _LibWCMpscNode  LibWCMpscNode;
+typedef struct _LibWCMpscQueue LibWCMpscQueue;
+
+struct _LibWCMpscNode {
+    LibWCMpscNode *_Atomic next;
+};
+
+struct _LibWCMpscQueue {
+    LibWCMpscNode *_Atomic head;
+    LibWCMpscNode *tail;
+    LibWCMpscNode stub;
+};
+
+void _libwc_mpsc_queue_init(LibWCMpscQueue *queue)
+G_GNUC_INTERNAL;
+
+void _libwc_mpsc_queue_push(LibWCMpscQueue *queue,
+                            LibWCMpscNode *node)
+G_GNUC_INTERNAL;
+
+LibWCMpscNode * _libwc_mpsc_queue_pop(LibWCMpscQueue *queue)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+#endif /* !MPSC_QUEUE_H */
@@ -0,0 +1,54 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef REACTOR_POOL_PRIVATE_H
+#define REACTOR_POOL_PRIVATE_H
+
+#include "reactor-pool.h"
+
+#include <glib.h>
+
+/* A single event loop thread in a reactor pool. Every relay assigned to a
+ * reactor has all of its I/O done on the reactor's thread. Anyone holding on
+ * to a reactor is expected to hold a reference to its pool */
+struct _LibWCReactor {
+    LibWCReactorPool *pool;
+
+    GThread *thread;
+    GMainContext *context;
+    GMainLoop *main_loop;
+
+    gint relay_count;
+
+    /* Lazily created by the io_uring backend, and only ever touched from the
+     * reactor's thread */
+    gpointer uring;
+};
+
+typedef struct _LibWCReactor LibWCReactor;
+
+struct _LibWCReactorPoolPrivate {
+    LibWCReactor *reactors;
+    guint n_reactors;
+};
+
+LibWCReactor * _libwc_reactor_pool_acquire(LibWCReactorPool *pool)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_reactor_reacquire(LibWCReactor *reactor)
+G_GNUC_INTERNAL;
+
+void _libwc_reactor_release(LibWCReactor *reactor)
+G_GNUC_INTERNAL;
+
+#endif /* !REACTOR_POOL_PRIVATE_H */
@@ -0,0 +1,152 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "config.h"
+
+#include "reactor-pool.h"
+#include "reactor-pool-private.h"
+#include "relay-uring.h"
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_DEFINE_TYPE_WITH_PRIVATE(LibWCReactorPool, libwc_reactor_pool, G_TYPE_OBJECT);
+
+static void *
+reactor_thread_func(LibWCReactor *reactor) {
+    g_main_context_push_thread_default(reactor->context);
+    g_main_loop_run(reactor->main_loop);
+    g_main_context_pop_thread_default(reactor->context);
+
+    return NULL;
+}
+
+static void
+libwc_reactor_pool_finalize(GObject *object) {
+    LibWCReactorPool *pool = LIBWC_REACTOR_POOL(object);
+
+    for (guint i = 0; i < pool->priv->n_reactors; i++) {
+        LibWCReactor *reactor = &pool->priv->reactors[i];
+
+        g_main_loop_quit(reactor->main_loop);
+
+        /* If the last reference was dropped from one of our own threads, the
+         * best we can do is let it exit on its own */
+        if (reactor->thread == g_thread_self())
+            g_thread_unref(reactor->thread);
+        else
+            g_thread_join(reactor->thread);
+
+#ifdef HAVE_LIBURING
+        if (reactor->uring)
+            _libwc_reactor_uring_free(reactor->uring);
+#endif
+
+        g_main_loop_unref(reactor->main_loop);
+        g_main_context_unref(reactor->context);
+    }
+
+    g_free(pool->priv->reactors);
+
+    G_OBJECT_CLASS(libwc_reactor_pool_parent_class)->finalize(object);
+}
+
+static void
+libwc_reactor_pool_class_init(LibWCReactorPoolClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = libwc_reactor_pool_finalize;
+}
+
+static void
+libwc_reactor_pool_init(LibWCReactorPool *self) {
+    self->priv = libwc_reactor_pool_get_instance_private(self);
+}
+
+/* n_threads can be 0, in which case we use one thread per CPU */
+LibWCReactorPool *
+libwc_reactor_pool_new(guint n_threads) {
+    LibWCReactorPool *pool;
+
+    pool = LIBWC_REACTOR_POOL(g_object_new(LIBWC_TYPE_REACTOR_POOL, NULL));
+
+    if (n_threads == 0)
+        n_threads = g_get_num_processors();
+
+    pool->priv->n_reactors = n_threads;
+    pool->priv->reactors = g_new0(LibWCReactor, n_threads);
+
+    for (guint i = 0; i < n_threads; i++) {
+        LibWCReactor *reactor = &pool->priv->reactors[i];
+        gchar *thread_name = g_strdup_printf("libweechat-%u", i);
+
+        reactor->pool = pool;
+        reactor->context = g_main_context_new();
+        reactor->main_loop = g_main_loop_new(reactor->context, FALSE);
+        reactor->thread = g_thread_new(thread_name,
+                                       (GThreadFunc)reactor_thread_func,
+                                       reactor);
+
+        g_free(thread_name);
+    }
+
+    return pool;
+}
+
+/* The pool used by every relay that doesn't have one set explicitly. It's
+ * created the first time it's needed, and sticks around for the lifetime of
+ * the process */
+LibWCReactorPool *
+libwc_reactor_pool_get_default() {
+    static gsize default_pool = 0;
+
+    if (g_once_init_enter(&default_pool))
+        g_once_init_leave(&default_pool, (gsize)libwc_reactor_pool_new(0));
+
+    return LIBWC_REACTOR_POOL(default_pool);
+}
+
+guint
+libwc_reactor_pool_get_n_threads(LibWCReactorPool *pool) {
+    return pool->priv->n_reactors;
+}
+
+/* Hands out whichever reactor currently has the fewest relays on it */
+LibWCReactor *
+_libwc_reactor_pool_acquire(LibWCReactorPool *pool) {
+    LibWCReactor *reactor = &pool->priv->reactors[0];
+
+    for (guint i = 1; i < pool->priv->n_reactors; i++) {
+        LibWCReactor *candidate = &pool->priv->reactors[i];
+
+        if (g_atomic_int_get(&candidate->relay_count) <
+            g_atomic_int_get(&reactor->relay_count))
+            reactor = candidate;
+    }
+
+    g_atomic_int_inc(&reactor->relay_count);
+
+    return reactor;
+}
+
+/* For relays that are reconnecting, and need to stay on the reactor they were
+ * on before */
+void
+_libwc_reactor_reacquire(LibWCReactor *reactor) {
+    g_atomic_int_inc(&reactor->relay_count);
+}
+
+void
+_libwc_reactor_release(LibWCReactor *reactor) {
+    g_atomic_int_add(&reactor->relay_count, -1);
+}
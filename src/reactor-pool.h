@@ -0,0 +1,48 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef REACTOR_POOL_H
+#define REACTOR_POOL_H
+
+#include <glib-object.h>
+
+#define LIBWC_TYPE_REACTOR_POOL            (libwc_reactor_pool_get_type())
+#define LIBWC_REACTOR_POOL(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj), LIBWC_TYPE_REACTOR_POOL, LibWCReactorPool))
+#define LIBWC_IS_REACTOR_POOL(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj), LIBWC_TYPE_REACTOR_POOL))
+#define LIBWC_REACTOR_POOL_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST((klass), LIBWC_TYPE_REACTOR_POOL, LibWCReactorPoolClass))
+#define LIBWC_IS_REACTOR_POOL_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), LIBWC_TYPE_REACTOR_POOL))
+
+typedef struct _LibWCReactorPool        LibWCReactorPool;
+typedef struct _LibWCReactorPoolClass   LibWCReactorPoolClass;
+typedef struct _LibWCReactorPoolPrivate LibWCReactorPoolPrivate;
+
+struct _LibWCReactorPool {
+    GObject parent_instance;
+
+    LibWCReactorPoolPrivate *priv;
+};
+
+struct _LibWCReactorPoolClass {
+    GObjectClass parent_class;
+};
+
+GType libwc_reactor_pool_get_type();
+
+LibWCReactorPool * libwc_reactor_pool_new(guint n_threads)
+G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+
+LibWCReactorPool * libwc_reactor_pool_get_default();
+
+guint libwc_reactor_pool_get_n_threads(LibWCReactorPool *pool);
+
+#endif /* !REACTOR_POOL_H */
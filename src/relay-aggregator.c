@@ -0,0 +1,396 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-parser.h"
+#include "relay-aggregator.h"
+
+#include <glib.h>
+
+/* Merges the lines coming from several relays into one stream, ordered by the
+ * date weechat gave each line. Every relay gets a FIFO of lines it's sent that
+ * haven't been handed out yet, and every relay with anything in its FIFO sits
+ * in a min-heap keyed on the date of the line at the front of it. The line at
+ * the top of the heap can be handed out once every relay has something
+ * waiting, since nothing that comes in later can be older than it. Relays that
+ * go quiet would hold everything up forever, so lines are also handed out once
+ * they've been waiting for longer than the reorder window.
+ *
+ * Lines from one relay are assumed to already be in order. Everything here
+ * happens on the aggregator's context, so none of it needs locking */
+
+/* No matter how long the window is, this many lines waiting at once is enough
+ * to start handing them out */
+#define AGGREGATOR_MAX_PENDING (65536)
+
+typedef struct {
+    LibWCRelayMessage *message;
+    /* In seconds, like weechat sends them */
+    guint64 date;
+    /* Monotonic time the line was received at, and the order it was received
+     * in across every relay, which breaks ties between lines with the same
+     * date */
+    gint64 arrival;
+    guint64 serial;
+} LibWCAggregatorLine;
+
+typedef struct {
+    LibWCRelayAggregator *aggregator;
+    LibWCRelay *relay;
+    gchar *tag;
+
+    GQueue lines;
+    /* Where we are in the heap, -1 when we have no lines waiting */
+    gint heap_index;
+} LibWCAggregatorSource;
+
+struct _LibWCRelayAggregator {
+    GMainContext *context;
+    gint64 window;
+
+    LibWCAggregatorLineFunc func;
+    LibWCRelayEventFunc other_func;
+    void *user_data;
+
+    GPtrArray *sources;
+    GPtrArray *heap;
+    guint pending;
+    guint64 next_serial;
+
+    /* Wakes us up when the oldest line waiting runs out of time */
+    GSource *timer;
+};
+
+static void
+aggregator_line_free(LibWCAggregatorLine *line) {
+    _libwc_relay_message_free(line->message);
+    g_free(line);
+}
+
+/* Returns the date of the first line in a _buffer_line_added event's hdata, or
+ * 0 if it doesn't have one */
+static guint64
+aggregator_line_get_date(LibWCRelayMessage *message) {
+    LibWCRelayMessageObject *object;
+    GVariant *items, *item, *item_tuple, *keys;
+    guint64 date = 0;
+
+    if (!message->objects)
+        return 0;
+
+    object = message->objects->data;
+    if (object->type != LIBWC_OBJECT_TYPE_HDATA)
+        return 0;
+
+    items = g_variant_get_child_value(object->value, 2);
+    if (g_variant_n_children(items)) {
+        item = g_variant_get_child_value(items, 0);
+        item_tuple = g_variant_get_variant(item);
+        keys = g_variant_get_child_value(item_tuple, 1);
+
+        g_variant_lookup(keys, "date", "t", &date);
+
+        g_variant_unref(keys);
+        g_variant_unref(item_tuple);
+        g_variant_unref(item);
+    }
+    g_variant_unref(items);
+
+    return date;
+}
+
+static inline gboolean
+aggregator_source_before(LibWCAggregatorSource *a,
+                         LibWCAggregatorSource *b) {
+    LibWCAggregatorLine *line_a = g_queue_peek_head(&a->lines),
+                        *line_b = g_queue_peek_head(&b->lines);
+
+    if (line_a->date != line_b->date)
+        return line_a->date < line_b->date;
+
+    return line_a->serial < line_b->serial;
+}
+
+static inline void
+aggregator_heap_set(GPtrArray *heap,
+                    guint index,
+                    LibWCAggregatorSource *source) {
+    heap->pdata[index] = source;
+    source->heap_index = index;
+}
+
+static void
+aggregator_heap_sift_up(GPtrArray *heap,
+                        guint index) {
+    LibWCAggregatorSource *source = heap->pdata[index];
+
+    while (index > 0) {
+        guint parent = (index - 1) / 2;
+
+        if (!aggregator_source_before(source, heap->pdata[parent]))
+            break;
+
+        aggregator_heap_set(heap, index, heap->pdata[parent]);
+        index = parent;
+    }
+
+    aggregator_heap_set(heap, index, source);
+}
+
+static void
+aggregator_heap_sift_down(GPtrArray *heap,
+                          guint index) {
+    LibWCAggregatorSource *source = heap->pdata[index];
+
+    for (;;) {
+        guint child = index * 2 + 1;
+
+        if (child >= heap->len)
+            break;
+
+        if (child + 1 < heap->len &&
+            aggregator_source_before(heap->pdata[child + 1],
+                                     heap->pdata[child]))
+            child++;
+
+        if (!aggregator_source_before(heap->pdata[child], source))
+            break;
+
+        aggregator_heap_set(heap, index, heap->pdata[child]);
+        index = child;
+    }
+
+    aggregator_heap_set(heap, index, source);
+}
+
+/* Takes the line at the front of the source at the top of the heap, and fixes
+ * the heap back up afterwards */
+static LibWCAggregatorLine *
+aggregator_heap_pop_line(LibWCRelayAggregator *aggregator) {
+    GPtrArray *heap = aggregator->heap;
+    LibWCAggregatorSource *source = heap->pdata[0],
+                          *last;
+    LibWCAggregatorLine *line = g_queue_pop_head(&source->lines);
+
+    if (g_queue_is_empty(&source->lines)) {
+        source->heap_index = -1;
+
+        last = g_ptr_array_remove_index(heap, heap->len - 1);
+        if (last != source) {
+            aggregator_heap_set(heap, 0, last);
+            aggregator_heap_sift_down(heap, 0);
+        }
+    }
+    else {
+        aggregator_heap_sift_down(heap, 0);
+    }
+
+    aggregator->pending--;
+
+    return line;
+}
+
+/* The time the oldest line waiting runs out of time, or -1 if there aren't any
+ * lines waiting */
+static gint64
+aggregator_get_deadline(LibWCRelayAggregator *aggregator) {
+    gint64 deadline = -1;
+
+    for (guint i = 0; i < aggregator->heap->len; i++) {
+        LibWCAggregatorSource *source = aggregator->heap->pdata[i];
+        LibWCAggregatorLine *line = g_queue_peek_head(&source->lines);
+
+        if (deadline == -1 || line->arrival + aggregator->window < deadline)
+            deadline = line->arrival + aggregator->window;
+    }
+
+    return deadline;
+}
+
+/* Hands out every line that's safe to hand out. If force is set, every line
+ * gets handed out */
+static void
+aggregator_release(LibWCRelayAggregator *aggregator,
+                   gboolean force) {
+    GPtrArray *heap = aggregator->heap;
+    LibWCAggregatorSource *source;
+    LibWCAggregatorLine *line;
+    gint64 now = g_get_monotonic_time(),
+           deadline;
+
+    while (heap->len) {
+        if (!force && heap->len < aggregator->sources->len &&
+            aggregator->pending <= AGGREGATOR_MAX_PENDING &&
+            aggregator_get_deadline(aggregator) > now)
+            break;
+
+        source = heap->pdata[0];
+        line = aggregator_heap_pop_line(aggregator);
+
+        if (aggregator->func)
+            aggregator->func(aggregator, source->relay, source->tag,
+                             line->message, aggregator->user_data);
+
+        aggregator_line_free(line);
+    }
+
+    deadline = aggregator_get_deadline(aggregator);
+    g_source_set_ready_time(aggregator->timer, deadline);
+}
+
+static gboolean
+aggregator_timer_dispatch(GSource *source,
+                          GSourceFunc callback,
+                          void *user_data) {
+    aggregator_release(user_data, FALSE);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs aggregator_timer_funcs = {
+    .dispatch = aggregator_timer_dispatch
+};
+
+/* Runs on the aggregator's context */
+static void
+aggregator_events_cb(LibWCRelay *relay,
+                     LibWCRelayMessage **events,
+                     guint n_events,
+                     LibWCAggregatorSource *source) {
+    LibWCRelayAggregator *aggregator = source->aggregator;
+    LibWCAggregatorLine *line;
+    gint64 now = g_get_monotonic_time();
+    guint n_other = 0;
+
+    for (guint i = 0; i < n_events; i++) {
+        LibWCRelayMessage *event = events[i];
+
+        if (event->event_id != LIBWC_EVENT_BUFFER_LINE_ADDED) {
+            events[n_other++] = event;
+            continue;
+        }
+
+        line = g_new(LibWCAggregatorLine, 1);
+        line->message = event;
+        line->arrival = now;
+        line->serial = aggregator->next_serial++;
+
+        /* Lines without a date get treated as if they just happened */
+        line->date = aggregator_line_get_date(event);
+        if (!line->date)
+            line->date = g_get_real_time() / G_USEC_PER_SEC;
+
+        g_queue_push_tail(&source->lines, line);
+        aggregator->pending++;
+
+        if (source->heap_index == -1) {
+            g_ptr_array_add(aggregator->heap, source);
+            aggregator_heap_sift_up(aggregator->heap,
+                                    aggregator->heap->len - 1);
+        }
+    }
+
+    /* The lines belong to us now, so the event source can't free them */
+    for (guint i = n_other; i < n_events; i++)
+        events[i] = NULL;
+
+    if (n_other && aggregator->other_func)
+        aggregator->other_func(relay, events, n_other, aggregator->user_data);
+
+    aggregator_release(aggregator, FALSE);
+}
+
+static void
+aggregator_source_free(LibWCAggregatorSource *source) {
+    libwc_relay_event_handler_set(source->relay, NULL, NULL, NULL, NULL);
+
+    g_queue_free_full(&source->lines, (GDestroyNotify)aggregator_line_free);
+    g_object_unref(source->relay);
+    g_free(source->tag);
+    g_free(source);
+}
+
+/* Creates an aggregator that merges the lines from each of the relays added to
+ * it with libwc_relay_aggregator_add(), handing them to func from context in
+ * the order of their dates. A line is held back for at most window
+ * milliseconds waiting on lines from other relays that might be older than
+ * it. Every other event gets handed to other_func, if set, as it comes in.
+ * The aggregator must only be used from the thread that owns context */
+LibWCRelayAggregator *
+libwc_relay_aggregator_new(GMainContext *context,
+                           guint window,
+                           LibWCAggregatorLineFunc func,
+                           LibWCRelayEventFunc other_func,
+                           void *user_data) {
+    LibWCRelayAggregator *aggregator = g_new0(LibWCRelayAggregator, 1);
+
+    aggregator->context = context ? g_main_context_ref(context) :
+                                    g_main_context_ref_thread_default();
+    aggregator->window = (gint64)window * 1000;
+    aggregator->func = func;
+    aggregator->other_func = other_func;
+    aggregator->user_data = user_data;
+
+    aggregator->sources = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)aggregator_source_free);
+    aggregator->heap = g_ptr_array_new();
+
+    aggregator->timer = g_source_new(&aggregator_timer_funcs, sizeof(GSource));
+    g_source_set_name(aggregator->timer, "libweechat aggregator");
+    g_source_set_callback(aggregator->timer, NULL, aggregator, NULL);
+    g_source_attach(aggregator->timer, aggregator->context);
+
+    return aggregator;
+}
+
+/* Adds relay to the aggregator, which takes over delivering its events. Lines
+ * from it get passed to the aggregator's callback along with tag */
+void
+libwc_relay_aggregator_add(LibWCRelayAggregator *aggregator,
+                           LibWCRelay *relay,
+                           const gchar *tag) {
+    LibWCAggregatorSource *source = g_new0(LibWCAggregatorSource, 1);
+
+    source->aggregator = aggregator;
+    source->relay = g_object_ref(relay);
+    source->tag = g_strdup(tag);
+    source->heap_index = -1;
+    g_queue_init(&source->lines);
+
+    g_ptr_array_add(aggregator->sources, source);
+
+    libwc_relay_event_handler_set(relay, aggregator->context,
+                                  (LibWCRelayEventFunc)aggregator_events_cb,
+                                  source, NULL);
+}
+
+/* Hands out every line that's waiting right away, without waiting for any of
+ * them to run out of time */
+void
+libwc_relay_aggregator_flush(LibWCRelayAggregator *aggregator) {
+    aggregator_release(aggregator, TRUE);
+}
+
+/* Stops delivering events from all of the aggregator's relays. Lines that are
+ * still waiting get dropped */
+void
+libwc_relay_aggregator_free(LibWCRelayAggregator *aggregator) {
+    g_source_destroy(aggregator->timer);
+    g_source_unref(aggregator->timer);
+
+    g_ptr_array_unref(aggregator->heap);
+    g_ptr_array_unref(aggregator->sources);
+    g_main_context_unref(aggregator->context);
+    g_free(aggregator);
+}
@@ -0,0 +1,48 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_AGGREGATOR_H
+#define RELAY_AGGREGATOR_H
+
+#include <glib.h>
+
+#include "relay.h"
+#include "relay-parser.h"
+
+typedef struct _LibWCRelayAggregator LibWCRelayAggregator;
+
+/* Called with each _buffer_line_added event, in order of the date of the line
+ * it carries. relay and tag say which relay it came from. The event is owned
+ * by libweechat, and is only valid until the callback returns */
+typedef void (*LibWCAggregatorLineFunc)(LibWCRelayAggregator *aggregator,
+                                        LibWCRelay *relay,
+                                        const gchar *tag,
+                                        LibWCRelayMessage *line,
+                                        void *user_data);
+
+LibWCRelayAggregator * libwc_relay_aggregator_new(GMainContext *context,
+                                                  guint window,
+                                                  LibWCAggregatorLineFunc func,
+                                                  LibWCRelayEventFunc other_func,
+                                                  void *user_data)
+G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+
+void libwc_relay_aggregator_add(LibWCRelayAggregator *aggregator,
+                                LibWCRelay *relay,
+                                const gchar *tag);
+
+void libwc_relay_aggregator_flush(LibWCRelayAggregator *aggregator);
+
+void libwc_relay_aggregator_free(LibWCRelayAggregator *aggregator);
+
+#endif /* !RELAY_AGGREGATOR_H */
@@ -0,0 +1,488 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "async-wrapper.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-connection.h"
+#include "relay-capture.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/* Records get built up here, and only hit the disk once there's this much */
+#define CAPTURE_BUFFER_SIZE ((guint)65536)
+
+/* How many full buffers can be waiting on the writer thread before we decide
+ * the disk can't keep up */
+#define CAPTURE_MAX_PENDING_BUFFERS (64)
+
+/* How many records a replay goes through before letting the rest of the
+ * reactor have a turn */
+#define REPLAY_BATCH_SIZE (64)
+
+#define RECORD_PADDING(length_) ((8 - ((length_) % 8)) % 8)
+
+/* Records are appended from the reactor thread with the relay's capture mutex
+ * held, but nothing on that side ever touches the disk. Full buffers are handed
+ * to writer through pending instead, so a slow disk can only ever hold up the
+ * capture and not every relay on the reactor */
+struct _LibWCRelayCapture {
+    gint fd;
+    GByteArray *buffer;
+    gboolean failed;
+
+    GThread *writer;
+    GAsyncQueue *pending;
+    gint pending_count;
+    gint write_failed;
+};
+
+typedef struct {
+    GMappedFile *file;
+    const guint8 *pos;
+    const guint8 *end;
+
+    gboolean realtime;
+    gint64 start_time;
+    gint64 first_timestamp;
+} LibWCReplay;
+
+static const guint8 padding[8] = { 0 };
+
+/* Pushed onto the writer's queue to tell it to finish up */
+static GByteArray capture_writer_stop;
+
+static gpointer
+capture_writer(LibWCRelayCapture *capture) {
+    GByteArray *buffer;
+    const guint8 *pos;
+    gsize remaining;
+    gssize written;
+
+    while ((buffer = g_async_queue_pop(capture->pending)) !=
+           &capture_writer_stop) {
+        pos = buffer->data;
+        remaining = buffer->len;
+
+        while (remaining && !g_atomic_int_get(&capture->write_failed)) {
+            written = write(capture->fd, pos, remaining);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+
+                g_warning("Couldn't write to capture file, no longer "
+                          "capturing: %s", g_strerror(errno));
+                g_atomic_int_set(&capture->write_failed, TRUE);
+                break;
+            }
+
+            pos += written;
+            remaining -= written;
+        }
+
+        g_byte_array_free(buffer, TRUE);
+        g_atomic_int_add(&capture->pending_count, -1);
+    }
+
+    return NULL;
+}
+
+/* Hands the current buffer off to the writer thread. If the writer's too far
+ * behind, we stop capturing instead of dropping records from the middle of the
+ * file */
+static void
+capture_flush(LibWCRelayCapture *capture) {
+    if (!capture->buffer->len)
+        return;
+
+    if (g_atomic_int_get(&capture->write_failed))
+        capture->failed = TRUE;
+
+    if (!capture->failed &&
+        g_atomic_int_get(&capture->pending_count) >=
+        CAPTURE_MAX_PENDING_BUFFERS) {
+        g_warning("Capture file can't keep up with the relay, no longer "
+                  "capturing");
+        capture->failed = TRUE;
+    }
+
+    if (capture->failed) {
+        g_byte_array_set_size(capture->buffer, 0);
+        return;
+    }
+
+    g_atomic_int_inc(&capture->pending_count);
+    g_async_queue_push(capture->pending, capture->buffer);
+    capture->buffer = g_byte_array_sized_new(CAPTURE_BUFFER_SIZE);
+}
+
+static void
+capture_free(LibWCRelayCapture *capture) {
+    capture_flush(capture);
+
+    g_async_queue_push(capture->pending, &capture_writer_stop);
+    g_thread_join(capture->writer);
+
+    close(capture->fd);
+    g_async_queue_unref(capture->pending);
+    g_byte_array_free(capture->buffer, TRUE);
+    g_free(capture);
+}
+
+/* The record's data gets passed in two parts, so frames don't need their
+ * header and payload put back together first */
+static void
+capture_append(LibWCRelayCapture *capture,
+               LibWCCaptureRecordType type,
+               const void *data1,
+               gsize data1_size,
+               const void *data2,
+               gsize data2_size) {
+    LibWCCaptureRecordHeader header;
+    gsize length = data1_size + data2_size;
+
+    if (capture->failed || length > G_MAXUINT32)
+        return;
+
+    header = (LibWCCaptureRecordHeader) {
+        .type = GUINT32_TO_LE(type),
+        .length = GUINT32_TO_LE(length),
+        .timestamp = GINT64_TO_LE(g_get_monotonic_time())
+    };
+
+    g_byte_array_append(capture->buffer, (guint8*)&header, sizeof(header));
+    g_byte_array_append(capture->buffer, data1, data1_size);
+    if (data2_size)
+        g_byte_array_append(capture->buffer, data2, data2_size);
+    g_byte_array_append(capture->buffer, padding, RECORD_PADDING(length));
+
+    if (capture->buffer->len >= CAPTURE_BUFFER_SIZE)
+        capture_flush(capture);
+}
+
+/* Runs on the relay's reactor thread */
+void
+_libwc_relay_capture_frame(LibWCRelay *relay,
+                           const guint8 *header,
+                           const void *payload,
+                           gsize payload_size) {
+    g_mutex_lock(&relay->priv->capture_mutex);
+
+    if (relay->priv->capture)
+        capture_append(relay->priv->capture, LIBWC_CAPTURE_RECORD_FRAME,
+                       header, LIBWC_RELAY_HEADER_SIZE, payload, payload_size);
+
+    g_mutex_unlock(&relay->priv->capture_mutex);
+}
+
+/* Runs on the relay's reactor thread */
+void
+_libwc_relay_capture_command(LibWCRelay *relay,
+                             GBytes *command) {
+    static const gchar redacted_init[] = "init\n";
+    gconstpointer data;
+    gsize size;
+
+    data = g_bytes_get_data(command, &size);
+
+    /* Passwords have no business ending up on disk */
+    if (size >= 5 && memcmp(data, "init ", 5) == 0) {
+        data = redacted_init;
+        size = sizeof(redacted_init) - 1;
+    }
+
+    g_mutex_lock(&relay->priv->capture_mutex);
+
+    if (relay->priv->capture)
+        capture_append(relay->priv->capture, LIBWC_CAPTURE_RECORD_COMMAND,
+                       data, size, NULL, 0);
+
+    g_mutex_unlock(&relay->priv->capture_mutex);
+}
+
+/* Starts recording every frame received from the relay, along with every
+ * command sent to it, to a new file at path. Replaces any capture that was
+ * already running. Captures can be started and stopped at any point, but
+ * starting one in the middle of a connection means the first frame recorded
+ * might not be the first one the relay sent */
+gboolean
+libwc_relay_capture_start(LibWCRelay *relay,
+                          const gchar *path,
+                          GError **error) {
+    LibWCRelayCapture *capture, *old_capture;
+    LibWCCaptureFileHeader header = {
+        .magic = LIBWC_CAPTURE_MAGIC,
+        .version = GUINT32_TO_LE(LIBWC_CAPTURE_VERSION)
+    };
+    gint fd;
+
+    fd = g_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        gint saved_errno = errno;
+
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Couldn't open %s: %s", path, g_strerror(saved_errno));
+        return FALSE;
+    }
+
+    capture = g_new0(LibWCRelayCapture, 1);
+    capture->fd = fd;
+    capture->buffer = g_byte_array_sized_new(CAPTURE_BUFFER_SIZE);
+    g_byte_array_append(capture->buffer, (guint8*)&header, sizeof(header));
+    capture->pending = g_async_queue_new();
+    capture->writer = g_thread_new("libweechat-capture",
+                                   (GThreadFunc)capture_writer, capture);
+
+    g_mutex_lock(&relay->priv->capture_mutex);
+    old_capture = relay->priv->capture;
+    g_atomic_pointer_set(&relay->priv->capture, capture);
+    g_mutex_unlock(&relay->priv->capture_mutex);
+
+    if (old_capture)
+        capture_free(old_capture);
+
+    return TRUE;
+}
+
+void
+libwc_relay_capture_stop(LibWCRelay *relay) {
+    LibWCRelayCapture *capture;
+
+    g_mutex_lock(&relay->priv->capture_mutex);
+    capture = relay->priv->capture;
+    g_atomic_pointer_set(&relay->priv->capture, NULL);
+    g_mutex_unlock(&relay->priv->capture_mutex);
+
+    if (capture)
+        capture_free(capture);
+}
+
+static void
+replay_free(LibWCReplay *replay) {
+    g_mapped_file_unref(replay->file);
+    g_free(replay);
+}
+
+static gboolean replay_step(GTask *task);
+
+static void
+replay_schedule(GTask *task,
+                guint delay) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    GSource *source = g_timeout_source_new(delay);
+
+    g_source_set_callback(source, (GSourceFunc)replay_step, task, NULL);
+    g_source_attach(source, relay->priv->context);
+    g_source_unref(source);
+}
+
+/* Ends the fake connection the replay was fed through, and hands back the
+ * result. Takes ownership of error */
+static void
+replay_return(GTask *task,
+              GError *error) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+
+    if (relay->priv->connected)
+        _libwc_relay_connection_end_on_error(relay, NULL);
+
+    if (error)
+        g_task_return_error(task, error);
+    else
+        g_task_return_boolean(task, TRUE);
+
+    g_object_unref(task);
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+replay_step(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    LibWCReplay *replay = g_task_get_task_data(task);
+    const LibWCCaptureRecordHeader *header;
+    GError *error = NULL;
+    gint64 due, now;
+    gsize length;
+
+    for (guint i = 0; i < REPLAY_BATCH_SIZE; i++) {
+        if (g_task_return_error_if_cancelled(task)) {
+            if (relay->priv->connected)
+                _libwc_relay_connection_end_on_error(relay, NULL);
+
+            g_object_unref(task);
+            return G_SOURCE_REMOVE;
+        }
+
+        /* Frames are only ever invalid if they end the connection */
+        if (!relay->priv->connected) {
+            replay_return(task, g_error_new_literal(
+                LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
+                "The capture contained a frame that couldn't be decoded"));
+            return G_SOURCE_REMOVE;
+        }
+
+        if (replay->pos == replay->end) {
+            /* Give the decode threads a chance to catch up, otherwise ending
+             * the connection would throw out whatever they're working on */
+            if (relay->priv->decoder &&
+                !_libwc_relay_decoder_is_idle(relay->priv->decoder)) {
+                replay_schedule(task, 1);
+                return G_SOURCE_REMOVE;
+            }
+
+            replay_return(task, NULL);
+            return G_SOURCE_REMOVE;
+        }
+
+        header = (const LibWCCaptureRecordHeader*)replay->pos;
+        if ((gsize)(replay->end - replay->pos) < sizeof(*header))
+            goto truncated;
+
+        length = GUINT32_FROM_LE(header->length);
+        if ((gsize)(replay->end - replay->pos) - sizeof(*header) <
+            length + RECORD_PADDING(length))
+            goto truncated;
+
+        if (replay->realtime) {
+            now = g_get_monotonic_time();
+            due = replay->start_time +
+                  (GINT64_FROM_LE(header->timestamp) - replay->first_timestamp);
+
+            if (due > now) {
+                replay_schedule(task, (due - now) / 1000);
+                return G_SOURCE_REMOVE;
+            }
+        }
+
+        if (GUINT32_FROM_LE(header->type) == LIBWC_CAPTURE_RECORD_FRAME)
+            _libwc_relay_connection_feed(relay, replay->pos + sizeof(*header),
+                                         length);
+
+        replay->pos += sizeof(*header) + length + RECORD_PADDING(length);
+    }
+
+    replay_schedule(task, 0);
+    return G_SOURCE_REMOVE;
+
+truncated:
+    error = g_error_new_literal(LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_INVALID_DATA,
+                                "The capture file is truncated");
+    replay_return(task, error);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+replay_start_worker(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    LibWCReplay *replay = g_task_get_task_data(task);
+    const LibWCCaptureRecordHeader *first = (const void*)replay->pos;
+
+    relay->priv->connected = TRUE;
+    _libwc_relay_connection_reset_reader(relay);
+
+    replay->start_time = g_get_monotonic_time();
+    if ((gsize)(replay->end - replay->pos) >= sizeof(*first))
+        replay->first_timestamp = GINT64_FROM_LE(first->timestamp);
+
+    replay_step(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Feeds the frames in a capture back through the relay, as if they had just
+ * been received from a real connection: they get decompressed, parsed and
+ * dispatched to the event handlers exactly the same way. With realtime set,
+ * frames are spaced out the way they were when they were captured, otherwise
+ * they go through as fast as the relay can take them.
+ *
+ * The relay can't be connected, and shouldn't have reconnecting or a standby
+ * set up. Commands recorded in the capture aren't sent anywhere */
+void
+libwc_relay_replay_async(LibWCRelay *relay,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         void *user_data,
+                         const gchar *path,
+                         gboolean realtime) {
+    const LibWCCaptureFileHeader *header;
+    LibWCReplay *replay;
+    GMappedFile *file;
+    GTask *task;
+    GError *error = NULL;
+
+    g_assert_false(relay->priv->connected);
+
+    task = g_task_new(relay, cancellable, callback, user_data);
+
+    file = g_mapped_file_new(path, FALSE, &error);
+    if (!file) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    header = (const void*)g_mapped_file_get_contents(file);
+    if (g_mapped_file_get_length(file) < sizeof(*header) ||
+        memcmp(header->magic, LIBWC_CAPTURE_MAGIC, sizeof(header->magic)) != 0 ||
+        GUINT32_FROM_LE(header->version) != LIBWC_CAPTURE_VERSION) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_INVALID_DATA,
+                                "%s isn't a capture file libweechat can read",
+                                path);
+        g_mapped_file_unref(file);
+        g_object_unref(task);
+        return;
+    }
+
+    replay = g_new0(LibWCReplay, 1);
+    replay->file = file;
+    replay->pos = (const guint8*)header + sizeof(*header);
+    replay->end = (const guint8*)header + g_mapped_file_get_length(file);
+    replay->realtime = realtime;
+    g_task_set_task_data(task, replay, (GDestroyNotify)replay_free);
+
+    _libwc_relay_connection_acquire_reactor(relay);
+
+    g_main_context_invoke(relay->priv->context,
+                          (GSourceFunc)replay_start_worker, task);
+}
+
+gboolean
+libwc_relay_replay_finish(LibWCRelay *relay,
+                          GAsyncResult *res,
+                          GError **error) {
+    g_assert_null(*error);
+    g_return_val_if_fail(g_task_is_valid(res, relay), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(res), error);
+}
+
+gboolean
+libwc_relay_replay(LibWCRelay *relay,
+                   GCancellable *cancellable,
+                   GError **error,
+                   const gchar *path,
+                   gboolean realtime) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_replay, gboolean,
+                           libwc_relay_replay_async, path, realtime);
+}
@@ -0,0 +1,67 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_CAPTURE_H
+#define RELAY_CAPTURE_H
+
+#include "libweechat.h"
+
+#include <glib.h>
+
+/* Capture files are made to be mmap()ed and walked through in place. Every
+ * field is little endian, and every record starts on an 8 byte boundary:
+ *
+ *   file header:   "LWCCAP\0\0", guint32 version, guint32 reserved
+ *   record header: guint32 type, guint32 length, gint64 timestamp
+ *   record data:   length bytes, padded with zeroes to a multiple of 8
+ *
+ * Timestamps are from g_get_monotonic_time(), in microseconds. Frames are
+ * recorded exactly as the relay sent them, header included, once they've been
+ * received completely */
+
+#define LIBWC_CAPTURE_MAGIC   "LWCCAP\0\0"
+#define LIBWC_CAPTURE_VERSION (1)
+
+typedef enum {
+    LIBWC_CAPTURE_RECORD_FRAME   = 1,
+    LIBWC_CAPTURE_RECORD_COMMAND = 2
+} LibWCCaptureRecordType;
+
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    guint32 reserved;
+} LibWCCaptureFileHeader;
+
+typedef struct {
+    guint32 type;
+    guint32 length;
+    gint64 timestamp;
+} LibWCCaptureRecordHeader;
+
+G_STATIC_ASSERT(sizeof(LibWCCaptureFileHeader) == 16);
+G_STATIC_ASSERT(sizeof(LibWCCaptureRecordHeader) == 16);
+
+typedef struct _LibWCRelayCapture LibWCRelayCapture;
+
+void _libwc_relay_capture_frame(LibWCRelay *relay,
+                                const guint8 *header,
+                                const void *payload,
+                                gsize payload_size)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_capture_command(LibWCRelay *relay,
+                                  GBytes *command)
+G_GNUC_INTERNAL;
+
+#endif /* !RELAY_CAPTURE_H */
@@ -17,7 +17,12 @@
 #include "relay-command.h"
 #include "relay-connection.h"
 #include "relay-private.h"
+#include "relay-parser.h"
+#include "command-slab.h"
+#include "timer-wheel.h"
 #include "printf-format-wrappers.h"
+#include "command-encoder.h"
+#include "misc.h"
 
 #include <glib.h>
 #include <gio/gio.h>
@@ -25,80 +30,519 @@
 
 guint
 _libwc_command_id_new(LibWCRelay *relay) {
-    guint new_id;
+    return _libwc_command_slab_alloc(&relay->priv->pending_commands);
+}
+
+/* Only for IDs that never had a task added to them */
+void
+_libwc_command_id_free(LibWCRelay *relay,
+                       guint id) {
+    _libwc_command_slab_release(&relay->priv->pending_commands, id);
+}
+
+static inline guint64
+current_deadline_tick() {
+    return g_get_monotonic_time() / (LIBWC_DEADLINE_TICK_MS * 1000);
+}
+
+static void
+deadlines_reschedule(LibWCRelay *relay) {
+    guint64 next_tick;
 
-    g_mutex_lock(&relay->priv->pending_tasks_mutex);
+    if (!relay->priv->deadline_source)
+        return;
 
-    /* Starting from next_cmd_id, find the first ID that isn't already taken by
-     * another pending task */
-    for (new_id = relay->priv->next_cmd_id;
-         g_hash_table_contains(relay->priv->pending_tasks,
-                               GUINT_TO_POINTER(new_id)) || new_id == 0;
-         new_id++);
+    next_tick = _libwc_timer_wheel_next_tick(&relay->priv->deadline_wheel);
+    if (next_tick == G_MAXUINT64)
+        g_source_set_ready_time(relay->priv->deadline_source, -1);
+    else
+        g_source_set_ready_time(relay->priv->deadline_source,
+                                next_tick * LIBWC_DEADLINE_TICK_MS * 1000);
+}
 
-    relay->priv->next_cmd_id = new_id + 1;
+static void
+pending_command_expired_cb(LibWCTimer *timer,
+                           LibWCRelay *relay) {
+    LibWCCommandSlot *slot =
+        LIBWC_CONTAINER_OF(timer, LibWCCommandSlot, deadline);
 
-    g_mutex_unlock(&relay->priv->pending_tasks_mutex);
+    g_task_return_new_error(slot->task, LIBWC_ERROR_RELAY,
+                            LIBWC_ERROR_RELAY_TIMED_OUT,
+                            "Timed out waiting for a response from the relay");
 
-    return new_id;
+    /* If the response ever does show up, the slot's generation will have
+     * changed and it'll just get ignored */
+    _libwc_relay_pending_tasks_remove(relay, slot->id);
+}
+
+static gboolean
+deadline_source_dispatch(GSource *source,
+                         GSourceFunc callback,
+                         void *user_data) {
+    LibWCRelay *relay = user_data;
+
+    _libwc_timer_wheel_advance(&relay->priv->deadline_wheel,
+                               current_deadline_tick());
+    deadlines_reschedule(relay);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs deadline_source_funcs = {
+    .dispatch = deadline_source_dispatch
+};
+
+void
+_libwc_relay_deadlines_init(LibWCRelay *relay) {
+    _libwc_timer_wheel_init(&relay->priv->deadline_wheel,
+                            current_deadline_tick(),
+                            (LibWCTimerFunc)pending_command_expired_cb, relay);
+}
+
+/* Must be called from the libweechat thread */
+void
+_libwc_relay_deadlines_attach(LibWCRelay *relay) {
+    GSource *source = g_source_new(&deadline_source_funcs, sizeof(GSource));
+
+    g_source_set_callback(source, NULL, relay, NULL);
+    g_source_set_ready_time(source, -1);
+    g_source_attach(source, relay->priv->context);
+
+    relay->priv->deadline_source = source;
+    deadlines_reschedule(relay);
 }
 
 void
 _libwc_relay_pending_tasks_add(LibWCRelay *relay,
                                guint id,
-                               GTask *task) {
-    g_mutex_lock(&relay->priv->pending_tasks_mutex);
-    g_hash_table_insert(relay->priv->pending_tasks, GUINT_TO_POINTER(id),
-                        g_object_ref_sink(task));
-    g_mutex_unlock(&relay->priv->pending_tasks_mutex);
+                               GTask *task,
+                               guint timeout,
+                               GBytes *replay_data) {
+    LibWCCommandSlot *slot =
+        _libwc_command_slab_lookup(&relay->priv->pending_commands, id);
+    guint64 now;
+
+    g_return_if_fail(slot != NULL && slot->task == NULL);
+
+    slot->id = id;
+    slot->task = g_object_ref_sink(task);
+    slot->replay_data = replay_data ? g_bytes_ref(replay_data) : NULL;
+
+    if (timeout == LIBWC_TIMEOUT_DEFAULT)
+        timeout = g_atomic_int_get(&relay->priv->default_timeout);
+
+    if (timeout == LIBWC_TIMEOUT_DEFAULT || timeout == LIBWC_TIMEOUT_NONE)
+        return;
+
+    /* Round up, a deadline should never fire early */
+    now = current_deadline_tick();
+    _libwc_timer_wheel_add(&relay->priv->deadline_wheel, &slot->deadline, now,
+                           now + 1 + (timeout + LIBWC_DEADLINE_TICK_MS - 1) /
+                           LIBWC_DEADLINE_TICK_MS);
+    deadlines_reschedule(relay);
 }
 
 void
 _libwc_relay_pending_tasks_remove(LibWCRelay *relay,
                                   guint id) {
-    g_mutex_lock(&relay->priv->pending_tasks_mutex);
-    g_hash_table_remove(relay->priv->pending_tasks, GUINT_TO_POINTER(id));
-    g_mutex_unlock(&relay->priv->pending_tasks_mutex);
+    LibWCCommandSlot *slot =
+        _libwc_command_slab_lookup(&relay->priv->pending_commands, id);
+
+    if (!slot || !slot->task)
+        return;
+
+    _libwc_timer_wheel_remove(&relay->priv->deadline_wheel, &slot->deadline);
+    g_clear_pointer(&slot->replay_data, g_bytes_unref);
+    g_object_unref(slot->task);
+    _libwc_command_slab_release(&relay->priv->pending_commands, id);
+
+    _libwc_relay_window_adjust(relay, -1, 0);
 }
 
 GTask *
 _libwc_relay_pending_tasks_lookup(LibWCRelay *relay,
                                   guint id) {
+    LibWCCommandSlot *slot =
+        _libwc_command_slab_lookup(&relay->priv->pending_commands, id);
+
+    return slot ? slot->task : NULL;
+}
+
+static void
+collect_pending_id(guint id,
+                   LibWCCommandSlot *slot,
+                   GArray *ids) {
+    g_array_append_val(ids, id);
+}
+
+void
+_libwc_relay_pending_tasks_fail_all(LibWCRelay *relay,
+                                    const GError *error) {
+    GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    _libwc_command_slab_foreach(&relay->priv->pending_commands,
+                                (LibWCCommandSlabFunc)collect_pending_id, ids);
+
+    for (guint i = 0; i < ids->len; i++) {
+        guint id = g_array_index(ids, guint, i);
+        GTask *task = _libwc_relay_pending_tasks_lookup(relay, id);
+
+        if (error)
+            g_task_return_error(task, g_error_copy(error));
+        else
+            g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                    LIBWC_ERROR_RELAY_CLOSED,
+                                    "The connection to the relay was closed");
+
+        _libwc_relay_pending_tasks_remove(relay, id);
+    }
+
+    g_array_free(ids, TRUE);
+}
+
+void
+_libwc_relay_pending_tasks_fail(LibWCRelay *relay,
+                                guint id,
+                                const GError *error) {
+    GTask *task = _libwc_relay_pending_tasks_lookup(relay, id);
+
+    if (!task)
+        return;
+
+    g_task_return_error(task, g_error_copy(error));
+    _libwc_relay_pending_tasks_remove(relay, id);
+}
+
+/* Used when failing over to another connection. Commands that can safely be
+ * sent again stay pending, and their data gets added to replay_data in no
+ * particular order. Everything else gets failed */
+void
+_libwc_relay_pending_tasks_fail_unreplayable(LibWCRelay *relay,
+                                             const GError *error,
+                                             GPtrArray *replay_data) {
+    GArray *ids = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    _libwc_command_slab_foreach(&relay->priv->pending_commands,
+                                (LibWCCommandSlabFunc)collect_pending_id, ids);
+
+    for (guint i = 0; i < ids->len; i++) {
+        guint id = g_array_index(ids, guint, i);
+        LibWCCommandSlot *slot =
+            _libwc_command_slab_lookup(&relay->priv->pending_commands, id);
+
+        if (slot->replay_data) {
+            g_ptr_array_add(replay_data, g_bytes_ref(slot->replay_data));
+            continue;
+        }
+
+        if (error)
+            g_task_return_error(slot->task, g_error_copy(error));
+        else
+            g_task_return_new_error(slot->task, LIBWC_ERROR_RELAY,
+                                    LIBWC_ERROR_RELAY_CLOSED,
+                                    "The connection to the relay was closed");
+
+        _libwc_relay_pending_tasks_remove(relay, id);
+    }
+
+    g_array_free(ids, TRUE);
+}
+
+/* The relay answers commands in order, so responses to commands sent before
+ * the connection was handed over to us all come in before anything of ours
+ * gets answered. Returns TRUE if id belongs to one of those, in which case
+ * whatever answered it should be dropped. Pongs count as answers too */
+gboolean
+_libwc_relay_adopted_id_take(LibWCRelay *relay,
+                             guint id) {
+    if (!relay->priv->adopted_ids)
+        return FALSE;
+
+    if (g_hash_table_remove(relay->priv->adopted_ids, GUINT_TO_POINTER(id))) {
+        g_debug("Dropping response for command %x, it was sent before the "
+                "connection was handed off", id);
+
+        if (g_hash_table_size(relay->priv->adopted_ids) == 0)
+            g_clear_pointer(&relay->priv->adopted_ids, g_hash_table_unref);
+
+        return TRUE;
+    }
+
+    g_clear_pointer(&relay->priv->adopted_ids, g_hash_table_unref);
+
+    return FALSE;
+}
+
+/* Completes whatever command a response belongs to, and hands it the message.
+ * Returns FALSE if the response didn't belong to any pending command, in which
+ * case the caller still owns the message */
+gboolean
+_libwc_relay_response_route(LibWCRelay *relay,
+                            LibWCRelayMessage *message) {
     GTask *task;
+    guint id;
+
+    if (!_libwc_command_id_parse(message->response_id,
+                                 strlen(message->response_id), &id)) {
+        g_warning("Received response with invalid ID '%s' from relay, "
+                  "ignoring", message->response_id);
+        return FALSE;
+    }
 
-    g_mutex_lock(&relay->priv->pending_tasks_mutex);
-    task = g_hash_table_lookup(relay->priv->pending_tasks, GUINT_TO_POINTER(id));
-    g_mutex_unlock(&relay->priv->pending_tasks_mutex);
+    if (_libwc_relay_adopted_id_take(relay, id))
+        return FALSE;
 
-    return task;
+    task = _libwc_relay_pending_tasks_lookup(relay, id);
+    if (!task) {
+        g_debug("Received response for unknown or expired command %x, "
+                "ignoring", id);
+        return FALSE;
+    }
+
+    g_task_return_pointer(task, message,
+                          (GDestroyNotify)_libwc_relay_message_free);
+    _libwc_relay_pending_tasks_remove(relay, id);
+
+    return TRUE;
+}
+
+/* Writes the "(id) " prefix that gets the relay to tag its response with id */
+static void
+relay_command_encode_id(LibWCCommandBuffer *buffer,
+                        guint id) {
+    gchar id_string[LIBWC_COMMAND_ID_MAX_LEN];
+
+    _libwc_command_buffer_append_c(buffer, '(');
+    _libwc_command_buffer_append(buffer, id_string,
+                                 _libwc_command_id_format(id, id_string));
+    _libwc_command_buffer_append(buffer, ") ", 2);
+}
+
+/* Encodes command followed by args. Arguments are optional from the first NULL
+ * one on, everything after it gets left out. Commands that get a response are
+ * prefixed with their ID, pass 0 for ones that don't */
+static GBytes *
+relay_command_encode(LibWCRelay *relay,
+                     guint id,
+                     const gchar *command,
+                     const gchar *const *args,
+                     guint n_args) {
+    LibWCCommandBuffer *buffer =
+        _libwc_command_buffer_get(&relay->priv->command_pool);
+
+    if (id)
+        relay_command_encode_id(buffer, id);
+
+    _libwc_command_buffer_append_str(buffer, command);
+
+    for (guint i = 0; i < n_args && args[i]; i++)
+        _libwc_command_buffer_append_arg(buffer, args[i]);
+
+    return _libwc_command_buffer_finish(buffer);
+}
+
+/* Sends a command the relay answers, the response gets handed back through
+ * libwc_relay_command_finish(). Everything that does this only reads from the
+ * relay, so it's safe to send again after failing over */
+static void
+relay_command_send_async(LibWCRelay *relay,
+                         LibWCCommandPriority priority,
+                         GCancellable *cancellable,
+                         GAsyncReadyCallback callback,
+                         void *user_data,
+                         const gchar *command,
+                         const gchar *const *args,
+                         guint n_args) {
+    guint id = _libwc_command_id_new(relay);
+    GBytes *command_data;
+    GTask *task;
+
+    task = g_task_new(relay, cancellable, callback, user_data);
+
+    if (G_UNLIKELY(!id)) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_TOO_MANY_COMMANDS,
+                                "Too many commands are pending on the relay");
+        g_object_unref(task);
+        return;
+    }
+
+    command_data = relay_command_encode(relay, id, command, args, n_args);
+    if (G_UNLIKELY(!command_data)) {
+        _libwc_command_id_free(relay, id);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Arguments to relay commands can't contain "
+                                "line breaks");
+        g_object_unref(task);
+        return;
+    }
+
+    _libwc_relay_connection_queue_command(relay, command_data, task, id,
+                                          LIBWC_TIMEOUT_DEFAULT,
+                                          LIBWC_COMMAND_FLAG_IDEMPOTENT,
+                                          priority, cancellable);
+
+    g_bytes_unref(command_data);
+    g_object_unref(task);
+}
+
+/* Sends a command the relay never answers. args stops at the first NULL */
+gboolean
+_libwc_relay_command_send(LibWCRelay *relay,
+                          LibWCCommandPriority priority,
+                          GError **error,
+                          const gchar *command,
+                          const gchar *const *args,
+                          guint n_args) {
+    GBytes *command_data;
+
+    command_data = relay_command_encode(relay, 0, command, args, n_args);
+    if (G_UNLIKELY(!command_data)) {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                            "Arguments to relay commands can't contain line "
+                            "breaks");
+        return FALSE;
+    }
+
+    _libwc_relay_connection_queue_command(relay, command_data, NULL, 0,
+                                          LIBWC_TIMEOUT_NONE,
+                                          LIBWC_COMMAND_FLAG_NONE, priority,
+                                          NULL);
+    g_bytes_unref(command_data);
+
+    return TRUE;
+}
+
+/* For commands libweechat sends on its own behalf. The command gets prefixed
+ * with its ID, and the response is handed back through
+ * _libwc_relay_command_finish(). Returns the ID the command was sent with, or 0
+ * if it couldn't be sent */
+guint
+_libwc_relay_command_async(LibWCRelay *relay,
+                           guint timeout,
+                           LibWCCommandFlags flags,
+                           LibWCCommandPriority priority,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           void *user_data,
+                           const gchar *format_string,
+                           ...) {
+    guint id = _libwc_command_id_new(relay);
+    LibWCCommandBuffer *buffer;
+    GBytes *command_data;
+    GTask *task;
+    va_list va_args;
+
+    task = g_task_new(relay, cancellable, callback, user_data);
+
+    if (G_UNLIKELY(!id)) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_TOO_MANY_COMMANDS,
+                                "Too many commands are pending on the relay");
+        g_object_unref(task);
+        return 0;
+    }
+
+    buffer = _libwc_command_buffer_get(&relay->priv->command_pool);
+    relay_command_encode_id(buffer, id);
+
+    va_start(va_args, format_string);
+    _libwc_command_buffer_append_vprintf(buffer, format_string, va_args);
+    va_end(va_args);
+
+    command_data = _libwc_command_buffer_finish(buffer);
+    if (G_UNLIKELY(!command_data)) {
+        _libwc_command_id_free(relay, id);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Relay commands can't contain line breaks");
+        g_object_unref(task);
+        return 0;
+    }
+
+    _libwc_relay_connection_queue_command(relay, command_data, task, id,
+                                          timeout, flags, priority,
+                                          cancellable);
+
+    g_bytes_unref(command_data);
+    g_object_unref(task);
+
+    return id;
+}
+
+LibWCRelayMessage *
+_libwc_relay_command_finish(LibWCRelay *relay,
+                            GAsyncResult *res,
+                            GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, relay), NULL);
+
+    return g_task_propagate_pointer(G_TASK(res), error);
 }
 
 void
-libwc_relay_ping_async(LibWCRelay *relay,
-                       GCancellable *cancellable,
-                       GAsyncReadyCallback callback,
-                       void *user_data,
-                       const gchar *ping_string) {
+libwc_relay_command_timeout_set(LibWCRelay *relay,
+                                guint timeout) {
+    g_atomic_int_set(&relay->priv->default_timeout, timeout);
+}
+
+void
+libwc_relay_ping_full_async(LibWCRelay *relay,
+                            guint timeout,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            void *user_data,
+                            const gchar *ping_string) {
     guint id = _libwc_command_id_new(relay);
-    gchar *command_string;
+    LibWCCommandBuffer *buffer;
+    gchar id_string[LIBWC_COMMAND_ID_MAX_LEN];
     GBytes *command_data;
     GTask *task;
 
     task = g_task_new(relay, cancellable, callback, user_data);
-    _libwc_relay_pending_tasks_add(relay, id, task);
 
+    if (G_UNLIKELY(!id)) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_TOO_MANY_COMMANDS,
+                                "Too many commands are pending on the relay");
+        g_object_unref(task);
+        return;
+    }
+
+    /* The relay doesn't tag pongs with the command's ID, so it goes in the
+     * ping string instead */
+    buffer = _libwc_command_buffer_get(&relay->priv->command_pool);
+    _libwc_command_buffer_append(buffer, "ping ", 5);
+    _libwc_command_buffer_append(buffer, id_string,
+                                 _libwc_command_id_format(id, id_string));
     if (ping_string)
-        command_string = g_strdup_printf("ping %x %s\n",
-                                         id, ping_string);
-    else
-        command_string = g_strdup_printf("ping %x\n",
-                                         id);
+        _libwc_command_buffer_append_arg(buffer, ping_string);
+
+    command_data = _libwc_command_buffer_finish(buffer);
+    if (G_UNLIKELY(!command_data)) {
+        _libwc_command_id_free(relay, id);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                                "Ping strings can't contain line breaks");
+        g_object_unref(task);
+        return;
+    }
 
-    command_data = g_bytes_new_take(command_string, strlen(command_string));
     _libwc_relay_connection_queue_command(relay, command_data, task, id,
+                                          timeout,
+                                          LIBWC_COMMAND_FLAG_IDEMPOTENT,
+                                          LIBWC_COMMAND_PRIORITY_CONTROL,
                                           cancellable);
 
     g_bytes_unref(command_data);
+    g_object_unref(task);
+}
+
+void
+libwc_relay_ping_async(LibWCRelay *relay,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       void *user_data,
+                       const gchar *ping_string) {
+    libwc_relay_ping_full_async(relay, LIBWC_TIMEOUT_DEFAULT, cancellable,
+                                callback, user_data, ping_string);
 }
 
 void
@@ -128,16 +572,10 @@ gchar *
 libwc_relay_ping_finish(LibWCRelay *relay,
                         GAsyncResult *res,
                         GError **error) {
-    gchar *result;
-
     g_assert_null(*error);
     g_return_val_if_fail(g_task_is_valid(res, relay), FALSE);
 
-    result = g_task_propagate_pointer(G_TASK(res), error);
-
-    g_object_unref(res);
-
-    return result;
+    return g_task_propagate_pointer(G_TASK(res), error);
 }
 
 gchar *
@@ -170,3 +608,246 @@ libwc_relay_pingv(LibWCRelay *relay,
                                                    printf_string),
                                   gchar*);
 }
+
+/* Hands back the response to one of the commands below. Free it with
+ * libwc_relay_message_free() */
+LibWCRelayMessage *
+libwc_relay_command_finish(LibWCRelay *relay,
+                           GAsyncResult *res,
+                           GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, relay), NULL);
+
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+/* keys can be NULL to get every variable */
+void
+libwc_relay_hdata_async(LibWCRelay *relay,
+                        GCancellable *cancellable,
+                        GAsyncReadyCallback callback,
+                        void *user_data,
+                        const gchar *path,
+                        const gchar *keys) {
+    const gchar *args[] = { path, keys };
+
+    g_return_if_fail(path != NULL);
+
+    relay_command_send_async(relay, LIBWC_COMMAND_PRIORITY_BULK, cancellable,
+                             callback, user_data, "hdata", args,
+                             G_N_ELEMENTS(args));
+}
+
+LibWCRelayMessage *
+libwc_relay_hdata(LibWCRelay *relay,
+                  GCancellable *cancellable,
+                  GError **error,
+                  const gchar *path,
+                  const gchar *keys) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_command, LibWCRelayMessage*,
+                           libwc_relay_hdata_async, path, keys);
+}
+
+/* Sends the hdata command described by query, which can be freed as soon as
+ * this returns. If the query isn't valid nothing gets sent, and the error it
+ * found is handed to the callback instead */
+void
+libwc_relay_hdata_query_async(LibWCRelay *relay,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback,
+                              void *user_data,
+                              LibWCHdataQuery *query) {
+    GError *error = NULL;
+    gchar *arguments = libwc_hdata_query_build(query, &error);
+    const gchar *args[] = { arguments };
+
+    if (!arguments) {
+        g_task_report_error(relay, callback, user_data,
+                            libwc_relay_hdata_query_async, error);
+        return;
+    }
+
+    relay_command_send_async(relay, LIBWC_COMMAND_PRIORITY_BULK, cancellable,
+                             callback, user_data, "hdata", args,
+                             G_N_ELEMENTS(args));
+    g_free(arguments);
+}
+
+LibWCRelayMessage *
+libwc_relay_hdata_query(LibWCRelay *relay,
+                        GCancellable *cancellable,
+                        GError **error,
+                        LibWCHdataQuery *query) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_command, LibWCRelayMessage*,
+                           libwc_relay_hdata_query_async, query);
+}
+
+/* arguments can be NULL */
+void
+libwc_relay_info_async(LibWCRelay *relay,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       void *user_data,
+                       const gchar *name,
+                       const gchar *arguments) {
+    const gchar *args[] = { name, arguments };
+
+    g_return_if_fail(name != NULL);
+
+    relay_command_send_async(relay, LIBWC_COMMAND_PRIORITY_CONTROL,
+                             cancellable, callback, user_data, "info", args,
+                             G_N_ELEMENTS(args));
+}
+
+LibWCRelayMessage *
+libwc_relay_info(LibWCRelay *relay,
+                 GCancellable *cancellable,
+                 GError **error,
+                 const gchar *name,
+                 const gchar *arguments) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_command, LibWCRelayMessage*,
+                           libwc_relay_info_async, name, arguments);
+}
+
+/* pointer can be 0 and arguments NULL. Arguments can't be given without a
+ * pointer, so a pointer of 0 still gets sent if there are any */
+void
+libwc_relay_infolist_async(LibWCRelay *relay,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           void *user_data,
+                           const gchar *name,
+                           guint64 pointer,
+                           const gchar *arguments) {
+    gchar pointer_string[sizeof("0x") + sizeof(pointer) * 2];
+    const gchar *args[] = { name, pointer_string, arguments };
+
+    g_return_if_fail(name != NULL);
+
+    g_snprintf(pointer_string, sizeof(pointer_string),
+               "0x%" G_GINT64_MODIFIER "x", pointer);
+    if (!pointer && !arguments)
+        args[1] = NULL;
+
+    relay_command_send_async(relay, LIBWC_COMMAND_PRIORITY_BULK, cancellable,
+                             callback, user_data, "infolist", args,
+                             G_N_ELEMENTS(args));
+}
+
+LibWCRelayMessage *
+libwc_relay_infolist(LibWCRelay *relay,
+                     GCancellable *cancellable,
+                     GError **error,
+                     const gchar *name,
+                     guint64 pointer,
+                     const gchar *arguments) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_command, LibWCRelayMessage*,
+                           libwc_relay_infolist_async, name, pointer,
+                           arguments);
+}
+
+/* buffer is a buffer's name or pointer, or NULL for every buffer */
+void
+libwc_relay_nicklist_async(LibWCRelay *relay,
+                           GCancellable *cancellable,
+                           GAsyncReadyCallback callback,
+                           void *user_data,
+                           const gchar *buffer) {
+    const gchar *args[] = { buffer };
+
+    relay_command_send_async(relay, LIBWC_COMMAND_PRIORITY_BULK, cancellable,
+                             callback, user_data, "nicklist", args,
+                             G_N_ELEMENTS(args));
+}
+
+LibWCRelayMessage *
+libwc_relay_nicklist(LibWCRelay *relay,
+                     GCancellable *cancellable,
+                     GError **error,
+                     const gchar *buffer) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_command, LibWCRelayMessage*,
+                           libwc_relay_nicklist_async, buffer);
+}
+
+/* Gets the relay to send back one object of every type */
+void
+libwc_relay_test_async(LibWCRelay *relay,
+                       GCancellable *cancellable,
+                       GAsyncReadyCallback callback,
+                       void *user_data) {
+    relay_command_send_async(relay, LIBWC_COMMAND_PRIORITY_CONTROL,
+                             cancellable, callback, user_data, "test", NULL,
+                             0);
+}
+
+LibWCRelayMessage *
+libwc_relay_test(LibWCRelay *relay,
+                 GCancellable *cancellable,
+                 GError **error) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_command, LibWCRelayMessage*,
+                           libwc_relay_test_async);
+}
+
+/* The relay doesn't answer input, sync, desync or quit, so these just queue
+ * the command up and return. They only fail if an argument has a line break
+ * in it. Use libwc_relay_wait_writable() to keep from queueing up more than
+ * the relay can keep up with */
+
+/* buffer is a buffer's name or pointer, data is a line of text or a command,
+ * just as if it was typed into the buffer */
+gboolean
+libwc_relay_input(LibWCRelay *relay,
+                  const gchar *buffer,
+                  const gchar *data,
+                  GError **error) {
+    const gchar *args[] = { buffer, data };
+
+    g_return_val_if_fail(buffer != NULL && data != NULL, FALSE);
+
+    return _libwc_relay_command_send(relay,
+                                     LIBWC_COMMAND_PRIORITY_INTERACTIVE,
+                                     error, "input", args, G_N_ELEMENTS(args));
+}
+
+/* buffers is a comma separated list of buffer names or pointers, NULL syncs
+ * every buffer. options is a comma separated list of what to sync, NULL syncs
+ * everything */
+gboolean
+libwc_relay_sync(LibWCRelay *relay,
+                 const gchar *buffers,
+                 const gchar *options,
+                 GError **error) {
+    const gchar *args[] = { buffers ? buffers : "*", options };
+
+    if (!buffers && !options)
+        args[0] = NULL;
+
+    return _libwc_relay_command_send(relay,
+                                     LIBWC_COMMAND_PRIORITY_CONTROL,
+                                     error, "sync", args, G_N_ELEMENTS(args));
+}
+
+/* Takes the same arguments as libwc_relay_sync() */
+gboolean
+libwc_relay_desync(LibWCRelay *relay,
+                   const gchar *buffers,
+                   const gchar *options,
+                   GError **error) {
+    const gchar *args[] = { buffers ? buffers : "*", options };
+
+    if (!buffers && !options)
+        args[0] = NULL;
+
+    return _libwc_relay_command_send(relay,
+                                     LIBWC_COMMAND_PRIORITY_CONTROL,
+                                     error, "desync", args, G_N_ELEMENTS(args));
+}
+
+/* Asks the relay to close the connection. Reconnecting gets disabled first,
+ * otherwise the relay closing on us would look like the connection dropped */
+void
+libwc_relay_quit(LibWCRelay *relay) {
+    libwc_relay_reconnect_disable(relay);
+
+    _libwc_relay_command_send(relay, LIBWC_COMMAND_PRIORITY_CONTROL, NULL,
+                              "quit", NULL, 0);
+}
@@ -15,15 +15,33 @@
 #define RELAY_COMMAND_H
 
 #include "libweechat.h"
+#include "relay-parser.h"
+#include "relay-connection.h"
 
 #include <glib.h>
 
+#define LIBWC_COMMAND_ID_MAX_LEN (sizeof(guint) * 2)
+
 guint _libwc_command_id_new(LibWCRelay *relay)
 G_GNUC_WARN_UNUSED_RESULT G_GNUC_INTERNAL;
 
+void _libwc_command_id_free(LibWCRelay *relay,
+                            guint id)
+G_GNUC_INTERNAL;
+
+#define LIBWC_DEADLINE_TICK_MS ((gint64)10)
+
+void _libwc_relay_deadlines_init(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_deadlines_attach(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
 void _libwc_relay_pending_tasks_add(LibWCRelay *relay,
                                     guint id,
-                                    GTask *task)
+                                    GTask *task,
+                                    guint timeout,
+                                    GBytes *replay_data)
 G_GNUC_INTERNAL;
 
 void _libwc_relay_pending_tasks_remove(LibWCRelay *relay,
@@ -34,14 +52,94 @@ GTask * _libwc_relay_pending_tasks_lookup(LibWCRelay *relay,
                                           guint id)
 G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
 
-static inline gchar * _libwc_command_id_to_string(guint id)
-G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+void _libwc_relay_pending_tasks_fail(LibWCRelay *relay,
+                                     guint id,
+                                     const GError *error)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_pending_tasks_fail_all(LibWCRelay *relay,
+                                         const GError *error)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_pending_tasks_fail_unreplayable(LibWCRelay *relay,
+                                                  const GError *error,
+                                                  GPtrArray *replay_data)
+G_GNUC_INTERNAL;
+
+gboolean _libwc_relay_adopted_id_take(LibWCRelay *relay,
+                                      guint id)
+G_GNUC_INTERNAL;
+
+gboolean _libwc_relay_response_route(LibWCRelay *relay,
+                                     LibWCRelayMessage *message)
+G_GNUC_INTERNAL;
+
+guint _libwc_relay_command_async(LibWCRelay *relay,
+                                 guint timeout,
+                                 LibWCCommandFlags flags,
+                                 LibWCCommandPriority priority,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 void *user_data,
+                                 const gchar *format_string,
+                                 ...)
+G_GNUC_INTERNAL G_GNUC_PRINTF(8, 9);
+
+gboolean _libwc_relay_command_send(LibWCRelay *relay,
+                                   LibWCCommandPriority priority,
+                                   GError **error,
+                                   const gchar *command,
+                                   const gchar *const *args,
+                                   guint n_args)
+G_GNUC_INTERNAL;
+
+LibWCRelayMessage * _libwc_relay_command_finish(LibWCRelay *relay,
+                                                GAsyncResult *res,
+                                                GError **error)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+/* Writes the ID into buf as hex without NULL terminating it, and returns the
+ * number of characters written. buf must be at least LIBWC_COMMAND_ID_MAX_LEN
+ * long */
+static inline gsize
+_libwc_command_id_format(guint id,
+                         gchar *buf) {
+    static const gchar digits[] = "0123456789abcdef";
+    gchar reversed[LIBWC_COMMAND_ID_MAX_LEN];
+    gsize len = 0;
+
+    do {
+        reversed[len++] = digits[id & 0xf];
+        id >>= 4;
+    } while (id);
+
+    for (gsize i = 0; i < len; i++)
+        buf[i] = reversed[len - i - 1];
+
+    return len;
+}
+
+static inline gboolean
+_libwc_command_id_parse(const gchar *str,
+                        gsize len,
+                        guint *id) {
+    guint value = 0;
+
+    if (len == 0 || len > LIBWC_COMMAND_ID_MAX_LEN)
+        return FALSE;
+
+    for (gsize i = 0; i < len; i++) {
+        gint digit = g_ascii_xdigit_value(str[i]);
+
+        if (digit < 0)
+            return FALSE;
+
+        value = (value << 4) | digit;
+    }
 
-static inline gchar *
-_libwc_command_id_to_string(guint id) {
-    gchar *string = g_strdup_printf("%x", id);
+    *id = value;
 
-    return string;
+    return TRUE;
 }
 
 #endif /* !RELAY_COMMAND_H */
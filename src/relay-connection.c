@@ -11,6 +11,8 @@
  * details.
  */
 
+#include "config.h"
+
 #include "libweechat.h"
 #include "async-wrapper.h"
 #include "relay.h"
@@ -19,60 +21,284 @@
 #include "relay-command.h"
 #include "relay-parser.h"
 #include "relay-event.h"
+#include "relay-event-source.h"
+#include "relay-reconnect.h"
+#include "relay-standby.h"
+#include "relay-decode.h"
+#include "relay-capture.h"
+#include "relay-shm.h"
+#include "spill-file.h"
+#include "mpsc-queue.h"
+#include "relay-uring.h"
 #include "misc.h"
 
 #include <glib.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 #include <string.h>
+#include <errno.h>
+
+#define HEADER_SIZE LIBWC_RELAY_HEADER_SIZE
 
-#define HEADER_SIZE ((gsize)5)
+#define RECEIVE_CHUNK_SIZE ((gsize)16384)
 
 #define PAYLOAD_SIZE_OFFSET             (0)
 #define PAYLOAD_COMPRESSION_FLAG_OFFSET (4)
 
-struct _LibWCQueuedWrite {
-    LibWCRelay *relay;
-    GCancellable *cancellable;
+struct _LibWCWritableWaiter {
+    GTask *task;
     gulong cancellable_id;
-    GBytes *data;
 };
 
-typedef struct _LibWCQueuedWrite LibWCQueuedWrite;
+typedef struct _LibWCWritableWaiter LibWCWritableWaiter;
 
-static void
-queued_write_free(LibWCQueuedWrite *queued_write) {
+void
+_libwc_queued_write_free(LibWCQueuedWrite *queued_write) {
     g_bytes_unref(queued_write->data);
     g_object_unref(queued_write->relay);
 
     if (queued_write->cancellable)
         g_object_unref(queued_write->cancellable);
+    if (queued_write->task)
+        g_object_unref(queued_write->task);
 
     g_free(queued_write);
 }
 
+/* Used for commands that never made it onto the wire, either because they were
+ * cancelled or because the connection died first */
+static void
+queued_write_fail(LibWCQueuedWrite *queued_write,
+                  const GError *error) {
+    if (queued_write->task &&
+        !g_task_return_error_if_cancelled(queued_write->task)) {
+        if (error)
+            g_task_return_error(queued_write->task, g_error_copy(error));
+        else
+            g_task_return_new_error(queued_write->task, LIBWC_ERROR_RELAY,
+                                    LIBWC_ERROR_RELAY_CLOSED,
+                                    "The connection to the relay was closed");
+    }
+
+    if (queued_write->task)
+        _libwc_command_id_free(queued_write->relay, queued_write->id);
+
+    _libwc_relay_window_adjust(queued_write->relay,
+                               queued_write->task ? -1 : 0,
+                               -queued_write->size);
+    _libwc_queued_write_free(queued_write);
+}
+
+static void
+writable_waiter_complete(LibWCWritableWaiter *waiter,
+                         const GError *error) {
+    GCancellable *cancellable = g_task_get_cancellable(waiter->task);
+
+    if (waiter->cancellable_id)
+        g_cancellable_disconnect(cancellable, waiter->cancellable_id);
+
+    if (error)
+        g_task_return_error(waiter->task, g_error_copy(error));
+    else
+        g_task_return_boolean(waiter->task, TRUE);
+
+    g_object_unref(waiter->task);
+    g_free(waiter);
+}
+
+static void
+writable_waiter_cancelled_cb(GCancellable *cancellable,
+                             LibWCWritableWaiter *waiter) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(waiter->task));
+    gboolean found;
+
+    /* If the waiter isn't in the queue anymore, then it's already being
+     * completed by someone else */
+    g_mutex_lock(&relay->priv->window_mutex);
+    found = g_queue_remove(&relay->priv->writable_waiters, waiter);
+    g_mutex_unlock(&relay->priv->window_mutex);
+
+    if (!found)
+        return;
+
+    /* g_cancellable_disconnect() would wait on this very handler to return */
+    g_signal_handler_disconnect(cancellable, waiter->cancellable_id);
+
+    g_task_return_error_if_cancelled(waiter->task);
+    g_object_unref(waiter->task);
+    g_free(waiter);
+}
+
+static inline gboolean
+window_has_capacity(LibWCRelayPrivate *priv) {
+    guint max_commands = g_atomic_int_get(&priv->max_pending_commands);
+    gsize max_bytes =
+        GPOINTER_TO_SIZE(g_atomic_pointer_get(&priv->max_pending_bytes));
+
+    if (max_commands &&
+        (guint)g_atomic_int_get(&priv->pending_command_count) >= max_commands)
+        return FALSE;
+
+    if (max_bytes &&
+        GPOINTER_TO_SIZE(g_atomic_pointer_get(&priv->pending_bytes)) >=
+        max_bytes)
+        return FALSE;
+
+    return TRUE;
+}
+
+/* Recalculates whether or not the relay is writable, and notifies everyone
+ * who cares if that changed. Must be called with the window mutex held, and
+ * releases it before emitting anything */
+static void
+window_update_and_unlock(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+    GQueue waiters = G_QUEUE_INIT;
+    gboolean writable = window_has_capacity(priv);
+
+    if (writable == priv->writable) {
+        g_mutex_unlock(&priv->window_mutex);
+        return;
+    }
+
+    g_atomic_int_set(&priv->writable, writable);
+    if (writable) {
+        waiters = priv->writable_waiters;
+        g_queue_init(&priv->writable_waiters);
+    }
+
+    g_mutex_unlock(&priv->window_mutex);
+
+    g_signal_emit(relay,
+                  _libwc_relay_signals[LIBWC_RELAY_SIGNAL_WRITABLE_CHANGED], 0,
+                  writable);
+
+    while (!g_queue_is_empty(&waiters))
+        writable_waiter_complete(g_queue_pop_head(&waiters), NULL);
+}
+
+void
+_libwc_relay_window_adjust(LibWCRelay *relay,
+                           gint command_delta,
+                           gssize byte_delta) {
+    LibWCRelayPrivate *priv = relay->priv;
+
+    if (command_delta)
+        g_atomic_int_add(&priv->pending_command_count, command_delta);
+    if (byte_delta)
+        g_atomic_pointer_add(&priv->pending_bytes, byte_delta);
+
+    /* This gets called for every single command, so only bother taking the
+     * lock if it looks like the state of the window actually changed */
+    if (window_has_capacity(priv) == g_atomic_int_get(&priv->writable))
+        return;
+
+    g_mutex_lock(&priv->window_mutex);
+    window_update_and_unlock(relay);
+}
+
+/* Nothing is ever going to drain the window of a dead connection on its own,
+ * so anyone still waiting on it needs to be told. The counters themselves are
+ * left alone, whoever drops a command takes back exactly what it added */
+static void
+window_fail_waiters(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+    GQueue waiters;
+    GError *error;
+
+    g_mutex_lock(&priv->window_mutex);
+    waiters = priv->writable_waiters;
+    g_queue_init(&priv->writable_waiters);
+    g_mutex_unlock(&priv->window_mutex);
+
+    if (g_queue_is_empty(&waiters))
+        return;
+
+    error = g_error_new_literal(LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_CLOSED,
+                                "The connection to the relay was closed");
+
+    while (!g_queue_is_empty(&waiters))
+        writable_waiter_complete(g_queue_pop_head(&waiters), error);
+
+    g_error_free(error);
+}
+
 void
 _libwc_relay_connection_end_on_error(LibWCRelay *relay,
                                      GError *error) {
-    GList *pending_tasks;
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCQueuedWrite *queued_write;
+    gssize stale_bytes = 0;
+
+    if (!priv->connected)
+        return;
+
+    if (_libwc_relay_standby_failover(relay, error))
+        return;
+
+    priv->connected = FALSE;
+    priv->connection_serial++;
+
+    /* Its callback won't touch the window once it sees the serial changed */
+    if (priv->current_write) {
+        stale_bytes += priv->current_write->size;
+        priv->current_write = NULL;
+    }
+
+    g_clear_pointer(&priv->spill, _libwc_spill_file_free);
+    g_clear_pointer(&priv->adopted_ids, g_hash_table_unref);
+
+    /* Replays don't have a stream */
+    if (priv->stream) {
+        g_io_stream_clear_pending(priv->stream);
+        g_io_stream_close(priv->stream, NULL, NULL);
+    }
+
+    _libwc_relay_pending_tasks_fail_all(relay, error);
+
+    /* Everything else stays attached to the reactor, so that commands that
+     * get submitted after this can still be failed */
+    if (priv->source) {
+        g_source_destroy(priv->source);
+        g_source_unref(priv->source);
+        priv->source = NULL;
+    }
+
+#ifdef HAVE_LIBURING
+    if (priv->backend == LIBWC_RELAY_BACKEND_IO_URING)
+        stale_bytes += _libwc_relay_uring_stop(relay);
+#endif
 
-    relay->priv->connected = FALSE;
+    if (priv->decoder)
+        _libwc_relay_decoder_reset(priv->decoder);
 
-    pending_tasks = g_hash_table_get_values(relay->priv->pending_tasks);
+    /* We hang on to the reactor itself, so that if we reconnect we end up on
+     * the same thread the rest of our sources are attached to */
+    if (priv->reactor)
+        _libwc_reactor_release(priv->reactor);
 
-    for (GList *l = pending_tasks; l != NULL; l = l->next) {
-        GTask *task = l->data;
-        GCancellable *cancellable;
+    /* Anything that's still queued up was never sent. If a write is currently
+     * in flight, it gets freed by its own callback */
+    while ((queued_write =
+            (LibWCQueuedWrite*)_libwc_mpsc_queue_pop(&priv->submit_queue)))
+        queued_write_fail(queued_write, error);
 
-        cancellable = g_task_get_cancellable(task);
-        g_cancellable_cancel(cancellable);
+    while ((queued_write = _libwc_write_scheduler_pop(&priv->write_queue))) {
+        stale_bytes += queued_write->size;
+        _libwc_queued_write_free(queued_write);
     }
 
-    g_io_stream_clear_pending(relay->priv->stream);
-    g_io_stream_close(relay->priv->stream, NULL, NULL);
+    if (stale_bytes)
+        _libwc_relay_window_adjust(relay, 0, -stale_bytes);
 
-    g_hash_table_remove_all(relay->priv->pending_tasks);
-    g_async_queue_unref(relay->priv->pending_writes);
+    window_fail_waiters(relay);
+
+    _libwc_relay_reconnect_schedule(relay);
 }
 
 static void
@@ -80,26 +306,232 @@ read_msg_header_cb(LibWCRelay *relay,
                    void *data,
                    gsize count);
 
+/* Called with frames that couldn't be decoded. response_id is the ID the frame
+ * started with, if we could get that far. Runs on the relay's reactor thread */
+void
+_libwc_relay_connection_frame_error(LibWCRelay *relay,
+                                    const gchar *response_id,
+                                    const GError *error) {
+    guint id;
+
+    if (!g_atomic_int_get(&relay->priv->tolerant)) {
+        _libwc_relay_connection_end_on_error(relay, (GError*)error);
+        return;
+    }
+
+    LIBWC_STAT_ADD(relay, frames_dropped, 1);
+    g_debug("Skipping frame that couldn't be decoded: %s", error->message);
+
+    if (response_id &&
+        _libwc_command_id_parse(response_id, strlen(response_id), &id))
+        _libwc_relay_pending_tasks_fail(relay, id, error);
+}
+
+/* Hands a message off to whatever is waiting on it, and takes ownership of it.
+ * Runs on the relay's reactor thread */
+void
+_libwc_relay_connection_dispatch(LibWCRelay *relay,
+                                 LibWCRelayMessage *parsed_message) {
+    LibWCEventHandler event_handler;
+
+    if (relay->priv->timestamps)
+        parsed_message->timestamps.dispatched = _libwc_realtime_ns();
+
+    if (parsed_message->type == LIBWC_RELAY_MESSAGE_TYPE_EVENT) {
+        if (g_atomic_pointer_get(&relay->priv->shm_publisher))
+            _libwc_relay_shm_publish(relay, parsed_message);
+
+        if (relay->priv->reconnect)
+            _libwc_relay_reconnect_track_event(relay, parsed_message);
+
+        event_handler = _libwc_relay_event_get_handler(parsed_message->event_id);
+        if (event_handler) {
+            event_handler(relay, parsed_message);
+            _libwc_relay_message_free(parsed_message);
+        }
+        else if (!_libwc_relay_event_deliver(relay, parsed_message)) {
+            _libwc_relay_message_free(parsed_message);
+        }
+    }
+    else if (!_libwc_relay_response_route(relay, parsed_message))
+        _libwc_relay_message_free(parsed_message);
+}
+
 static void
 read_payload_cb(LibWCRelay *relay,
                 void *data,
                 gsize count) {
     LibWCRelayMessage *parsed_message;
     GError *error = NULL;
-    LibWCEventHandler event_handler;
+
+    relay->priv->read_cb = read_msg_header_cb;
+    relay->priv->read_len = HEADER_SIZE;
 
     parsed_message = _libwc_relay_message_parse_data(data, count, &error);
     if (G_UNLIKELY(!parsed_message)) {
+        gchar *response_id =
+            _libwc_relay_message_peek_response_id(data, count);
+
+        _libwc_relay_connection_frame_error(relay, response_id, error);
+        g_free(response_id);
+        g_error_free(error);
+        return;
+    }
+
+    if (relay->priv->timestamps) {
+        parsed_message->timestamps.received = relay->priv->rx_timestamp;
+        parsed_message->timestamps.parsed = _libwc_realtime_ns();
+    }
+
+    _libwc_relay_connection_dispatch(relay, parsed_message);
+}
+
+/* Spilled frames are already in a GBytes of their own, so handing them off
+ * doesn't need a copy */
+static GBytes *
+relay_connection_payload_bytes(LibWCRelay *relay,
+                               void *data,
+                               gsize count) {
+    if (relay->priv->spilled_frame)
+        return g_bytes_ref(relay->priv->spilled_frame);
+
+    return g_bytes_new(data, count);
+}
+
+/* Used instead of the payload callbacks when the relay has decode threads */
+static void
+queue_payload_cb(LibWCRelay *relay,
+                 void *data,
+                 gsize count) {
+    _libwc_relay_decoder_push(relay->priv->decoder,
+                              relay_connection_payload_bytes(relay, data,
+                                                             count),
+                              FALSE);
+
+    relay->priv->read_cb = read_msg_header_cb;
+    relay->priv->read_len = HEADER_SIZE;
+}
+
+/* Everything that wants to see complete frames as they come off the wire, before
+ * they get decoded, hooks in here */
+static void
+relay_connection_tap_frame(LibWCRelay *relay,
+                           void *payload,
+                           gsize count) {
+    LibWCRelayPrivate *priv = relay->priv;
+
+    if (g_atomic_pointer_get(&priv->capture))
+        _libwc_relay_capture_frame(relay, priv->frame_header, payload, count);
+
+    if (priv->proxy)
+        _libwc_relay_proxy_frame(priv->proxy, priv->frame_header, payload,
+                                 count);
+}
+
+static inline void
+relay_connection_read(LibWCRelay *relay,
+                      void *data,
+                      gsize count) {
+    LibWCRelayPrivate *priv = relay->priv;
+
+    if (priv->read_cb == read_msg_header_cb) {
+        memcpy(priv->frame_header, data, HEADER_SIZE);
+    }
+    else {
+        LIBWC_STAT_ADD(relay, frames_received, 1);
+        relay_connection_tap_frame(relay, data, count);
+    }
+
+    priv->read_cb(relay, data, count);
+}
+
+/* Adds data to the frame that's being received into the spill file. Once the
+ * whole frame is there, it gets handed to the read callbacks from a mapping of
+ * it */
+static void
+relay_connection_feed_spill(LibWCRelay *relay,
+                            const void *data,
+                            gsize len) {
+    LibWCRelayPrivate *priv = relay->priv;
+    GError *error = NULL;
+    gconstpointer frame;
+    gsize size;
+
+    if (!_libwc_spill_file_append(priv->spill, data, len, &error)) {
         _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
         return;
     }
 
-    if (parsed_message->type == LIBWC_RELAY_MESSAGE_TYPE_EVENT) {
-        event_handler = _libwc_relay_event_get_handler(parsed_message->event_id);
-        event_handler(relay, parsed_message);
+    if (_libwc_spill_file_get_size(priv->spill) < priv->read_len)
+        return;
+
+    priv->spilled_frame =
+        _libwc_spill_file_finish(g_steal_pointer(&priv->spill), &error);
+    if (!priv->spilled_frame) {
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+        return;
     }
 
-    _libwc_relay_message_free(parsed_message);
+    frame = g_bytes_get_data(priv->spilled_frame, &size);
+    relay_connection_read(relay, (void*)frame, size);
+
+    g_clear_pointer(&priv->spilled_frame, g_bytes_unref);
+}
+
+/* Takes however much data the transport happened to receive, and splits it up
+ * into the chunks our read callbacks are expecting. Data is only copied when a
+ * chunk is split across multiple receives */
+void
+_libwc_relay_connection_feed(LibWCRelay *relay,
+                             const void *data,
+                             gsize len) {
+    LibWCRelayPrivate *priv = relay->priv;
+    GByteArray *rx_buffer = priv->rx_buffer;
+    const guint8 *pos = data;
+    gsize take;
+
+    while (len && priv->connected) {
+        if (priv->spill) {
+            take = MIN(priv->read_len - _libwc_spill_file_get_size(priv->spill),
+                       len);
+            relay_connection_feed_spill(relay, pos, take);
+
+            pos += take;
+            len -= take;
+            continue;
+        }
+
+        if (rx_buffer->len == 0 && len >= priv->read_len) {
+            take = priv->read_len;
+            relay_connection_read(relay, (void*)pos, take);
+
+            pos += take;
+            len -= take;
+            continue;
+        }
+
+        take = MIN(priv->read_len - rx_buffer->len, len);
+        g_byte_array_append(rx_buffer, pos, take);
+        pos += take;
+        len -= take;
+
+        if (rx_buffer->len == priv->read_len) {
+            relay_connection_read(relay, rx_buffer->data, rx_buffer->len);
+            g_byte_array_set_size(rx_buffer, 0);
+        }
+    }
+}
+
+static void
+queue_compressed_payload_cb(LibWCRelay *relay,
+                            void *data,
+                            gsize count) {
+    _libwc_relay_decoder_push(relay->priv->decoder,
+                              relay_connection_payload_bytes(relay, data,
+                                                             count),
+                              TRUE);
 
     relay->priv->read_cb = read_msg_header_cb;
     relay->priv->read_len = HEADER_SIZE;
@@ -109,62 +541,202 @@ static void
 read_compressed_payload_cb(LibWCRelay *relay,
                            void *data,
                            gsize count) {
-    GConverterResult result;
-    void *outbuf = NULL;
-    gsize outbuf_size = count,
-          bytes_read = 0,
-          bytes_written = 0;
+    LibWCRelayPrivate *priv = relay->priv;
+    GBytes *inflated;
+    gconstpointer inflated_data;
+    gsize inflated_size;
     GError *error = NULL;
 
-    do {
-        outbuf_size *= 2;
-        outbuf = g_realloc(outbuf, outbuf_size);
-
-        result = g_converter_convert(G_CONVERTER(relay->priv->decompressor),
-                                     data, count, outbuf, outbuf_size,
-                                     G_CONVERTER_NO_FLAGS, &bytes_read,
-                                     &bytes_written, &error);
-    } while (result == G_CONVERTER_CONVERTED);
-
-    g_converter_reset(G_CONVERTER(relay->priv->decompressor));
+    inflated = _libwc_relay_payload_inflate(
+        G_CONVERTER(priv->decompressor), data, count,
+        priv->max_heap_frame_size, priv->max_frame_size, &error);
+    if (!inflated) {
+        relay->priv->read_cb = read_msg_header_cb;
+        relay->priv->read_len = HEADER_SIZE;
 
-    if (result != G_CONVERTER_FINISHED) {
-        _libwc_relay_connection_end_on_error(relay, error);
-        g_free(outbuf);
+        _libwc_relay_connection_frame_error(relay, NULL, error);
+        g_error_free(error);
 
         return;
     }
 
-    read_payload_cb(relay, outbuf, outbuf_size);
-    g_free(outbuf);
+    inflated_data = g_bytes_get_data(inflated, &inflated_size);
+    read_payload_cb(relay, (void*)inflated_data, inflated_size);
+    g_bytes_unref(inflated);
 }
 
 static void
 read_msg_header_cb(LibWCRelay *relay,
                    void *data,
                    gsize count) {
-    gsize payload_size =
-        GINT32_FROM_BE(LIBWC_GET_FIELD(data, PAYLOAD_SIZE_OFFSET, guint32)) -
-        HEADER_SIZE;
+    gsize message_size =
+        GUINT32_FROM_BE(LIBWC_GET_FIELD(data, PAYLOAD_SIZE_OFFSET, guint32));
+    gboolean compressed;
+    GError *error;
+
+    if (G_UNLIKELY(message_size <= HEADER_SIZE)) {
+        error = g_error_new(LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
+                            "Message header claims a length of %" G_GSIZE_FORMAT,
+                            message_size);
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+
+        return;
+    }
+
+    /* Nothing this big is real, there's no point in even trying to skip over
+     * it */
+    if (G_UNLIKELY(message_size > relay->priv->max_frame_size)) {
+        error = g_error_new(LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
+                            "Message header claims a length of %" G_GSIZE_FORMAT
+                            ", more than the limit of %" G_GSIZE_FORMAT,
+                            message_size, relay->priv->max_frame_size);
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+
+        return;
+    }
+
+    if (message_size - HEADER_SIZE > relay->priv->max_heap_frame_size) {
+        error = NULL;
+        relay->priv->spill = _libwc_spill_file_new(&error);
+        if (!relay->priv->spill) {
+            _libwc_relay_connection_end_on_error(relay, error);
+            g_error_free(error);
+
+            return;
+        }
+    }
 
     /* Use the zlib payload callback if the compression flag is on in the
      * header */
-    if (LIBWC_GET_FIELD(data, PAYLOAD_COMPRESSION_FLAG_OFFSET, guint8))
-        relay->priv->read_cb = read_compressed_payload_cb;
+    compressed = LIBWC_GET_FIELD(data, PAYLOAD_COMPRESSION_FLAG_OFFSET, guint8);
+
+    if (relay->priv->decoder)
+        relay->priv->read_cb = compressed ? queue_compressed_payload_cb :
+                                            queue_payload_cb;
     else
-        relay->priv->read_cb = read_payload_cb;
+        relay->priv->read_cb = compressed ? read_compressed_payload_cb :
+                                            read_payload_cb;
+
+    relay->priv->read_len = message_size - HEADER_SIZE;
+}
+
+static void
+queued_write_cb(GObject *source_object,
+                GAsyncResult *res,
+                void *user_data);
+
+static void
+start_next_write(LibWCRelay *relay);
+
+static gboolean
+shaper_source_dispatch(GSource *source,
+                       GSourceFunc callback,
+                       void *user_data) {
+    g_source_set_ready_time(source, -1);
+    start_next_write(user_data);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs shaper_source_funcs = {
+    .dispatch = shaper_source_dispatch
+};
+
+static void
+relay_connection_record_queue_delay(LibWCRelay *relay,
+                                    gint64 delay) {
+    LibWCRelayStatCounters *counters = &relay->priv->stats;
+
+    LIBWC_STAT_ADD(relay, commands_written, 1);
+    LIBWC_STAT_ADD(relay, queue_delay_total, delay);
+
+    /* We're the only ones who ever write this */
+    if (delay > atomic_load_explicit(&counters->queue_delay_max,
+                                     memory_order_relaxed))
+        atomic_store_explicit(&counters->queue_delay_max, delay,
+                              memory_order_relaxed);
+}
+
+/* Runs on the relay's reactor thread. Takes the next write off the queue, as
+ * long as the relay's rate limit and the global one allow it to go out right
+ * now. If they don't, it stays queued and we come back to it once they do.
+ * Submitters never wait on any of this, commands just pile up in the queue,
+ * where the window still applies to them */
+LibWCQueuedWrite *
+_libwc_relay_connection_next_write(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCRateLimit *limits[] = {
+        &priv->rate_limit,
+        &_libwc_global_rate_limit
+    };
+    LibWCQueuedWrite *queued_write;
+    gint64 now, wait;
+
+    /* Writes being resumed were already let through and counted the first
+     * time, and are partway onto the wire, so nothing gets to hold them up */
+    queued_write = _libwc_write_scheduler_pop_resume(&priv->write_queue);
+    if (queued_write)
+        return queued_write;
+
+    queued_write = _libwc_write_scheduler_peek(&priv->write_queue);
+    if (!queued_write)
+        return NULL;
+
+    /* Already waiting for the buckets to fill back up */
+    if (g_source_get_ready_time(priv->shaper_source) >= 0)
+        return NULL;
+
+    now = g_get_monotonic_time();
+    wait = _libwc_rate_limit_admit(limits, G_N_ELEMENTS(limits),
+                                   queued_write->size, now);
+    if (wait) {
+        LIBWC_STAT_ADD(relay, commands_shaped, 1);
+        g_source_set_ready_time(priv->shaper_source, now + wait);
+        return NULL;
+    }
+
+    relay_connection_record_queue_delay(relay, now - queued_write->queued_at);
+
+    return _libwc_write_scheduler_pop(&priv->write_queue);
+}
+
+static void
+start_next_write(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCQueuedWrite *queued_write;
+
+#ifdef HAVE_LIBURING
+    if (priv->backend == LIBWC_RELAY_BACKEND_IO_URING) {
+        _libwc_relay_uring_flush(relay);
+        return;
+    }
+#endif
+
+    if (priv->current_write)
+        return;
 
-    relay->priv->read_len = payload_size;
+    queued_write = _libwc_relay_connection_next_write(relay);
+    if (!queued_write)
+        return;
+
+    /* We don't pass the cancellable here, cancelling a command that's already
+     * halfway out the door would leave garbage on the wire */
+    priv->current_write = queued_write;
+    queued_write->connection_serial = priv->connection_serial;
+    g_output_stream_write_bytes_async(priv->output_stream, queued_write->data,
+                                      G_PRIORITY_DEFAULT, NULL,
+                                      queued_write_cb, queued_write);
 }
 
 static void
 queued_write_cb(GObject *source_object,
                 GAsyncResult *res,
                 void *user_data) {
-    LibWCQueuedWrite *queued_write = user_data,
-                     *next_write;
+    LibWCQueuedWrite *queued_write = user_data;
+    LibWCRelay *relay = queued_write->relay;
     GOutputStream *stream = G_OUTPUT_STREAM(source_object);
-    GAsyncQueue *queued_writes = queued_write->relay->priv->pending_writes;
     gssize bytes_written;
     gsize data_size;
     GBytes *new_data;
@@ -172,8 +744,20 @@ queued_write_cb(GObject *source_object,
 
     bytes_written = g_output_stream_write_bytes_finish(stream, res, &error);
 
+    /* The connection this was written to is gone, whoever got rid of it has
+     * already taken care of the window */
+    if (queued_write->connection_serial != relay->priv->connection_serial) {
+        g_clear_error(&error);
+        _libwc_queued_write_free(queued_write);
+        return;
+    }
+
+    /* Ending the connection takes care of current_write for us */
     if (error) {
-        _libwc_relay_connection_end_on_error(queued_write->relay, error);
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+
+        _libwc_queued_write_free(queued_write);
         return;
     }
 
@@ -185,28 +769,77 @@ queued_write_cb(GObject *source_object,
         g_bytes_unref(queued_write->data);
         queued_write->data = new_data;
 
-        g_output_stream_write_bytes_async(
-            queued_write->relay->priv->output_stream, new_data,
-            G_PRIORITY_DEFAULT, queued_write->cancellable,
-            queued_write_cb, queued_write);
+        /* The part that made it out no longer takes up the window */
+        queued_write->size -= bytes_written;
+        _libwc_relay_window_adjust(relay, 0, -bytes_written);
+
+        g_output_stream_write_bytes_async(relay->priv->output_stream, new_data,
+                                          G_PRIORITY_DEFAULT, NULL,
+                                          queued_write_cb, queued_write);
         return;
     }
 
-    g_async_queue_lock(queued_writes);
-    g_async_queue_pop_unlocked(queued_writes);
+    relay->priv->current_write = NULL;
+    start_next_write(relay);
 
-    next_write = g_async_queue_try_pop_unlocked(queued_writes);
-    if (next_write) {
-        g_output_stream_write_bytes_async(
-            queued_write->relay->priv->output_stream, next_write->data,
-            G_PRIORITY_DEFAULT, next_write->cancellable,
-            queued_write_cb, next_write);
+    _libwc_relay_connection_write_done(relay, queued_write);
+}
+
+void
+_libwc_relay_connection_write_done(LibWCRelay *relay,
+                                   LibWCQueuedWrite *queued_write) {
+    _libwc_relay_window_adjust(relay, 0, -queued_write->size);
+    _libwc_queued_write_free(queued_write);
+}
 
-        g_async_queue_push_unlocked(queued_writes, next_write);
+static gboolean
+submit_queue_cb(gint fd,
+                GIOCondition condition,
+                void *user_data) {
+    LibWCRelay *relay = user_data;
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCQueuedWrite *queued_write;
+    eventfd_t value;
+
+    /* Clear the wakeup flag before draining anything, so that anyone who
+     * pushes a command after this point is guaranteed to wake us up again */
+    eventfd_read(fd, &value);
+    g_atomic_int_set(&priv->wakeup_pending, FALSE);
+
+    /* Anything submitted while the connection is being handed off waits here,
+     * so that everything that's pending once it goes is already on the wire */
+    if (priv->handoff)
+        return G_SOURCE_CONTINUE;
+
+    while ((queued_write =
+            (LibWCQueuedWrite*)_libwc_mpsc_queue_pop(&priv->submit_queue))) {
+        if (!priv->connected) {
+            queued_write_fail(queued_write, NULL);
+            continue;
+        }
+
+        if (queued_write->cancellable &&
+            g_cancellable_is_cancelled(queued_write->cancellable)) {
+            queued_write_fail(queued_write, NULL);
+            continue;
+        }
+
+        if (g_atomic_pointer_get(&priv->capture))
+            _libwc_relay_capture_command(relay, queued_write->data);
+
+        if (queued_write->task)
+            _libwc_relay_pending_tasks_add(
+                relay, queued_write->id, queued_write->task,
+                queued_write->timeout,
+                queued_write->flags & LIBWC_COMMAND_FLAG_IDEMPOTENT ?
+                queued_write->data : NULL);
+
+        _libwc_write_scheduler_push(&priv->write_queue, queued_write);
     }
 
-    g_async_queue_unlock(queued_writes);
-    queued_write_free(queued_write);
+    start_next_write(relay);
+
+    return G_SOURCE_CONTINUE;
 }
 
 void
@@ -214,43 +847,49 @@ _libwc_relay_connection_queue_command(LibWCRelay *relay,
                                       GBytes *data,
                                       GTask *task,
                                       guint id,
+                                      guint timeout,
+                                      LibWCCommandFlags flags,
+                                      LibWCCommandPriority priority,
                                       GCancellable *cancellable) {
+    LibWCRelayPrivate *priv = relay->priv;
     LibWCQueuedWrite *queued_write = g_new0(LibWCQueuedWrite, 1);
 
     *queued_write = (LibWCQueuedWrite) {
         .relay = g_object_ref(relay),
-        .data = g_bytes_ref(data)
+        .timeout = timeout,
+        .flags = flags,
+        .priority = priority,
+        .data = g_bytes_ref(data),
+        .size = g_bytes_get_size(data),
+        .queued_at = g_get_monotonic_time()
     };
 
-    if (cancellable) {
+    if (cancellable)
         queued_write->cancellable = g_object_ref(cancellable);
-        queued_write->cancellable_id =
-            g_cancellable_connect(cancellable,
-                                  G_CALLBACK(queued_write_free),
-                                  queued_write, NULL);
-    }
 
     if (task) {
-        if (!id)
-            id = _libwc_command_id_new(relay);
-
-        _libwc_relay_pending_tasks_add(relay, id, task);
+        queued_write->task = g_object_ref(task);
+        queued_write->id = id ? id : _libwc_command_id_new(relay);
+
+        if (G_UNLIKELY(!queued_write->id)) {
+            g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                    LIBWC_ERROR_RELAY_TOO_MANY_COMMANDS,
+                                    "Too many commands are pending on the "
+                                    "relay");
+            _libwc_queued_write_free(queued_write);
+            return;
+        }
     }
 
-    g_async_queue_lock(relay->priv->pending_writes);
+    _libwc_relay_window_adjust(relay, task ? 1 : 0, queued_write->size);
 
-    if (g_async_queue_length_unlocked(relay->priv->pending_writes) <= 0) {
-        g_async_queue_push_unlocked(relay->priv->pending_writes, queued_write);
-        g_async_queue_unlock(relay->priv->pending_writes);
+    _libwc_mpsc_queue_push(&priv->submit_queue, &queued_write->node);
 
-        g_output_stream_write_bytes_async(relay->priv->output_stream, data,
-                                          G_PRIORITY_DEFAULT, cancellable,
-                                          queued_write_cb, queued_write);
-    }
-    else {
-        g_async_queue_push_unlocked(relay->priv->pending_writes, queued_write);
-        g_async_queue_unlock(relay->priv->pending_writes);
-    }
+    /* Only poke the libweechat thread if nobody else has done so since it last
+     * drained the queue */
+    if (!g_atomic_int_get(&priv->wakeup_pending) &&
+        g_atomic_int_compare_and_exchange(&priv->wakeup_pending, FALSE, TRUE))
+        eventfd_write(priv->wakeup_fd, 1);
 }
 
 static void
@@ -263,72 +902,543 @@ relay_connection_init_ping_response_cb(GObject *source_object,
 
     libwc_relay_ping_finish(relay, res, &error);
 
-    if (error)
+    if (error) {
         g_task_return_error(task, error);
-    else
+    }
+    else {
+        if (relay->priv->standby)
+            _libwc_relay_standby_start(relay);
+
+        _libwc_relay_subscriptions_replay(relay);
+
         g_task_return_boolean(task, TRUE);
+    }
 
     g_object_unref(task);
 }
 
+/* Reads straight from the socket, so we can get at the timestamp the kernel
+ * attached to the data. Only usable when nothing (like TLS) sits between us and
+ * the socket */
+static gssize
+relay_connection_recv_timestamped(LibWCRelay *relay,
+                                  GError **error) {
+    LibWCRelayPrivate *priv = relay->priv;
+    union {
+        struct cmsghdr align;
+        gchar buf[CMSG_SPACE(sizeof(struct scm_timestamping))];
+    } control;
+    struct iovec iov = {
+        .iov_base = priv->receive_buffer,
+        .iov_len = RECEIVE_CHUNK_SIZE
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    struct cmsghdr *cmsg;
+    struct scm_timestamping *timestamps;
+    const struct timespec *ts;
+    gssize count;
+    gint saved_errno;
+
+    do {
+        count = recvmsg(g_socket_get_fd(priv->socket), &msg, MSG_DONTWAIT);
+    } while (count < 0 && errno == EINTR);
+
+    if (count < 0) {
+        saved_errno = errno;
+        g_set_error_literal(error, G_IO_ERROR,
+                            g_io_error_from_errno(saved_errno),
+                            g_strerror(saved_errno));
+        return -1;
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET ||
+            cmsg->cmsg_type != SCM_TIMESTAMPING)
+            continue;
+
+        /* Only the software timestamp is on CLOCK_REALTIME like the rest of
+         * ours, hardware ones come from the NIC's own clock */
+        timestamps = (struct scm_timestamping*)CMSG_DATA(cmsg);
+        ts = &timestamps->ts[0];
+
+        priv->rx_timestamp =
+            ts->tv_sec * G_GINT64_CONSTANT(1000000000) + ts->tv_nsec;
+    }
+
+    return count;
+}
+
+/* Spins on the socket until it has something for us to read, or deadline
+ * passes. EOF and errors count as something to read, so the caller finds out
+ * about them. Returns whether we found anything */
+static gboolean
+relay_connection_busy_poll(LibWCRelay *relay,
+                           gint64 deadline) {
+    LibWCRelayPrivate *priv = relay->priv;
+    gint fd = g_socket_get_fd(priv->socket);
+    gint64 cpu_start;
+    gboolean readable = FALSE;
+    guint8 byte;
+
+    if (g_get_monotonic_time() >= deadline)
+        return FALSE;
+
+    cpu_start = _libwc_thread_cpu_time_ns();
+
+    /* Peeking at the socket works even if there's TLS on top of it, and with
+     * SO_BUSY_POLL each try polls the device for us too */
+    do {
+        if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 ||
+            (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            readable = TRUE;
+            break;
+        }
+    } while (g_get_monotonic_time() < deadline);
+
+    LIBWC_STAT_ADD(relay, busy_poll_time,
+                   _libwc_thread_cpu_time_ns() - cpu_start);
+    if (readable)
+        LIBWC_STAT_ADD(relay, busy_poll_hits, 1);
+    else
+        LIBWC_STAT_ADD(relay, busy_poll_misses, 1);
+
+    return readable;
+}
+
 gboolean
 socket_source_cb(GSocket *socket,
                  GIOCondition condition,
                  void *user_data) {
     __label__ socket_error;
     LibWCRelay *relay = user_data;
+    LibWCRelayPrivate *priv = relay->priv;
     GError *error = NULL;
-    void *data;
-    gsize count;
+    gint64 busy_poll_deadline = 0;
+    gssize count;
 
     if (condition & (G_IO_ERR | G_IO_HUP))
         goto socket_error;
 
-    data = g_malloc(relay->priv->read_len);
-
-    g_input_stream_read_all(relay->priv->input_stream, data,
-                            relay->priv->read_len, &count,
-                            relay->priv->input_stream_cancellable, &error);
-
-    if (error)
-        goto socket_error;
-
-    relay->priv->read_cb(relay, data, count);
-    g_free(data);
+    /* Keep reading until we'd block. Streams like TLS can have data buffered
+     * on their end, so the socket going quiet doesn't mean we've read
+     * everything */
+    while (priv->connected) {
+        if (priv->kernel_timestamps)
+            count = relay_connection_recv_timestamped(relay, &error);
+        else
+            count = g_pollable_input_stream_read_nonblocking(
+                G_POLLABLE_INPUT_STREAM(priv->input_stream),
+                priv->receive_buffer, RECEIVE_CHUNK_SIZE,
+                priv->input_stream_cancellable, &error);
+
+        if (count < 0) {
+            if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+                g_clear_error(&error);
+
+                if (!priv->busy_poll)
+                    return TRUE;
+
+                /* The budget covers the whole dispatch rather than each spin.
+                 * Under steady traffic every spin would find something, and
+                 * we'd never give the rest of the reactor a turn */
+                if (!busy_poll_deadline)
+                    busy_poll_deadline =
+                        g_get_monotonic_time() + priv->busy_poll;
+
+                if (relay_connection_busy_poll(relay, busy_poll_deadline))
+                    continue;
+
+                return TRUE;
+            }
+
+            goto socket_error;
+        }
+
+        if (count == 0) {
+            error = g_error_new_literal(G_IO_ERROR,
+                                        G_IO_ERROR_CONNECTION_CLOSED,
+                                        "The relay closed the connection");
+            goto socket_error;
+        }
+
+        _libwc_relay_connection_feed(relay, priv->receive_buffer, count);
+    }
 
-    return TRUE;
+    /* One of the read callbacks ended the connection */
+    return FALSE;
 
 socket_error:
-    g_socket_shutdown(socket, TRUE, TRUE, &error);
+    g_socket_shutdown(socket, TRUE, TRUE, NULL);
     _libwc_relay_connection_end_on_error(relay, error);
-    g_main_loop_quit(relay->priv->main_loop);
-    g_free(data);
+    g_clear_error(&error);
 
     return FALSE;
 }
 
+/* Starts reading from and writing to the relay's current stream, using
+ * whichever backend was requested */
 static void
-relay_connection_init_async_worker(GTask *task) {
-    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
-    GCancellable *cancellable = g_task_get_cancellable(task);
-    gchar *init_string;
-    guint cmd_id;
-    gsize init_string_len, bytes_written;
-    GBytes *init_bytes;
-    GSource *input_stream_source;
+relay_connection_start_io(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+#ifdef HAVE_LIBURING
+    GError *error = NULL;
+
+    if (priv->backend == LIBWC_RELAY_BACKEND_IO_URING &&
+        !_libwc_relay_uring_start(relay, &error)) {
+        g_warning("Couldn't use io_uring for relay, falling back to GIO: %s",
+                  error->message);
+        g_clear_error(&error);
+
+        priv->backend = LIBWC_RELAY_BACKEND_GIO;
+    }
+#endif
+
+    if (priv->backend == LIBWC_RELAY_BACKEND_GIO) {
+        if (!priv->receive_buffer)
+            priv->receive_buffer = g_malloc(RECEIVE_CHUNK_SIZE);
+
+        /* Kernel timestamps only make it to us if we're the ones reading from
+         * the socket */
+        priv->kernel_timestamps = FALSE;
+        if (priv->timestamps && G_IS_SOCKET_CONNECTION(priv->stream)) {
+            gint flags = SOF_TIMESTAMPING_SOFTWARE |
+                         SOF_TIMESTAMPING_RX_SOFTWARE;
+
+            if (setsockopt(g_socket_get_fd(priv->socket), SOL_SOCKET,
+                           SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+                priv->kernel_timestamps = TRUE;
+            else
+                g_debug("Couldn't turn on kernel timestamps: %s",
+                        g_strerror(errno));
+        }
+
+        /* Raising this past the net.core.busy_read sysctl takes
+         * CAP_NET_ADMIN, we still spin on our own without it */
+        if (priv->busy_poll &&
+            setsockopt(g_socket_get_fd(priv->socket), SOL_SOCKET,
+                       SO_BUSY_POLL, &priv->busy_poll,
+                       sizeof(priv->busy_poll)) < 0)
+            g_debug("Couldn't turn on SO_BUSY_POLL: %s", g_strerror(errno));
+
+        priv->source =
+            g_socket_create_source(priv->socket, G_IO_IN | G_IO_PRI,
+                                   priv->input_stream_cancellable);
+
+        g_source_set_callback(priv->source,
+                              (GSourceFunc)socket_source_cb, relay, NULL);
+        g_source_attach(priv->source, priv->context);
+    }
+}
+
+/* Runs on the relay's reactor thread. Swaps the relay's dead connection out for
+ * standby's, which must already be initialized and on the same reactor.
+ * Commands that are safe to send twice get sent again on the new connection,
+ * anything else that was still waiting on a response is failed with error */
+void
+_libwc_relay_connection_failover(LibWCRelay *relay,
+                                 LibWCRelay *standby,
+                                 const GError *error) {
+    LibWCRelayPrivate *priv = relay->priv,
+                      *standby_priv = standby->priv;
+    LibWCQueuedWrite *queued_write;
+    GPtrArray *replay_data;
+    gssize stale_bytes = 0;
+
+    /* Tear down the dead connection, but leave everything that hasn't been
+     * sent yet queued up */
+    priv->connection_serial++;
+
+    if (priv->source) {
+        g_source_destroy(priv->source);
+        g_source_unref(priv->source);
+        priv->source = NULL;
+    }
 
-    relay->priv->context = g_main_context_ref_thread_default();
+#ifdef HAVE_LIBURING
+    if (priv->backend == LIBWC_RELAY_BACKEND_IO_URING)
+        stale_bytes += _libwc_relay_uring_stop(relay);
+#endif
+
+    if (priv->current_write) {
+        stale_bytes += priv->current_write->size;
+        priv->current_write = NULL;
+    }
+
+    /* Whatever's waiting to be resumed was already partly sent on the dead
+     * connection */
+    while ((queued_write =
+            _libwc_write_scheduler_pop_resume(&priv->write_queue))) {
+        stale_bytes += queued_write->size;
+        _libwc_queued_write_free(queued_write);
+    }
+
+    if (stale_bytes)
+        _libwc_relay_window_adjust(relay, 0, -stale_bytes);
+
+    /* Anything still being decoded came from the dead connection, and the
+     * commands it would have answered are about to be failed or replayed */
+    if (priv->decoder)
+        _libwc_relay_decoder_reset(priv->decoder);
+
+    g_io_stream_clear_pending(priv->stream);
+    g_io_stream_close(priv->stream, NULL, NULL);
+    g_clear_object(&priv->stream);
+    g_clear_object(&priv->socket);
+
+    /* Replays go out before anything that was queued up after them. Only
+     * things like pings and resync requests get replayed, so they all go
+     * through the control lane */
+    replay_data = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    _libwc_relay_pending_tasks_fail_unreplayable(relay, error, replay_data);
+
+    for (guint i = replay_data->len; i-- > 0;) {
+        GBytes *data = g_ptr_array_index(replay_data, i);
+
+        queued_write = g_new0(LibWCQueuedWrite, 1);
+        *queued_write = (LibWCQueuedWrite) {
+            .relay = g_object_ref(relay),
+            .priority = LIBWC_COMMAND_PRIORITY_CONTROL,
+            .data = g_bytes_ref(data),
+            .size = g_bytes_get_size(data),
+            .queued_at = g_get_monotonic_time()
+        };
+
+        _libwc_relay_window_adjust(relay, 0, queued_write->size);
+        _libwc_write_scheduler_push_head(&priv->write_queue, queued_write);
+    }
 
-    relay->priv->source =
-        g_socket_create_source(relay->priv->socket, G_IO_IN | G_IO_PRI,
-                               relay->priv->input_stream_cancellable);
+    g_ptr_array_free(replay_data, TRUE);
 
-    g_source_set_callback(relay->priv->source, (GSourceFunc)socket_source_cb,
-                          relay, NULL);
-    g_source_attach(relay->priv->source, relay->priv->context);
+    /* Take over the standby's connection, along with whatever part of a
+     * message it was in the middle of receiving */
+    standby_priv->connected = FALSE;
+    standby_priv->connection_serial++;
+    standby_priv->current_write = NULL;
+
+    if (standby_priv->source) {
+        g_source_destroy(standby_priv->source);
+        g_source_unref(standby_priv->source);
+        standby_priv->source = NULL;
+    }
+
+    while ((queued_write =
+            _libwc_write_scheduler_pop(&standby_priv->write_queue)))
+        _libwc_queued_write_free(queued_write);
+    while ((queued_write = (LibWCQueuedWrite*)
+            _libwc_mpsc_queue_pop(&standby_priv->submit_queue)))
+        queued_write_fail(queued_write, NULL);
+
+    priv->stream = g_steal_pointer(&standby_priv->stream);
+    priv->socket = g_steal_pointer(&standby_priv->socket);
+    priv->input_stream = g_io_stream_get_input_stream(priv->stream);
+    priv->output_stream = g_io_stream_get_output_stream(priv->stream);
+
+    priv->read_cb = standby_priv->read_cb;
+    priv->read_len = standby_priv->read_len;
+    g_clear_pointer(&priv->spill, _libwc_spill_file_free);
+    priv->spill = g_steal_pointer(&standby_priv->spill);
+    g_byte_array_set_size(priv->rx_buffer, 0);
+    g_byte_array_append(priv->rx_buffer, standby_priv->rx_buffer->data,
+                        standby_priv->rx_buffer->len);
+
+    _libwc_reactor_release(standby_priv->reactor);
+    _libwc_relay_connection_detach(standby);
+
+    priv->connected = TRUE;
+    relay_connection_start_io(relay);
+    start_next_write(relay);
+}
+
+/* Gets rid of everything a disconnected relay still has attached to its
+ * reactor, so that it can be thrown away. Its hold on the reactor was already
+ * given up when the connection ended */
+void
+_libwc_relay_connection_detach(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+
+    g_return_if_fail(!priv->connected);
+
+    if (priv->wakeup_source) {
+        g_source_destroy(priv->wakeup_source);
+        g_source_unref(priv->wakeup_source);
+        priv->wakeup_source = NULL;
+    }
+
+    if (priv->deadline_source) {
+        g_source_destroy(priv->deadline_source);
+        g_source_unref(priv->deadline_source);
+        priv->deadline_source = NULL;
+    }
 
+    if (priv->shaper_source) {
+        g_source_destroy(priv->shaper_source);
+        g_source_unref(priv->shaper_source);
+        priv->shaper_source = NULL;
+    }
+
+    priv->reactor = NULL;
+}
+
+/* Picks the reactor thread the relay's connection gets handled on. Once a relay
+ * has had a reactor, it sticks with it */
+void
+_libwc_relay_connection_acquire_reactor(LibWCRelay *relay) {
+    /* Rather than giving every relay its own thread, we share a pool of event
+     * loop threads between all of them */
+    if (!relay->priv->reactor_pool)
+        relay->priv->reactor_pool =
+            g_object_ref(libwc_reactor_pool_get_default());
+
+    if (!relay->priv->reactor) {
+        relay->priv->reactor =
+            _libwc_reactor_pool_acquire(relay->priv->reactor_pool);
+        relay->priv->context =
+            g_main_context_ref(relay->priv->reactor->context);
+    }
+    else {
+        _libwc_reactor_reacquire(relay->priv->reactor);
+    }
+}
+
+/* Gets the relay ready to read the first message of a new stream */
+void
+_libwc_relay_connection_reset_reader(LibWCRelay *relay) {
     relay->priv->read_cb = read_msg_header_cb;
     relay->priv->read_len = HEADER_SIZE;
+    g_byte_array_set_size(relay->priv->rx_buffer, 0);
+    g_clear_pointer(&relay->priv->spill, _libwc_spill_file_free);
+}
+
+/* Runs on the relay's reactor thread. Starts handling the stream the relay was
+ * given, from the first byte of a frame */
+void
+_libwc_relay_connection_start(LibWCRelay *relay) {
+    relay->priv->connected = TRUE;
+
+    /* These stay attached across reconnects */
+    if (!relay->priv->wakeup_source) {
+        relay->priv->wakeup_source =
+            g_unix_fd_source_new(relay->priv->wakeup_fd, G_IO_IN);
+        g_source_set_callback(relay->priv->wakeup_source,
+                              (GSourceFunc)submit_queue_cb, relay, NULL);
+        g_source_attach(relay->priv->wakeup_source, relay->priv->context);
+
+        relay->priv->shaper_source =
+            g_source_new(&shaper_source_funcs, sizeof(GSource));
+        g_source_set_callback(relay->priv->shaper_source, NULL, relay, NULL);
+        g_source_set_ready_time(relay->priv->shaper_source, -1);
+        g_source_attach(relay->priv->shaper_source, relay->priv->context);
+
+        _libwc_relay_deadlines_attach(relay);
+    }
+
+    _libwc_relay_connection_reset_reader(relay);
+    relay_connection_start_io(relay);
+}
+
+/* Runs on the relay's reactor thread. Stops reading from the connection
+ * without ending it, whatever the relay sends in the meantime stays in the
+ * socket until _libwc_relay_connection_resume() */
+void
+_libwc_relay_connection_pause(LibWCRelay *relay) {
+    if (relay->priv->source) {
+        g_source_destroy(relay->priv->source);
+        g_source_unref(relay->priv->source);
+        relay->priv->source = NULL;
+    }
+}
+
+/* Runs on the relay's reactor thread */
+void
+_libwc_relay_connection_resume(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+
+    if (!priv->source)
+        relay_connection_start_io(relay);
+
+    /* Pick up anything that got submitted while we were paused */
+    g_atomic_int_set(&priv->wakeup_pending, TRUE);
+    eventfd_write(priv->wakeup_fd, 1);
+}
+
+/* Everything of the frame that's currently being received that we've already
+ * taken off the wire. Fed to a reader that was just reset, it leaves that
+ * reader exactly where this one is. If part of the frame went into a spill
+ * file, that part is left out and *spill is pointed at the file instead */
+GBytes *
+_libwc_relay_connection_save_reader(LibWCRelay *relay,
+                                    LibWCSpillFile **spill) {
+    LibWCRelayPrivate *priv = relay->priv;
+    GByteArray *partial = g_byte_array_new();
+
+    if (priv->read_cb != read_msg_header_cb)
+        g_byte_array_append(partial, priv->frame_header, HEADER_SIZE);
+
+    g_byte_array_append(partial, priv->rx_buffer->data, priv->rx_buffer->len);
+    *spill = priv->spill;
+
+    return g_byte_array_free_to_bytes(partial);
+}
+
+/* Runs on the relay's reactor thread once a handoff has gone through. The
+ * connection belongs to another process now, so unlike
+ * _libwc_relay_connection_end_on_error() we leave the socket alone and don't
+ * try to reconnect. Whatever was still waiting on a response gets failed,
+ * since the response is going to show up somewhere else */
+void
+_libwc_relay_connection_hand_off(LibWCRelay *relay) {
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCQueuedWrite *queued_write;
+    GError *error;
+
+    error = g_error_new_literal(LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_HANDED_OFF,
+                                "The connection to the relay was handed off "
+                                "to another process");
+
+    priv->connected = FALSE;
+    priv->connection_serial++;
+    priv->handoff = NULL;
+
+    _libwc_relay_connection_pause(relay);
+    g_clear_pointer(&priv->spill, _libwc_spill_file_free);
+    g_clear_pointer(&priv->adopted_ids, g_hash_table_unref);
+
+    /* This only closes our own descriptor for the socket, the new owner's
+     * keeps the connection open */
+    g_io_stream_close(priv->stream, NULL, NULL);
+
+    _libwc_relay_pending_tasks_fail_all(relay, error);
+
+    if (priv->decoder)
+        _libwc_relay_decoder_reset(priv->decoder);
+
+    _libwc_reactor_release(priv->reactor);
+
+    while ((queued_write =
+            (LibWCQueuedWrite*)_libwc_mpsc_queue_pop(&priv->submit_queue)))
+        queued_write_fail(queued_write, error);
+
+    window_fail_waiters(relay);
+
+    g_error_free(error);
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+relay_connection_init_async_worker(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    GCancellable *cancellable = g_task_get_cancellable(task);
+    gchar *init_string;
+    gsize init_string_len;
+    GBytes *init_bytes;
+
+    _libwc_relay_connection_start(relay);
 
     if (relay->priv->password) {
         init_string = g_strdup_printf("init password=%s\n",
@@ -341,20 +1451,22 @@ relay_connection_init_async_worker(GTask *task) {
     }
     else {
         init_string = "init\n";
-        init_string_len = sizeof("init\n");
+        init_string_len = strlen(init_string);
 
         init_bytes = g_bytes_new_static(init_string, init_string_len);
     }
 
     _libwc_relay_connection_queue_command(relay, init_bytes, NULL, 0,
+                                          LIBWC_TIMEOUT_NONE,
+                                          LIBWC_COMMAND_FLAG_NONE,
+                                          LIBWC_COMMAND_PRIORITY_CONTROL,
                                           cancellable);
     /* The ping command won't work if the previous init command fails, so we can
      * use it to check whether or not we've successfully initialized */
     libwc_relay_ping_async(relay, cancellable,
                            relay_connection_init_ping_response_cb, task, NULL);
 
-    relay->priv->main_loop = g_main_loop_new(relay->priv->context, FALSE);
-    g_main_loop_run(relay->priv->main_loop);
+    return G_SOURCE_REMOVE;
 }
 
 void
@@ -374,9 +1486,11 @@ libwc_relay_connection_init_async(LibWCRelay *relay,
     if (cancellable)
         g_task_set_check_cancellable(init_task, TRUE);
 
-    relay->priv->thread = g_thread_new(
-        "libweechat", (GThreadFunc)relay_connection_init_async_worker,
-        init_task);
+    _libwc_relay_connection_acquire_reactor(relay);
+
+    g_main_context_invoke(relay->priv->context,
+                          (GSourceFunc)relay_connection_init_async_worker,
+                          init_task);
 }
 
 gboolean
@@ -400,3 +1514,91 @@ libwc_relay_connection_init(LibWCRelay *relay,
     LIBWC_BLOCKING_WRAPPER(libwc_relay_connection_init, gboolean,
                            libwc_relay_connection_init_async);
 }
+
+void
+libwc_relay_window_set(LibWCRelay *relay,
+                       guint max_commands,
+                       gsize max_bytes) {
+    g_mutex_lock(&relay->priv->window_mutex);
+
+    g_atomic_int_set(&relay->priv->max_pending_commands, max_commands);
+    g_atomic_pointer_set(&relay->priv->max_pending_bytes, max_bytes);
+
+    window_update_and_unlock(relay);
+}
+
+gboolean
+libwc_relay_is_writable(LibWCRelay *relay) {
+    return g_atomic_int_get(&relay->priv->writable);
+}
+
+void
+libwc_relay_wait_writable_async(LibWCRelay *relay,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                void *user_data) {
+    LibWCWritableWaiter *waiter;
+    GTask *task;
+
+    task = g_task_new(relay, cancellable, callback, user_data);
+
+    g_mutex_lock(&relay->priv->window_mutex);
+    if (relay->priv->writable) {
+        g_mutex_unlock(&relay->priv->window_mutex);
+
+        g_task_return_boolean(task, TRUE);
+        g_object_unref(task);
+        return;
+    }
+    g_mutex_unlock(&relay->priv->window_mutex);
+
+    waiter = g_new0(LibWCWritableWaiter, 1);
+    waiter->task = task;
+
+    /* Connect to the cancellable before we queue the waiter, since the
+     * handler can't find the waiter until it's been queued. If we get
+     * cancelled before that happens, we'll notice it below */
+    if (cancellable) {
+        waiter->cancellable_id =
+            g_cancellable_connect(cancellable,
+                                  G_CALLBACK(writable_waiter_cancelled_cb),
+                                  waiter, NULL);
+    }
+
+    g_mutex_lock(&relay->priv->window_mutex);
+
+    if (relay->priv->writable ||
+        (cancellable && g_cancellable_is_cancelled(cancellable))) {
+        g_mutex_unlock(&relay->priv->window_mutex);
+
+        if (waiter->cancellable_id)
+            g_cancellable_disconnect(cancellable, waiter->cancellable_id);
+
+        if (!g_task_return_error_if_cancelled(task))
+            g_task_return_boolean(task, TRUE);
+
+        g_object_unref(task);
+        g_free(waiter);
+        return;
+    }
+
+    g_queue_push_tail(&relay->priv->writable_waiters, waiter);
+    g_mutex_unlock(&relay->priv->window_mutex);
+}
+
+gboolean
+libwc_relay_wait_writable_finish(LibWCRelay *relay,
+                                 GAsyncResult *res,
+                                 GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, relay), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(res), error);
+}
+
+gboolean
+libwc_relay_wait_writable(LibWCRelay *relay,
+                          GCancellable *cancellable,
+                          GError **error) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_wait_writable, gboolean,
+                           libwc_relay_wait_writable_async);
+}
@@ -16,6 +16,60 @@
 
 #include "libweechat.h"
 
+#include "mpsc-queue.h"
+#include "relay-parser.h"
+#include "spill-file.h"
+
+/* Every message from the relay starts with a header this long */
+#define LIBWC_RELAY_HEADER_SIZE ((gsize)5)
+
+/* Defaults for libwc_relay_frame_limits_set() */
+#define LIBWC_DEFAULT_MAX_HEAP_FRAME_SIZE ((gsize)16 * 1024 * 1024)
+#define LIBWC_DEFAULT_MAX_FRAME_SIZE      ((gsize)1024 * 1024 * 1024)
+
+typedef enum {
+    LIBWC_COMMAND_FLAG_NONE       = 0,
+    /* The command can safely be sent again if we fail over to another
+     * connection before getting a response to it */
+    LIBWC_COMMAND_FLAG_IDEMPOTENT = 1 << 0
+} LibWCCommandFlags;
+
+/* Which lane a command gets written out in, see write-scheduler.h */
+typedef enum {
+    /* Anything the user is waiting on, like input */
+    LIBWC_COMMAND_PRIORITY_INTERACTIVE,
+    /* Small housekeeping commands, like init and pings */
+    LIBWC_COMMAND_PRIORITY_CONTROL,
+    /* Large or numerous requests for data nobody needs right this moment,
+     * like backlog */
+    LIBWC_COMMAND_PRIORITY_BULK,
+
+    LIBWC_COMMAND_PRIORITY_COUNT
+} LibWCCommandPriority;
+
+struct _LibWCQueuedWrite {
+    LibWCMpscNode node;
+
+    LibWCRelay *relay;
+    GCancellable *cancellable;
+    GTask *task;
+    guint id;
+    guint timeout;
+    LibWCCommandFlags flags;
+    LibWCCommandPriority priority;
+    GBytes *data;
+    gsize size;
+
+    /* When the command was submitted, on the monotonic clock */
+    gint64 queued_at;
+
+    /* Which connection the write was started on, so that writes on a
+     * connection that's since been replaced can be told apart */
+    guint connection_serial;
+};
+
+typedef struct _LibWCQueuedWrite LibWCQueuedWrite;
+
 typedef void (*LibWCReadCallback) (LibWCRelay *relay,
                                    void *data,
                                    gsize size);
@@ -28,7 +82,69 @@ void _libwc_relay_connection_queue_command(LibWCRelay *relay,
                                            GBytes *data,
                                            GTask *task,
                                            guint id,
+                                           guint timeout,
+                                           LibWCCommandFlags flags,
+                                           LibWCCommandPriority priority,
                                            GCancellable *cancellable)
 G_GNUC_INTERNAL;
 
+void _libwc_relay_connection_failover(LibWCRelay *relay,
+                                      LibWCRelay *standby,
+                                      const GError *error)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_detach(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_queued_write_free(LibWCQueuedWrite *queued_write)
+G_GNUC_INTERNAL;
+
+LibWCQueuedWrite * _libwc_relay_connection_next_write(LibWCRelay *relay)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_relay_connection_write_done(LibWCRelay *relay,
+                                        LibWCQueuedWrite *queued_write)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_acquire_reactor(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_reset_reader(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_start(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_pause(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_resume(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+GBytes * _libwc_relay_connection_save_reader(LibWCRelay *relay,
+                                             LibWCSpillFile **spill)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_relay_connection_hand_off(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_frame_error(LibWCRelay *relay,
+                                         const gchar *response_id,
+                                         const GError *error)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_dispatch(LibWCRelay *relay,
+                                      LibWCRelayMessage *parsed_message)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_connection_feed(LibWCRelay *relay,
+                                  const void *data,
+                                  gsize len)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_window_adjust(LibWCRelay *relay,
+                                gint command_delta,
+                                gssize byte_delta)
+G_GNUC_INTERNAL;
+
 #endif /* !RELAY_CONNECTION_H */
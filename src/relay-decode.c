@@ -0,0 +1,436 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-connection.h"
+#include "relay-parser.h"
+#include "relay-decode.h"
+#include "spill-file.h"
+#include "misc.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Decoding payloads takes a lot more work than framing them, so when a relay
+ * has decode threads the reactor thread only splits the stream into payloads.
+ * Each payload becomes a job that a worker inflates and parses, while the
+ * reactor thread keeps every job in the order it came off the wire. Whenever
+ * jobs finish, the reactor thread releases every finished job at the front of
+ * that queue for dispatch, so the relay sees messages in the same order it
+ * would have without any threads at all */
+
+typedef struct {
+    /* One reference is held by the reorder queue, the other by the worker */
+    gint ref_count;
+    gint done;
+
+    GBytes *payload;
+    gboolean compressed;
+    gsize heap_limit;
+    gsize size_limit;
+    gboolean timestamps;
+    gint64 rx_timestamp;
+
+    LibWCRelayMessage *message;
+    GError *error;
+    gchar *response_id;
+} LibWCDecodeJob;
+
+struct _LibWCRelayDecoder {
+    LibWCRelay *relay;
+    GThreadPool *pool;
+
+    /* Only touched from the relay's reactor thread */
+    GQueue reorder_queue;
+    GSource *wakeup_source;
+
+    gint wakeup_fd;
+    gint wakeup_pending;
+};
+
+/* zlib streams are cheap to reset but not to create, so each worker thread
+ * keeps its own decompressor around */
+static GPrivate worker_decompressor = G_PRIVATE_INIT(g_object_unref);
+
+static void
+decode_job_unref(LibWCDecodeJob *job) {
+    if (!g_atomic_int_dec_and_test(&job->ref_count))
+        return;
+
+    g_bytes_unref(job->payload);
+
+    if (job->message)
+        _libwc_relay_message_free(job->message);
+    if (job->error)
+        g_error_free(job->error);
+    g_free(job->response_id);
+
+    g_free(job);
+}
+
+static gboolean
+inflate_spill(LibWCSpillFile **spill,
+              const void *data,
+              gsize size,
+              GError **error) {
+    if (!*spill && !(*spill = _libwc_spill_file_new(error)))
+        return FALSE;
+
+    return _libwc_spill_file_append(*spill, data, size, error);
+}
+
+/* Inflates a complete zlib stream. The result stays on the heap as long as it
+ * fits in heap_limit bytes, anything bigger gets spilled to a file. Streams
+ * that inflate to more than size_limit bytes are rejected. decompressor is
+ * reset afterwards so it can be used again */
+GBytes *
+_libwc_relay_payload_inflate(GConverter *decompressor,
+                             const void *data,
+                             gsize count,
+                             gsize heap_limit,
+                             gsize size_limit,
+                             GError **error) {
+    GConverterResult result;
+    LibWCSpillFile *spill = NULL;
+    const guint8 *input = data;
+    guint8 *outbuf;
+    gsize outbuf_size = MIN(MAX(count, 64) * 2, MAX(heap_limit, 64)),
+          outbuf_used = 0,
+          total_read = 0,
+          total_written = 0,
+          bytes_read,
+          bytes_written;
+    GError *convert_error = NULL;
+    gboolean failed = FALSE;
+
+    outbuf = g_malloc(outbuf_size);
+
+    /* Keep feeding the decompressor whatever input it hasn't consumed yet.
+     * Whenever the output buffer fills up it either grows, or once it's as
+     * big as it's allowed to get, gets emptied out into the spill file */
+    do {
+        if (outbuf_used == outbuf_size) {
+            if (spill || outbuf_size >= heap_limit) {
+                if (!inflate_spill(&spill, outbuf, outbuf_used, error)) {
+                    failed = TRUE;
+                    break;
+                }
+
+                outbuf_used = 0;
+            }
+            else {
+                outbuf_size = MIN(outbuf_size * 2, heap_limit);
+                outbuf = g_realloc(outbuf, outbuf_size);
+            }
+        }
+
+        result = g_converter_convert(decompressor,
+                                     input + total_read, count - total_read,
+                                     outbuf + outbuf_used,
+                                     outbuf_size - outbuf_used,
+                                     G_CONVERTER_INPUT_AT_END, &bytes_read,
+                                     &bytes_written, &convert_error);
+
+        /* Not enough room left to make any progress at all. Nothing got
+         * written, so make room the same way we do when the buffer's full.
+         * Only a buffer that's nearly empty gets to grow past heap_limit */
+        if (result == G_CONVERTER_ERROR &&
+            g_error_matches(convert_error, G_IO_ERROR, G_IO_ERROR_NO_SPACE)) {
+            g_clear_error(&convert_error);
+
+            if (outbuf_used && (spill || outbuf_size >= heap_limit)) {
+                if (!inflate_spill(&spill, outbuf, outbuf_used, error)) {
+                    failed = TRUE;
+                    break;
+                }
+
+                outbuf_used = 0;
+            }
+            else {
+                if (outbuf_used)
+                    outbuf_size = MIN(outbuf_size * 2, heap_limit);
+                else
+                    outbuf_size *= 2;
+
+                outbuf = g_realloc(outbuf, outbuf_size);
+            }
+
+            result = G_CONVERTER_CONVERTED;
+            continue;
+        }
+
+        total_read += bytes_read;
+        total_written += bytes_written;
+        outbuf_used += bytes_written;
+
+        if (G_UNLIKELY(total_written > size_limit)) {
+            g_set_error(error, LIBWC_ERROR_RELAY,
+                        LIBWC_ERROR_RELAY_INVALID_DATA,
+                        "Compressed payload inflates to more than the limit "
+                        "of %" G_GSIZE_FORMAT " bytes", size_limit);
+            failed = TRUE;
+            break;
+        }
+    } while (result == G_CONVERTER_CONVERTED);
+
+    g_converter_reset(decompressor);
+
+    if (!failed && result != G_CONVERTER_FINISHED) {
+        if (convert_error)
+            g_propagate_error(error, convert_error);
+        else
+            g_set_error_literal(
+                error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
+                "Compressed payload ended before the zlib stream did");
+
+        failed = TRUE;
+    }
+
+    if (!failed && spill &&
+        !_libwc_spill_file_append(spill, outbuf, outbuf_used, error))
+        failed = TRUE;
+
+    if (failed) {
+        if (spill)
+            _libwc_spill_file_free(spill);
+        g_free(outbuf);
+
+        return NULL;
+    }
+
+    if (!spill)
+        return g_bytes_new_take(outbuf, total_written);
+
+    g_free(outbuf);
+
+    return _libwc_spill_file_finish(spill, error);
+}
+
+static void
+decoder_wakeup(LibWCRelayDecoder *decoder) {
+    if (!g_atomic_int_get(&decoder->wakeup_pending) &&
+        g_atomic_int_compare_and_exchange(&decoder->wakeup_pending, FALSE,
+                                          TRUE))
+        eventfd_write(decoder->wakeup_fd, 1);
+}
+
+/* Runs on one of the decoder's worker threads */
+static void
+decode_worker(LibWCDecodeJob *job,
+              LibWCRelayDecoder *decoder) {
+    GConverter *decompressor;
+    gconstpointer data;
+    GBytes *inflated = NULL;
+    gsize size;
+
+    data = g_bytes_get_data(job->payload, &size);
+
+    if (job->compressed) {
+        decompressor = g_private_get(&worker_decompressor);
+        if (!decompressor) {
+            decompressor = G_CONVERTER(
+                g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+            g_private_set(&worker_decompressor, decompressor);
+        }
+
+        inflated = _libwc_relay_payload_inflate(decompressor, data, size,
+                                                job->heap_limit,
+                                                job->size_limit, &job->error);
+        data = inflated ? g_bytes_get_data(inflated, &size) : NULL;
+    }
+
+    if (data) {
+        job->message = _libwc_relay_message_parse_data((void*)data, size,
+                                                       &job->error);
+        if (!job->message)
+            job->response_id =
+                _libwc_relay_message_peek_response_id(data, size);
+    }
+
+    if (job->message && job->timestamps)
+        job->message->timestamps.parsed = _libwc_realtime_ns();
+
+    if (inflated)
+        g_bytes_unref(inflated);
+
+    g_atomic_int_set(&job->done, TRUE);
+    decoder_wakeup(decoder);
+    decode_job_unref(job);
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+decoder_wakeup_cb(gint fd,
+                  GIOCondition condition,
+                  LibWCRelayDecoder *decoder) {
+    LibWCRelay *relay = decoder->relay;
+    LibWCDecodeJob *job;
+    eventfd_t value;
+
+    eventfd_read(fd, &value);
+    g_atomic_int_set(&decoder->wakeup_pending, FALSE);
+
+    while ((job = g_queue_peek_head(&decoder->reorder_queue)) &&
+           g_atomic_int_get(&job->done)) {
+        g_queue_pop_head(&decoder->reorder_queue);
+
+        /* If this ends the connection we get reset, so nothing else gets
+         * dispatched after it */
+        if (G_UNLIKELY(!job->message)) {
+            _libwc_relay_connection_frame_error(relay, job->response_id,
+                                                job->error);
+            decode_job_unref(job);
+            continue;
+        }
+
+        if (job->timestamps)
+            job->message->timestamps.received = job->rx_timestamp;
+
+        _libwc_relay_connection_dispatch(relay,
+                                         g_steal_pointer(&job->message));
+        decode_job_unref(job);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+LibWCRelayDecoder *
+_libwc_relay_decoder_new(LibWCRelay *relay,
+                         guint n_threads) {
+    LibWCRelayDecoder *decoder = g_new0(LibWCRelayDecoder, 1);
+
+    decoder->relay = relay;
+    decoder->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    g_queue_init(&decoder->reorder_queue);
+
+    decoder->pool = g_thread_pool_new((GFunc)decode_worker, decoder,
+                                      n_threads, FALSE, NULL);
+
+    return decoder;
+}
+
+typedef struct {
+    LibWCRelayDecoder *decoder;
+
+    GMutex mutex;
+    GCond cond;
+    gboolean done;
+} LibWCDecoderFreeRequest;
+
+static void
+decoder_destroy(LibWCRelayDecoder *decoder) {
+    _libwc_relay_decoder_reset(decoder);
+
+    /* Workers poke our eventfd once they're done, so they all need to be
+     * finished before it goes away */
+    g_thread_pool_free(decoder->pool, FALSE, TRUE);
+
+    if (decoder->wakeup_source) {
+        g_source_destroy(decoder->wakeup_source);
+        g_source_unref(decoder->wakeup_source);
+    }
+
+    close(decoder->wakeup_fd);
+    g_free(decoder);
+}
+
+static gboolean
+decoder_free_worker(LibWCDecoderFreeRequest *request) {
+    decoder_destroy(request->decoder);
+
+    g_mutex_lock(&request->mutex);
+    request->done = TRUE;
+    g_cond_signal(&request->cond);
+    g_mutex_unlock(&request->mutex);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Can't be called while the relay's connection is still up. The reactor thread
+ * keeps running after the connection drops, and might be in the middle of
+ * dispatching our wakeup source, so once that's been attached the decoder has
+ * to be torn down over there. Doesn't return until it has been */
+void
+_libwc_relay_decoder_free(LibWCRelayDecoder *decoder) {
+    GMainContext *context = decoder->relay->priv->context;
+    LibWCDecoderFreeRequest request = { .decoder = decoder };
+
+    if (!decoder->wakeup_source) {
+        decoder_destroy(decoder);
+        return;
+    }
+
+    g_mutex_init(&request.mutex);
+    g_cond_init(&request.cond);
+
+    g_main_context_invoke(context, (GSourceFunc)decoder_free_worker, &request);
+
+    g_mutex_lock(&request.mutex);
+    while (!request.done)
+        g_cond_wait(&request.cond, &request.mutex);
+    g_mutex_unlock(&request.mutex);
+
+    g_mutex_clear(&request.mutex);
+    g_cond_clear(&request.cond);
+}
+
+/* Runs on the relay's reactor thread. Takes ownership of payload */
+void
+_libwc_relay_decoder_push(LibWCRelayDecoder *decoder,
+                          GBytes *payload,
+                          gboolean compressed) {
+    LibWCRelayPrivate *priv = decoder->relay->priv;
+    LibWCDecodeJob *job = g_new0(LibWCDecodeJob, 1);
+
+    if (G_UNLIKELY(!decoder->wakeup_source)) {
+        decoder->wakeup_source = g_unix_fd_source_new(decoder->wakeup_fd,
+                                                      G_IO_IN);
+        g_source_set_callback(decoder->wakeup_source,
+                              (GSourceFunc)decoder_wakeup_cb, decoder, NULL);
+        g_source_attach(decoder->wakeup_source, decoder->relay->priv->context);
+    }
+
+    job->ref_count = 2;
+    job->payload = payload;
+    job->compressed = compressed;
+    job->heap_limit = priv->max_heap_frame_size;
+    job->size_limit = priv->max_frame_size;
+    job->timestamps = priv->timestamps;
+    job->rx_timestamp = priv->rx_timestamp;
+
+    g_queue_push_tail(&decoder->reorder_queue, job);
+    g_thread_pool_push(decoder->pool, job, NULL);
+}
+
+/* Runs on the relay's reactor thread. Returns TRUE once everything that was
+ * pushed has been dispatched */
+gboolean
+_libwc_relay_decoder_is_idle(LibWCRelayDecoder *decoder) {
+    return g_queue_is_empty(&decoder->reorder_queue);
+}
+
+/* Runs on the relay's reactor thread. Throws out everything that hasn't been
+ * dispatched yet, jobs that are still being worked on get freed once their
+ * workers are done with them */
+void
+_libwc_relay_decoder_reset(LibWCRelayDecoder *decoder) {
+    LibWCDecodeJob *job;
+
+    while ((job = g_queue_pop_head(&decoder->reorder_queue)))
+        decode_job_unref(job);
+}
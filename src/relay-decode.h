@@ -0,0 +1,50 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_DECODE_H
+#define RELAY_DECODE_H
+
+#include "libweechat.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+typedef struct _LibWCRelayDecoder LibWCRelayDecoder;
+
+LibWCRelayDecoder * _libwc_relay_decoder_new(LibWCRelay *relay,
+                                             guint n_threads)
+G_GNUC_INTERNAL G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_relay_decoder_free(LibWCRelayDecoder *decoder)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_decoder_push(LibWCRelayDecoder *decoder,
+                               GBytes *payload,
+                               gboolean compressed)
+G_GNUC_INTERNAL;
+
+gboolean _libwc_relay_decoder_is_idle(LibWCRelayDecoder *decoder)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_decoder_reset(LibWCRelayDecoder *decoder)
+G_GNUC_INTERNAL;
+
+GBytes * _libwc_relay_payload_inflate(GConverter *decompressor,
+                                      const void *data,
+                                      gsize count,
+                                      gsize heap_limit,
+                                      gsize size_limit,
+                                      GError **error)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+#endif /* !RELAY_DECODE_H */
@@ -0,0 +1,204 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-parser.h"
+#include "relay-event-source.h"
+
+#include <glib.h>
+
+/* How long a single dispatch should take at most, in microseconds. If the
+ * application keeps up with that, we hand it bigger batches whenever there's a
+ * backlog, if it doesn't we hand it smaller ones so that the rest of its main
+ * loop still gets a chance to run */
+#define BATCH_TARGET_TIME ((gint64)2000)
+#define BATCH_SIZE_MIN    (16)
+#define BATCH_SIZE_MAX    (4096)
+
+/* Events are pushed into pending from the relay's reactor thread. When the
+ * source gets dispatched, everything in pending gets moved over to backlog at
+ * once, and the application gets handed up to batch_size events from it at a
+ * time. backlog is only touched from the application's context */
+typedef struct {
+    GSource source;
+    LibWCRelay *relay;
+
+    GMutex mutex;
+    GPtrArray *pending;
+
+    GPtrArray *backlog;
+    guint backlog_pos;
+    guint batch_size;
+} LibWCEventSource;
+
+/* Internal handlers like the aggregator's can keep events for themselves by
+ * setting them to NULL in the batch */
+static void
+free_events(LibWCRelayMessage **events,
+            guint count) {
+    for (guint i = 0; i < count; i++)
+        if (events[i])
+            _libwc_relay_message_free(events[i]);
+}
+
+static gboolean
+event_source_dispatch(GSource *source,
+                      GSourceFunc callback,
+                      void *user_data) {
+    LibWCEventSource *event_source = (LibWCEventSource*)source;
+    LibWCRelayEventFunc func = (LibWCRelayEventFunc)callback;
+    GPtrArray *backlog = event_source->backlog,
+              *swap;
+    LibWCRelayMessage **batch;
+    guint count;
+    gint64 start_time, elapsed;
+
+    if (event_source->backlog_pos == backlog->len) {
+        g_ptr_array_set_size(backlog, 0);
+        event_source->backlog_pos = 0;
+
+        g_mutex_lock(&event_source->mutex);
+        swap = event_source->pending;
+        event_source->pending = backlog;
+        event_source->backlog = backlog = swap;
+        g_mutex_unlock(&event_source->mutex);
+    }
+
+    batch = (LibWCRelayMessage**)&backlog->pdata[event_source->backlog_pos];
+    count = MIN(backlog->len - event_source->backlog_pos,
+                event_source->batch_size);
+
+    start_time = g_get_monotonic_time();
+    if (func && count)
+        func(event_source->relay, batch, count, user_data);
+    elapsed = g_get_monotonic_time() - start_time;
+
+    free_events(batch, count);
+    event_source->backlog_pos += count;
+
+    if (elapsed > BATCH_TARGET_TIME) {
+        event_source->batch_size = MAX(event_source->batch_size / 2,
+                                       BATCH_SIZE_MIN);
+    }
+    else if (event_source->backlog_pos < backlog->len) {
+        event_source->batch_size = MIN(event_source->batch_size * 2,
+                                       BATCH_SIZE_MAX);
+    }
+
+    /* Stay ready for as long as there's anything left to hand out */
+    g_mutex_lock(&event_source->mutex);
+    if (event_source->backlog_pos == backlog->len &&
+        event_source->pending->len == 0)
+        g_source_set_ready_time(source, -1);
+    g_mutex_unlock(&event_source->mutex);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+event_source_finalize(GSource *source) {
+    LibWCEventSource *event_source = (LibWCEventSource*)source;
+    GPtrArray *backlog = event_source->backlog;
+
+    free_events((LibWCRelayMessage**)event_source->pending->pdata,
+                event_source->pending->len);
+    free_events((LibWCRelayMessage**)&backlog->pdata[event_source->backlog_pos],
+                backlog->len - event_source->backlog_pos);
+
+    g_ptr_array_unref(event_source->pending);
+    g_ptr_array_unref(backlog);
+    g_mutex_clear(&event_source->mutex);
+}
+
+static GSourceFuncs event_source_funcs = {
+    .dispatch = event_source_dispatch,
+    .finalize = event_source_finalize
+};
+
+static GSource *
+event_source_new(LibWCRelay *relay) {
+    GSource *source;
+    LibWCEventSource *event_source;
+
+    source = g_source_new(&event_source_funcs, sizeof(LibWCEventSource));
+    g_source_set_name(source, "libweechat events");
+
+    event_source = (LibWCEventSource*)source;
+    event_source->relay = relay;
+    event_source->pending = g_ptr_array_new();
+    event_source->backlog = g_ptr_array_new();
+    event_source->batch_size = BATCH_SIZE_MIN;
+    g_mutex_init(&event_source->mutex);
+
+    return source;
+}
+
+/* Runs on the relay's reactor thread. Returns FALSE if nobody is listening for
+ * events, in which case the caller keeps ownership of the event */
+gboolean
+_libwc_relay_event_deliver(LibWCRelay *relay,
+                           LibWCRelayMessage *event) {
+    LibWCEventSource *event_source;
+
+    g_mutex_lock(&relay->priv->event_mutex);
+
+    event_source = (LibWCEventSource*)relay->priv->event_source;
+    if (!event_source) {
+        g_mutex_unlock(&relay->priv->event_mutex);
+        return FALSE;
+    }
+
+    /* Only the first event in a batch needs to wake up the application's
+     * context, everything after that just piles on */
+    g_mutex_lock(&event_source->mutex);
+    g_ptr_array_add(event_source->pending, event);
+    if (event_source->pending->len == 1)
+        g_source_set_ready_time(&event_source->source, 0);
+    g_mutex_unlock(&event_source->mutex);
+
+    g_mutex_unlock(&relay->priv->event_mutex);
+
+    return TRUE;
+}
+
+/* Events are handed to func in batches from context, or the global default
+ * context if context is NULL. Any events that haven't been handed over to the
+ * previous handler yet are dropped. Passing a NULL func stops event delivery
+ * altogether */
+void
+libwc_relay_event_handler_set(LibWCRelay *relay,
+                              GMainContext *context,
+                              LibWCRelayEventFunc func,
+                              void *user_data,
+                              GDestroyNotify notify) {
+    GSource *new_source = NULL,
+            *old_source;
+
+    if (func) {
+        new_source = event_source_new(relay);
+        g_source_set_callback(new_source, (GSourceFunc)func, user_data,
+                              notify);
+        g_source_attach(new_source, context);
+    }
+
+    g_mutex_lock(&relay->priv->event_mutex);
+    old_source = relay->priv->event_source;
+    relay->priv->event_source = new_source;
+    g_mutex_unlock(&relay->priv->event_mutex);
+
+    if (old_source) {
+        g_source_destroy(old_source);
+        g_source_unref(old_source);
+    }
+}
@@ -16,10 +16,10 @@
 #include "relay-command.h"
 #include "relay-private.h"
 #include "relay-parser.h"
+#include "relay-standby.h"
 
 #include <glib.h>
-#include <stdlib.h>
-#include <errno.h>
+#include <string.h>
 
 #define BEGIN_HANDLER __label__ event_error;
 
@@ -37,7 +37,8 @@ _libwc_event_handler_pong(LibWCRelay *relay,
     BEGIN_HANDLER;
     LibWCRelayMessageObject *argument_object;
     const gchar *ping_msg;
-    gchar **ping_args = NULL;
+    gchar *result = NULL;
+    gsize id_len;
     guint command_id;
     GTask *pending_task;
     GVariant *maybe = NULL;
@@ -50,34 +51,39 @@ _libwc_event_handler_pong(LibWCRelay *relay,
     IGNORE_EVENT_IF_FAIL(maybe != NULL);
     ping_msg = g_variant_get_string(maybe, NULL);
 
-    /* Split the ping message into two parts: the message ID, and (if
+    if (strcmp(ping_msg, LIBWC_STANDBY_KEEPALIVE) == 0) {
+        relay->priv->last_keepalive = g_get_monotonic_time();
+        g_variant_unref(maybe);
+
+        return;
+    }
+
+    /* The ping message is made up of two parts: the message ID, and (if
      * applicable) whatever string was returned with the ping */
-    ping_args = g_strsplit(ping_msg, " ", 2);
+    id_len = strcspn(ping_msg, " ");
+    IGNORE_EVENT_IF_FAIL(_libwc_command_id_parse(ping_msg, id_len,
+                                                 &command_id));
 
-    errno = 0;
-    command_id = strtoul(ping_args[0], NULL, 16);
-    IGNORE_EVENT_IF_FAIL(errno == 0);
+    /* Answers a ping that was sent before the connection was handed to us */
+    if (_libwc_relay_adopted_id_take(relay, command_id))
+        goto event_error;
 
     pending_task = _libwc_relay_pending_tasks_lookup(relay, command_id);
     IGNORE_EVENT_IF_FAIL(pending_task != NULL);
 
-    g_task_return_pointer(pending_task, ping_args[1], g_free);
-    _libwc_relay_pending_tasks_remove(relay, command_id);
+    if (ping_msg[id_len] == ' ')
+        result = g_strdup(&ping_msg[id_len + 1]);
 
-    /* Mark the second argument as NULL, so it doesn't get freed with the rest
-     * of the arguments */
-    ping_args[1] = NULL;
+    g_task_return_pointer(pending_task, result, g_free);
+    _libwc_relay_pending_tasks_remove(relay, command_id);
 
     g_variant_unref(maybe);
-    g_strfreev(ping_args);
 
     return;
 
 event_error:
     if (maybe)
         g_variant_unref(maybe);
-    if (ping_args)
-        g_strfreev(ping_args);
 
     return;
 }
@@ -0,0 +1,687 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* Hands a live relay connection over to another process, so that whatever is
+ * using libweechat can restart without the relay ever noticing. The sending
+ * side stops taking new commands, lets everything that's queued go out, then
+ * stops reading and waits for whatever it already read to be dispatched. At
+ * that point the only state the connection has is the socket itself, the part
+ * of a frame we were in the middle of receiving, and the commands still
+ * waiting on a response, which is what gets sent over.
+ *
+ * The receiving side picks up reading where we left off. The responses to the
+ * commands that were still pending get dropped as they come in, since nobody
+ * on this end is waiting on them. Frames are compressed one at a time, so
+ * there's no compression state to carry over.
+ *
+ * The state goes over a Unix socket as a header carrying the descriptors,
+ * followed by a GVariant. Only plain socket connections can be handed off,
+ * there's no way to hand over the state of a TLS session */
+
+#include "config.h"
+
+#include "libweechat.h"
+#include "async-wrapper.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-connection.h"
+#include "relay-decode.h"
+#include "spill-file.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <gio/gunixfdmessage.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HANDOFF_MAGIC      "LWCH"
+#define HANDOFF_MAGIC_SIZE (sizeof(HANDOFF_MAGIC) - 1)
+#define HANDOFF_HEADER_SIZE (HANDOFF_MAGIC_SIZE + sizeof(guint32))
+
+#define HANDOFF_VERSION 1
+
+/* Version, the socket, the spill file or -1, the partial frame, and the IDs of
+ * the commands that are still pending */
+#define HANDOFF_VARIANT_TYPE_STR "(uhhayau)"
+#define HANDOFF_VARIANT_TYPE (G_VARIANT_TYPE(HANDOFF_VARIANT_TYPE_STR))
+
+/* How often to check whether the relay has quieted down, in milliseconds */
+#define HANDOFF_POLL_INTERVAL 1
+
+typedef struct {
+    GSocket *channel;
+    GVariant *state;
+    GUnixFDList *fds;
+} LibWCHandoff;
+
+static void
+handoff_free(LibWCHandoff *handoff) {
+    g_object_unref(handoff->channel);
+
+    if (handoff->state)
+        g_variant_unref(handoff->state);
+    if (handoff->fds)
+        g_object_unref(handoff->fds);
+
+    g_free(handoff);
+}
+
+static gboolean
+handoff_send_all(GSocket *channel,
+                 const guint8 *data,
+                 gsize size,
+                 GCancellable *cancellable,
+                 GError **error) {
+    gssize sent;
+
+    while (size) {
+        sent = g_socket_send(channel, (const gchar*)data, size, cancellable,
+                             error);
+        if (sent < 0)
+            return FALSE;
+
+        data += sent;
+        size -= sent;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+handoff_receive_all(GSocket *channel,
+                    guint8 *data,
+                    gsize size,
+                    GCancellable *cancellable,
+                    GError **error) {
+    gssize received;
+
+    while (size) {
+        received = g_socket_receive(channel, (gchar*)data, size, cancellable,
+                                    error);
+        if (received < 0)
+            return FALSE;
+
+        if (received == 0) {
+            g_set_error_literal(error, G_IO_ERROR,
+                                G_IO_ERROR_CONNECTION_CLOSED,
+                                "The handoff channel was closed early");
+            return FALSE;
+        }
+
+        data += received;
+        size -= received;
+    }
+
+    return TRUE;
+}
+
+/* Runs in a worker thread, since the channel is a blocking socket */
+static void
+handoff_send_thread(GTask *task,
+                    LibWCRelay *relay,
+                    LibWCHandoff *handoff,
+                    GCancellable *cancellable) {
+    GSocketControlMessage *fd_message;
+    GOutputVector vector;
+    guint8 header[HANDOFF_HEADER_SIZE];
+    guint32 state_size;
+    gssize sent;
+    GError *error = NULL;
+
+    state_size = GUINT32_TO_BE(g_variant_get_size(handoff->state));
+    memcpy(header, HANDOFF_MAGIC, HANDOFF_MAGIC_SIZE);
+    memcpy(header + HANDOFF_MAGIC_SIZE, &state_size, sizeof(state_size));
+
+    /* The descriptors ride along with the first byte of the header */
+    vector.buffer = header;
+    vector.size = sizeof(header);
+    fd_message = g_unix_fd_message_new_with_fd_list(handoff->fds);
+
+    sent = g_socket_send_message(handoff->channel, NULL, &vector, 1,
+                                 &fd_message, 1, G_SOCKET_MSG_NONE,
+                                 cancellable, &error);
+    g_object_unref(fd_message);
+
+    if (sent < 0 ||
+        !handoff_send_all(handoff->channel, header + sent,
+                          sizeof(header) - sent, cancellable, &error) ||
+        !handoff_send_all(handoff->channel,
+                          g_variant_get_data(handoff->state),
+                          g_variant_get_size(handoff->state), cancellable,
+                          &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    g_task_return_boolean(task, TRUE);
+}
+
+/* Runs on the relay's reactor thread */
+static void
+handoff_sent_cb(GObject *source_object,
+                GAsyncResult *res,
+                void *user_data) {
+    LibWCRelay *relay = LIBWC_RELAY(source_object);
+    GTask *task = user_data;
+    GError *error = NULL;
+
+    /* If the other side never got it, the connection is still ours */
+    if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+        relay->priv->handoff = NULL;
+        _libwc_relay_connection_resume(relay);
+
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    _libwc_relay_connection_hand_off(relay);
+
+    g_task_return_boolean(task, TRUE);
+    g_object_unref(task);
+}
+
+static void
+collect_pending_id(guint id,
+                   LibWCCommandSlot *slot,
+                   GVariantBuilder *builder) {
+    g_variant_builder_add(builder, "u", id);
+}
+
+/* Runs on the relay's reactor thread, once there's nothing left in flight on
+ * our end. The relay stays paused until the state has been sent */
+static void
+handoff_export(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCHandoff *handoff = g_task_get_task_data(task);
+    LibWCSpillFile *spill;
+    GVariantBuilder pending_ids;
+    GBytes *partial;
+    GTask *send_task;
+    gint socket_handle,
+         spill_handle = -1;
+    GError *error = NULL;
+
+    partial = _libwc_relay_connection_save_reader(relay, &spill);
+
+    handoff->fds = g_unix_fd_list_new();
+    socket_handle = g_unix_fd_list_append(handoff->fds,
+                                          g_socket_get_fd(priv->socket),
+                                          &error);
+    if (socket_handle >= 0 && spill)
+        spill_handle = g_unix_fd_list_append(handoff->fds,
+                                             _libwc_spill_file_get_fd(spill),
+                                             &error);
+
+    if (socket_handle < 0 || (spill && spill_handle < 0)) {
+        g_bytes_unref(partial);
+
+        priv->handoff = NULL;
+        _libwc_relay_connection_resume(relay);
+
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    g_variant_builder_init(&pending_ids, G_VARIANT_TYPE("au"));
+    _libwc_command_slab_foreach(&priv->pending_commands,
+                                (LibWCCommandSlabFunc)collect_pending_id,
+                                &pending_ids);
+
+    handoff->state = g_variant_ref_sink(
+        g_variant_new("(uhh@ayau)", HANDOFF_VERSION, socket_handle,
+                      spill_handle,
+                      g_variant_new_from_bytes(G_VARIANT_TYPE_BYTESTRING,
+                                               partial, TRUE),
+                      &pending_ids));
+    g_bytes_unref(partial);
+
+    /* Created here so that we get called back on the reactor */
+    send_task = g_task_new(relay, g_task_get_cancellable(task),
+                           handoff_sent_cb, task);
+    g_task_set_task_data(send_task, handoff, NULL);
+    g_task_run_in_thread(send_task, (GTaskThreadFunc)handoff_send_thread);
+    g_object_unref(send_task);
+}
+
+static void handoff_schedule(GTask *task);
+
+/* Runs on the relay's reactor thread. New commands are already being held
+ * back, everything that was queued before that goes out first. Once it has,
+ * we stop reading and give the decode threads a chance to finish what they
+ * were working on, so that the only responses still coming are the ones to
+ * the commands we hand over */
+static gboolean
+handoff_step(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    LibWCRelayPrivate *priv = relay->priv;
+
+    /* Ending the connection already failed anything we were holding back */
+    if (!priv->connected) {
+        priv->handoff = NULL;
+
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_CLOSED,
+                                "The connection to the relay was closed "
+                                "before it could be handed off");
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (g_cancellable_is_cancelled(g_task_get_cancellable(task))) {
+        priv->handoff = NULL;
+        _libwc_relay_connection_resume(relay);
+
+        g_task_return_error_if_cancelled(task);
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (priv->current_write ||
+        !_libwc_write_scheduler_is_empty(&priv->write_queue)) {
+        handoff_schedule(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    _libwc_relay_connection_pause(relay);
+
+    if (priv->decoder && !_libwc_relay_decoder_is_idle(priv->decoder)) {
+        handoff_schedule(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    handoff_export(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+handoff_schedule(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    GSource *source = g_timeout_source_new(HANDOFF_POLL_INTERVAL);
+
+    g_source_set_callback(source, (GSourceFunc)handoff_step, task, NULL);
+    g_source_attach(source, relay->priv->context);
+    g_source_unref(source);
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+handoff_send_worker(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    LibWCRelayPrivate *priv = relay->priv;
+
+    if (!priv->connected) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_CLOSED,
+                                "The relay isn't connected");
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (priv->handoff) {
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_PENDING,
+                                "The connection is already being handed off");
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    /* Anything the relay has already read off the socket on its own would be
+     * lost, and we can't hand over the state of a TLS session */
+    if (priv->backend != LIBWC_RELAY_BACKEND_GIO ||
+        !G_IS_SOCKET_CONNECTION(priv->stream)) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_NOT_SUPPORTED,
+                                "Only plain socket connections handled "
+                                "through GIO can be handed off");
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    priv->handoff = task;
+
+    return handoff_step(task);
+}
+
+/* Hands the relay's connection over to whoever is on the other end of
+ * channel, which has to be a connected Unix socket. They take it over with
+ * libwc_relay_handoff_receive(). Once this succeeds, the relay is left
+ * disconnected here, and anything that was waiting on a response fails with
+ * LIBWC_ERROR_RELAY_HANDED_OFF. If it fails, the connection carries on as if
+ * nothing happened */
+void
+libwc_relay_handoff_send_async(LibWCRelay *relay,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               void *user_data,
+                               GSocket *channel) {
+    LibWCHandoff *handoff;
+    GTask *task;
+
+    g_return_if_fail(g_socket_get_family(channel) == G_SOCKET_FAMILY_UNIX);
+
+    task = g_task_new(relay, cancellable, callback, user_data);
+
+    handoff = g_new0(LibWCHandoff, 1);
+    handoff->channel = g_object_ref(channel);
+    g_task_set_task_data(task, handoff, (GDestroyNotify)handoff_free);
+
+    if (!relay->priv->context) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_CLOSED,
+                                "The relay isn't connected");
+        g_object_unref(task);
+        return;
+    }
+
+    g_main_context_invoke(relay->priv->context,
+                          (GSourceFunc)handoff_send_worker, task);
+}
+
+gboolean
+libwc_relay_handoff_send_finish(LibWCRelay *relay,
+                                GAsyncResult *res,
+                                GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, relay), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(res), error);
+}
+
+gboolean
+libwc_relay_handoff_send(LibWCRelay *relay,
+                         GCancellable *cancellable,
+                         GError **error,
+                         GSocket *channel) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_handoff_send, gboolean,
+                           libwc_relay_handoff_send_async, channel);
+}
+
+/* Takes the descriptor the state refers to by handle out of the list, or
+ * returns -1 if it isn't there */
+static gint
+handoff_take_fd(GUnixFDList *fds,
+                gint handle,
+                GError **error) {
+    if (handle < 0 || handle >= g_unix_fd_list_get_length(fds)) {
+        g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
+                    "Handoff refers to descriptor %d, but only %d were sent",
+                    handle, g_unix_fd_list_get_length(fds));
+        return -1;
+    }
+
+    return g_unix_fd_list_get(fds, handle, error);
+}
+
+/* Runs in a worker thread. Receives the state, and sets the relay up to use
+ * the socket that came with it */
+static void
+handoff_receive_thread(GTask *task,
+                       LibWCRelay *relay,
+                       LibWCHandoff *handoff,
+                       GCancellable *cancellable) {
+    GSocketControlMessage **messages = NULL;
+    GSocketConnection *connection;
+    GSocket *socket;
+    GInputVector vector;
+    guint8 header[HANDOFF_HEADER_SIZE];
+    guint8 *state_data;
+    guint32 state_size;
+    guint32 version;
+    gint socket_handle, n_messages = 0, flags = 0, fd;
+    gssize received;
+    GError *error = NULL;
+
+    vector.buffer = header;
+    vector.size = sizeof(header);
+
+    received = g_socket_receive_message(handoff->channel, NULL, &vector, 1,
+                                        &messages, &n_messages, &flags,
+                                        cancellable, &error);
+    if (received < 0) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    for (gint i = 0; i < n_messages; i++) {
+        if (!handoff->fds && G_IS_UNIX_FD_MESSAGE(messages[i]))
+            handoff->fds = g_object_ref(
+                g_unix_fd_message_get_fd_list(
+                    G_UNIX_FD_MESSAGE(messages[i])));
+
+        g_object_unref(messages[i]);
+    }
+    g_free(messages);
+
+    if (received == 0 || !handoff->fds) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_INVALID_DATA,
+                                "Didn't receive a connection to take over");
+        return;
+    }
+
+    if (!handoff_receive_all(handoff->channel, header + received,
+                             sizeof(header) - received, cancellable,
+                             &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    if (memcmp(header, HANDOFF_MAGIC, HANDOFF_MAGIC_SIZE) != 0) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_INVALID_DATA,
+                                "Received something that isn't a handoff");
+        return;
+    }
+
+    memcpy(&state_size, header + HANDOFF_MAGIC_SIZE, sizeof(state_size));
+    state_size = GUINT32_FROM_BE(state_size);
+
+    state_data = g_malloc(state_size);
+    if (!handoff_receive_all(handoff->channel, state_data, state_size,
+                             cancellable, &error)) {
+        g_free(state_data);
+        g_task_return_error(task, error);
+        return;
+    }
+
+    handoff->state = g_variant_ref_sink(
+        g_variant_new_from_data(HANDOFF_VARIANT_TYPE, state_data, state_size,
+                                FALSE, g_free, state_data));
+
+    g_variant_get_child(handoff->state, 0, "u", &version);
+    if (version != HANDOFF_VERSION) {
+        g_task_return_new_error(task, LIBWC_ERROR_RELAY,
+                                LIBWC_ERROR_RELAY_NOT_SUPPORTED,
+                                "Handoff is version %u, we only understand "
+                                "version %u", version, HANDOFF_VERSION);
+        return;
+    }
+
+    g_variant_get_child(handoff->state, 1, "h", &socket_handle);
+    fd = handoff_take_fd(handoff->fds, socket_handle, &error);
+    if (fd < 0) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    socket = g_socket_new_from_fd(fd, &error);
+    if (!socket) {
+        close(fd);
+        g_task_return_error(task, error);
+        return;
+    }
+
+    connection = g_socket_connection_factory_create_connection(socket);
+    libwc_relay_connection_set(relay, G_IO_STREAM(connection), socket);
+    g_object_unref(connection);
+    g_object_unref(socket);
+
+    g_task_return_boolean(task, TRUE);
+}
+
+/* Feeds the part of the frame that went into the sender's spill file */
+static gboolean
+handoff_import_spill(LibWCRelay *relay,
+                     LibWCHandoff *handoff,
+                     gint spill_handle,
+                     GError **error) {
+    GMappedFile *mapped;
+    gint fd;
+
+    fd = handoff_take_fd(handoff->fds, spill_handle, error);
+    if (fd < 0)
+        return FALSE;
+
+    mapped = g_mapped_file_new_from_fd(fd, FALSE, error);
+    close(fd);
+
+    if (!mapped)
+        return FALSE;
+
+    _libwc_relay_connection_feed(relay, g_mapped_file_get_contents(mapped),
+                                 g_mapped_file_get_length(mapped));
+    g_mapped_file_unref(mapped);
+
+    return TRUE;
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+handoff_import_worker(GTask *task) {
+    LibWCRelay *relay = LIBWC_RELAY(g_task_get_source_object(task));
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCHandoff *handoff = g_task_get_task_data(task);
+    GVariant *partial, *pending_ids;
+    GVariantIter iter;
+    gint spill_handle;
+    guint id;
+    GError *error = NULL;
+
+    _libwc_relay_connection_start(relay);
+
+    g_variant_get_child(handoff->state, 2, "h", &spill_handle);
+    partial = g_variant_get_child_value(handoff->state, 3);
+    pending_ids = g_variant_get_child_value(handoff->state, 4);
+
+    _libwc_relay_connection_feed(relay, g_variant_get_data(partial),
+                                 g_variant_get_size(partial));
+    g_variant_unref(partial);
+
+    if (priv->connected && spill_handle >= 0 &&
+        !handoff_import_spill(relay, handoff, spill_handle, &error))
+        _libwc_relay_connection_end_on_error(relay, error);
+
+    /* The frame we picked up in the middle of can only be bad if the sender
+     * was set up to accept bigger frames than we are */
+    if (!priv->connected) {
+        g_variant_unref(pending_ids);
+
+        if (!error)
+            error = g_error_new_literal(LIBWC_ERROR_RELAY,
+                                        LIBWC_ERROR_RELAY_INVALID_DATA,
+                                        "Couldn't pick up the frame the "
+                                        "connection was handed off in the "
+                                        "middle of");
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (g_variant_n_children(pending_ids)) {
+        priv->adopted_ids = g_hash_table_new(NULL, NULL);
+
+        g_variant_iter_init(&iter, pending_ids);
+        /* Our own slab could hand out the same IDs, keep it from doing that
+         * until the responses to them have long since come in */
+        while (g_variant_iter_next(&iter, "u", &id)) {
+            g_hash_table_add(priv->adopted_ids, GUINT_TO_POINTER(id));
+            _libwc_command_slab_reserve(&priv->pending_commands, id);
+        }
+    }
+    g_variant_unref(pending_ids);
+
+    g_task_return_boolean(task, TRUE);
+    g_object_unref(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+handoff_received_cb(GObject *source_object,
+                    GAsyncResult *res,
+                    void *user_data) {
+    LibWCRelay *relay = LIBWC_RELAY(source_object);
+    GTask *task = user_data;
+    GError *error = NULL;
+
+    if (!g_task_propagate_boolean(G_TASK(res), &error)) {
+        g_task_return_error(task, error);
+        g_object_unref(task);
+        return;
+    }
+
+    _libwc_relay_connection_acquire_reactor(relay);
+
+    g_main_context_invoke(relay->priv->context,
+                          (GSourceFunc)handoff_import_worker, task);
+}
+
+/* Takes over a connection that another process is handing off with
+ * libwc_relay_handoff_send() over channel. The relay must not be connected,
+ * and doesn't need to be initialized afterwards, it picks up exactly where the
+ * other process left off */
+void
+libwc_relay_handoff_receive_async(LibWCRelay *relay,
+                                  GCancellable *cancellable,
+                                  GAsyncReadyCallback callback,
+                                  void *user_data,
+                                  GSocket *channel) {
+    LibWCHandoff *handoff;
+    GTask *task, *receive_task;
+
+    g_assert_false(relay->priv->connected);
+    g_return_if_fail(g_socket_get_family(channel) == G_SOCKET_FAMILY_UNIX);
+
+    task = g_task_new(relay, cancellable, callback, user_data);
+
+    handoff = g_new0(LibWCHandoff, 1);
+    handoff->channel = g_object_ref(channel);
+    g_task_set_task_data(task, handoff, (GDestroyNotify)handoff_free);
+
+    receive_task = g_task_new(relay, cancellable, handoff_received_cb, task);
+    g_task_set_task_data(receive_task, handoff, NULL);
+    g_task_run_in_thread(receive_task,
+                         (GTaskThreadFunc)handoff_receive_thread);
+    g_object_unref(receive_task);
+}
+
+gboolean
+libwc_relay_handoff_receive_finish(LibWCRelay *relay,
+                                   GAsyncResult *res,
+                                   GError **error) {
+    g_return_val_if_fail(g_task_is_valid(res, relay), FALSE);
+
+    return g_task_propagate_boolean(G_TASK(res), error);
+}
+
+gboolean
+libwc_relay_handoff_receive(LibWCRelay *relay,
+                            GCancellable *cancellable,
+                            GError **error,
+                            GSocket *channel) {
+    LIBWC_BLOCKING_WRAPPER(libwc_relay_handoff_receive, gboolean,
+                           libwc_relay_handoff_receive_async, channel);
+}
@@ -65,6 +65,12 @@ _libwc_relay_message_free(LibWCRelayMessage *message) {
     g_free(message);
 }
 
+/* For the responses handed back by libwc_relay_command_finish() */
+void
+libwc_relay_message_free(LibWCRelayMessage *message) {
+    _libwc_relay_message_free(message);
+}
+
 static inline gboolean
 check_msg_bounds(const void *pos,
                  const void *end_ptr,
@@ -92,7 +98,6 @@ get_object_type_from_string(const gchar *str,
     if (!type) {
         gchar *data_type = g_strescape(str, NULL);
 
-        g_warn_if_reached();
         g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
                     "Unknown data type encountered: '%s'", data_type);
 
@@ -111,7 +116,8 @@ extract_object_type(void **pos,
     LibWCRelayObjectType type;
     gchar type_str[4] = {0};
 
-    g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, OBJECT_ID_LEN, error), 0);
+    if (!check_msg_bounds(*pos, end_ptr, OBJECT_ID_LEN, error))
+        return 0;
 
     memcpy(type_str, *pos, OBJECT_ID_LEN);
     *pos += OBJECT_ID_LEN;
@@ -129,7 +135,8 @@ extract_size(void **pos,
              gsize size_len,
              gint32 *size,
              GError **error) {
-    g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, size_len, error), FALSE);
+    if (!check_msg_bounds(*pos, end_ptr, size_len, error))
+        return FALSE;
 
     /* We're copying a big endian value, so we need to start from the end of the
      * integer, not the start
@@ -217,12 +224,12 @@ extract_string(void **pos,
             return NULL;
 
         if (len != 0) {
-            g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, len, error),
-                                 NULL);
+            if (!check_msg_bounds(*pos, end_ptr, len, error))
+                return NULL;
         }
     }
-    else
-        g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, len, error), NULL);
+    else if (!check_msg_bounds(*pos, end_ptr, len, error))
+        return NULL;
 
     str = g_malloc0(len + 1);
     memcpy(str, *pos, len);
@@ -241,7 +248,8 @@ extract_normal_object(void **pos,
     GVariant *object;
     void *data;
 
-    g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, size, error), NULL);
+    if (!check_msg_bounds(*pos, end_ptr, size, error))
+        return NULL;
 
     data = g_slice_copy(size, *pos);
     object = g_variant_new_from_data(value_type, data, size, FALSE, notify,
@@ -293,7 +301,6 @@ extract_long_object(void **pos,
 
     value = strtol(str, NULL, 10);
     if (value == 0 && (errno == EINVAL || errno == ERANGE)) {
-        g_warn_if_reached();
         g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
                     "Failed to parse object of type 'long': %s",
                     strerror(errno));
@@ -342,7 +349,8 @@ extract_buffer_object(void **pos,
     else if (len == -1)
         object = NULL;
     else {
-        g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, len, error), NULL);
+        if (!check_msg_bounds(*pos, end_ptr, len, error))
+            return NULL;
 
         data = g_memdup(*pos, len);
         object =
@@ -367,7 +375,8 @@ extract_pointer_object(void **pos,
     if (!extract_size(pos, end_ptr, OBJECT_POINTER_LEN_LEN, &len, error))
         return NULL;
 
-    g_return_val_if_fail(check_msg_bounds(*pos, end_ptr, len, error), NULL);
+    if (!check_msg_bounds(*pos, end_ptr, len, error))
+        return NULL;
 
     /* If we have a length of 01, and the next byte is 0, we have a NULL
      * pointer */
@@ -385,7 +394,6 @@ extract_pointer_object(void **pos,
 
         value = strtoul(str, NULL, 16);
         if (value == 0 && (errno == EINVAL || errno == ERANGE)) {
-            g_warn_if_reached();
             g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
                         "Failed to parse object of type 'pointer': %s",
                         strerror(errno));
@@ -414,7 +422,6 @@ extract_time_object(void **pos,
 
     value = strtoul(str, NULL, 10);
     if (value == 0 && (errno == EINVAL || errno == ERANGE)) {
-        g_warn_if_reached();
         g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
                     "Failed to parse object of type 'time': %s",
                     strerror(errno));
@@ -587,8 +594,6 @@ extract_hdata_object(void **pos,
         if (g_strv_length(split_str) < 2) {
             gchar *key_type = g_strescape(key_names[i], NULL);
 
-            g_warn_if_reached();
-
             g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
                         "Invalid key:datatype specification in hdata: \"%s\"",
                         key_type);
@@ -935,11 +940,34 @@ extract_objects_error:
         for (GList *l = objects; l != NULL; l = l->next)
             g_variant_unref(l->data);
     }
-    g_warn_if_reached();
 
     return NULL;
 }
 
+/* For frames that couldn't be parsed: if the frame starts with a response ID,
+ * returns a copy of it */
+gchar *
+_libwc_relay_message_peek_response_id(const void *data,
+                                      gsize size) {
+    void *pos = (void*)data;
+    GError *error = NULL;
+    gchar *id;
+
+    id = extract_string(&pos, data + size, OBJECT_STRING_LEN_LEN, TRUE,
+                        &error);
+    if (!id) {
+        g_clear_error(&error);
+        return NULL;
+    }
+
+    if (g_hash_table_contains(event_identifiers, id)) {
+        g_free(id);
+        return NULL;
+    }
+
+    return id;
+}
+
 LibWCEventIdentifier
 extract_event_id(void **pos,
                  const void *end_ptr,
@@ -964,8 +992,8 @@ extract_event_id(void **pos,
      */
     if (!event_id)
         event_id = LIBWC_NOT_AN_EVENT;
-
-    *pos = new_pos;
+    else
+        *pos = new_pos;
 
     g_free(identifier_string);
     return event_id;
@@ -977,7 +1005,7 @@ _libwc_relay_message_parse_data(void *data,
                                 GError **error) {
     void *pos = data;
     const void *end_ptr = data + size;
-    LibWCRelayMessage *message = g_new(LibWCRelayMessage, 1);
+    LibWCRelayMessage *message = g_new0(LibWCRelayMessage, 1);
 
     g_assert_null(*error);
 
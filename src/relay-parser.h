@@ -69,6 +69,20 @@ struct _LibWCRelayMessageObject {
 
 typedef struct _LibWCRelayMessageObject LibWCRelayMessageObject;
 
+/* Only filled in if timestamps were turned on with
+ * libwc_relay_timestamps_set(), in nanoseconds since the epoch. received is
+ * when the kernel got the last bit of the message off the wire, and is 0 if the
+ * connection doesn't support kernel timestamps. parsed is when the message was
+ * done being decoded, and dispatched is when it was handed off to whatever was
+ * waiting on it */
+struct _LibWCRelayMessageTimestamps {
+    gint64 received;
+    gint64 parsed;
+    gint64 dispatched;
+};
+
+typedef struct _LibWCRelayMessageTimestamps LibWCRelayMessageTimestamps;
+
 struct _LibWCRelayMessage {
     enum {
         LIBWC_RELAY_MESSAGE_TYPE_EVENT,
@@ -81,6 +95,8 @@ struct _LibWCRelayMessage {
     };
 
     GList *objects;
+
+    LibWCRelayMessageTimestamps timestamps;
 };
 
 typedef struct _LibWCRelayMessage LibWCRelayMessage;
@@ -90,6 +106,10 @@ LibWCRelayMessage * _libwc_relay_message_parse_data(void *data,
                                                     GError **error)
 G_GNUC_INTERNAL G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
 
+gchar * _libwc_relay_message_peek_response_id(const void *data,
+                                              gsize size)
+G_GNUC_INTERNAL G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
 void
 _libwc_relay_message_free(LibWCRelayMessage *message);
 
@@ -16,14 +16,63 @@
 
 #include "relay.h"
 #include "relay-connection.h"
+#include "mpsc-queue.h"
+#include "write-scheduler.h"
+#include "command-slab.h"
+#include "timer-wheel.h"
+#include "reactor-pool.h"
+#include "reactor-pool-private.h"
+#include "relay-uring.h"
+#include "relay-reconnect.h"
+#include "relay-standby.h"
+#include "relay-decode.h"
+#include "relay-capture.h"
+#include "relay-proxy.h"
+#include "relay-shm.h"
+#include "spill-file.h"
+#include "token-bucket.h"
+#include "command-encoder.h"
+#include "relay-subscriptions.h"
 
 #include <glib.h>
 #include <gio/gio.h>
+#include <stdatomic.h>
+
+/* The private side of LibWCRelayStats. These can be bumped from any thread
+ * without locking */
+typedef struct {
+    _Atomic guint64 frames_received;
+    _Atomic guint64 frames_dropped;
+    _Atomic guint64 busy_poll_time;
+    _Atomic guint64 busy_poll_hits;
+    _Atomic guint64 busy_poll_misses;
+    _Atomic guint64 commands_written;
+    _Atomic guint64 queue_delay_total;
+    _Atomic guint64 queue_delay_max;
+    _Atomic guint64 commands_shaped;
+} LibWCRelayStatCounters;
+
+#define LIBWC_STAT_ADD(relay_, counter_, n_)                        \
+    atomic_fetch_add_explicit(&(relay_)->priv->stats.counter_, (n_), \
+                              memory_order_relaxed)
+
+typedef enum {
+    LIBWC_RELAY_SIGNAL_WRITABLE_CHANGED,
+    LIBWC_RELAY_SIGNAL_RECONNECTING,
+    LIBWC_RELAY_SIGNAL_RECONNECTED,
+    LIBWC_RELAY_SIGNAL_COUNT
+} LibWCRelaySignal;
+
+extern guint _libwc_relay_signals[LIBWC_RELAY_SIGNAL_COUNT] G_GNUC_INTERNAL;
+
+/* Shared by every relay in the process, see
+ * libwc_relay_global_rate_limit_set() */
+extern LibWCRateLimit _libwc_global_rate_limit G_GNUC_INTERNAL;
 
 struct _LibWCRelayPrivate {
+    LibWCReactorPool *reactor_pool;
+    LibWCReactor *reactor;
     GMainContext *context;
-    GMainLoop *main_loop;
-    GThread *thread;
 
     GSocket *socket;
     GSource *source;
@@ -36,13 +85,111 @@ struct _LibWCRelayPrivate {
     GCancellable *input_stream_cancellable;
 
     gboolean connected;
+    guint connection_serial;
+
+    /* Incoming data is handed to the read callbacks in read_len sized chunks,
+     * rx_buffer holds whatever part of the current chunk we've received so
+     * far */
+    LibWCRelayBackend backend;
+    LibWCRelayUring *uring;
+    guint8 *receive_buffer;
+    GByteArray *rx_buffer;
+
+    /* Frames bigger than max_heap_frame_size get received into spill instead
+     * of rx_buffer, and are handed to the read callbacks from a mapping of it.
+     * spilled_frame holds that mapping while they run. Frames bigger than
+     * max_frame_size end the connection before anything gets allocated for
+     * them */
+    gsize max_heap_frame_size;
+    gsize max_frame_size;
+    LibWCSpillFile *spill;
+    GBytes *spilled_frame;
 
-    guint next_cmd_id;
     GZlibDecompressor *decompressor;
 
-    GAsyncQueue *pending_writes;
-    GHashTable *pending_tasks;
-    GMutex pending_tasks_mutex;
+    /* If set, frames that can't be decoded are skipped instead of ending the
+     * connection */
+    gint tolerant;
+    LibWCRelayStatCounters stats;
+
+    /* Whether messages get timestamped, and whether we're getting timestamps
+     * for received data from the kernel. rx_timestamp is the timestamp of the
+     * last data we received */
+    gboolean timestamps;
+    gboolean kernel_timestamps;
+    gint64 rx_timestamp;
+
+    /* How long to spin waiting for more data before going back to the main
+     * loop, in microseconds. 0 turns busy polling off */
+    guint busy_poll;
+    LibWCRelayDecoder *decoder;
+
+    /* The header of the frame we're currently reading, so frames can be
+     * captured whole */
+    guint8 frame_header[LIBWC_RELAY_HEADER_SIZE];
+    GMutex capture_mutex;
+    LibWCRelayCapture *capture;
+
+    /* Set while a proxy is serving clients through this relay, only changed
+     * from the libweechat thread */
+    LibWCRelayProxy *proxy;
+
+    /* Set while events are being published to a shared memory ring */
+    GMutex shm_mutex;
+    LibWCShmPublisher *shm_publisher;
+
+    /* Commands can be submitted from any thread through submit_queue. The
+     * libweechat thread gets woken up through wakeup_fd, and moves them over
+     * to write_queue, which decides what order they go out in. Everything
+     * past submit_queue is only ever touched from the libweechat thread, so
+     * none of it needs locking */
+    LibWCMpscQueue submit_queue;
+    gint wakeup_fd;
+    gint wakeup_pending;
+    GSource *wakeup_source;
+    LibWCWriteScheduler write_queue;
+    LibWCQueuedWrite *current_write;
+    LibWCCommandSlab pending_commands;
+
+    /* Where the data for commands we send gets encoded */
+    LibWCCommandPool command_pool;
+
+    /* Writes are held in write_queue until the rate limits let them out,
+     * shaper_source wakes us up when they will */
+    LibWCRateLimit rate_limit;
+    GSource *shaper_source;
+
+    /* Deadlines for pending commands, the default timeout is in milliseconds
+     * and can be set from any thread */
+    LibWCTimerWheel deadline_wheel;
+    GSource *deadline_source;
+    guint default_timeout;
+
+    /* In-flight command window. The counters are updated atomically, the
+     * mutex is only needed when the writable state changes */
+    GMutex window_mutex;
+    guint max_pending_commands;
+    gsize max_pending_bytes;
+    gint pending_command_count;
+    gsize pending_bytes;
+    gboolean writable;
+    GQueue writable_waiters;
+
+    /* Events without an internal handler get batched up for the application
+     * through event_source */
+    GMutex event_mutex;
+    GSource *event_source;
+
+    LibWCRelaySubscriptions subscriptions;
+    LibWCRelayReconnect *reconnect;
+    LibWCRelayStandby *standby;
+
+    /* Set while the connection is being handed off to another process, see
+     * relay-handoff.c. adopted_ids holds the IDs of commands the process we
+     * took the connection over from was still waiting on */
+    GTask *handoff;
+    GHashTable *adopted_ids;
+    gint64 last_keepalive;
 
     gchar *password;
 };
@@ -0,0 +1,792 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-connection.h"
+#include "relay-command.h"
+#include "relay-parser.h"
+#include "relay-decode.h"
+#include "relay-proxy.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+/* Lets any number of clients speak the weechat relay protocol to us, while we
+ * only keep the one connection to weechat. Events from upstream get sent to
+ * every synced client exactly as we received them, so fanning out costs one
+ * copy per client and no decoding. The exception is compressed events going to
+ * clients that didn't ask for compression, those get inflated once for all of
+ * them. Responses are always sent back uncompressed. Commands that only
+ * concern the connection itself (init, ping, sync, desync, quit) are handled
+ * here, and everything else is sent upstream with an ID of our own. The
+ * response gets passed back to the client it belongs to with the client's ID
+ * put back in.
+ *
+ * Everything here runs on the upstream relay's reactor thread */
+
+#define PROXY_RECEIVE_CHUNK_SIZE ((gsize)4096)
+
+/* Clients that can't keep up with the events we're sending them get dropped
+ * once this much is waiting to be sent to them, as do clients that send us
+ * this much without a newline */
+#define PROXY_MAX_CLIENT_BACKLOG ((gsize)16 * 1024 * 1024)
+
+/* Event and response IDs are short, so this much of a payload is enough to
+ * tell which one a frame is */
+#define PROXY_ID_PEEK_SIZE (64)
+
+typedef struct {
+    gint ref_count;
+    LibWCRelayProxy *proxy;
+
+    GSocket *socket;
+    GSource *in_source;
+    GSource *out_source;
+    GByteArray *in_buffer;
+    GByteArray *out_buffer;
+
+    gboolean authenticated;
+    gboolean compression;
+    gboolean synced;
+    gboolean closed;
+} LibWCProxyClient;
+
+typedef struct {
+    LibWCProxyClient *client;
+    gchar *client_id;
+    guint upstream_id;
+} LibWCProxyRequest;
+
+struct _LibWCRelayProxy {
+    LibWCRelay *relay;
+    gchar *password;
+
+    GSocket *listen_socket;
+    GSource *listen_source;
+
+    GList *clients;
+
+    /* Upstream command ID -> LibWCProxyRequest */
+    GHashTable *requests;
+    GConverter *decompressor;
+};
+
+static void
+proxy_client_unref(LibWCProxyClient *client) {
+    if (--client->ref_count)
+        return;
+
+    g_object_unref(client->socket);
+    g_byte_array_free(client->in_buffer, TRUE);
+    g_byte_array_free(client->out_buffer, TRUE);
+    g_free(client);
+}
+
+static gboolean
+proxy_request_is_from(void *upstream_id,
+                      LibWCProxyRequest *request,
+                      LibWCProxyClient *client) {
+    return request->client == client;
+}
+
+static void
+proxy_client_close(LibWCProxyClient *client) {
+    if (client->closed)
+        return;
+
+    client->closed = TRUE;
+
+    /* The requests themselves stick around until upstream is done with them,
+     * but once the client is closed its proxy might go away, so nothing can
+     * find them through it anymore */
+    g_hash_table_foreach_remove(client->proxy->requests,
+                                (GHRFunc)proxy_request_is_from, client);
+
+    if (client->in_source) {
+        g_source_destroy(client->in_source);
+        g_source_unref(client->in_source);
+        client->in_source = NULL;
+    }
+
+    if (client->out_source) {
+        g_source_destroy(client->out_source);
+        g_source_unref(client->out_source);
+        client->out_source = NULL;
+    }
+
+    g_socket_close(client->socket, NULL);
+
+    client->proxy->clients = g_list_remove(client->proxy->clients, client);
+    proxy_client_unref(client);
+}
+
+static gboolean
+proxy_client_writable_cb(GSocket *socket,
+                         GIOCondition condition,
+                         LibWCProxyClient *client) {
+    GError *error = NULL;
+    gssize sent;
+
+    sent = g_socket_send(socket, (gchar*)client->out_buffer->data,
+                         client->out_buffer->len, NULL, &error);
+    if (sent < 0) {
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+            g_error_free(error);
+            return G_SOURCE_CONTINUE;
+        }
+
+        g_debug("Dropping proxy client: %s", error->message);
+        g_error_free(error);
+
+        proxy_client_close(client);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_byte_array_remove_range(client->out_buffer, 0, sent);
+    if (client->out_buffer->len)
+        return G_SOURCE_CONTINUE;
+
+    g_source_unref(client->out_source);
+    client->out_source = NULL;
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Sends data straight out if nothing else is waiting to go out before it,
+ * anything that doesn't fit gets sent once the client can take more */
+static void
+proxy_client_send(LibWCProxyClient *client,
+                  const void *data,
+                  gsize size) {
+    GError *error = NULL;
+    gssize sent = 0;
+
+    if (client->closed || !size)
+        return;
+
+    if (client->out_buffer->len == 0) {
+        sent = g_socket_send(client->socket, data, size, NULL, &error);
+        if (sent < 0) {
+            if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+                g_debug("Dropping proxy client: %s", error->message);
+                g_error_free(error);
+
+                proxy_client_close(client);
+                return;
+            }
+
+            g_error_free(error);
+            sent = 0;
+        }
+
+        if ((gsize)sent == size)
+            return;
+    }
+
+    if (client->out_buffer->len + (size - sent) > PROXY_MAX_CLIENT_BACKLOG) {
+        g_debug("Proxy client fell too far behind, dropping it");
+        proxy_client_close(client);
+        return;
+    }
+
+    g_byte_array_append(client->out_buffer, (guint8*)data + sent, size - sent);
+
+    if (!client->out_source) {
+        client->out_source = g_socket_create_source(client->socket, G_IO_OUT,
+                                                    NULL);
+        g_source_set_callback(client->out_source,
+                              (GSourceFunc)proxy_client_writable_cb, client,
+                              NULL);
+        g_source_attach(client->out_source,
+                        client->proxy->relay->priv->context);
+    }
+}
+
+static void
+frame_append_string(GByteArray *frame,
+                    const gchar *str,
+                    gsize len) {
+    guint32 be_len = GUINT32_TO_BE(len);
+
+    g_byte_array_append(frame, (guint8*)&be_len, sizeof(be_len));
+    g_byte_array_append(frame, (guint8*)str, len);
+}
+
+/* Fills in the header of a frame that was built with room left for one */
+static void
+frame_finish(GByteArray *frame) {
+    guint32 be_len = GUINT32_TO_BE(frame->len);
+
+    memcpy(frame->data, &be_len, sizeof(be_len));
+    frame->data[4] = 0;
+}
+
+static void
+proxy_client_send_pong(LibWCProxyClient *client,
+                       const gchar *args) {
+    GByteArray *frame = g_byte_array_new();
+
+    g_byte_array_set_size(frame, LIBWC_RELAY_HEADER_SIZE);
+    frame_append_string(frame, "_pong", strlen("_pong"));
+    g_byte_array_append(frame, (guint8*)"str", 3);
+    frame_append_string(frame, args, strlen(args));
+    frame_finish(frame);
+
+    proxy_client_send(client, frame->data, frame->len);
+    g_byte_array_free(frame, TRUE);
+}
+
+static void
+proxy_request_free(LibWCProxyRequest *request) {
+    proxy_client_unref(request->client);
+    g_free(request->client_id);
+    g_free(request);
+}
+
+static void
+proxy_response_cb(GObject *source_object,
+                  GAsyncResult *res,
+                  void *user_data) {
+    LibWCProxyRequest *request = user_data;
+    LibWCRelayMessage *message;
+    GError *error = NULL;
+    GHashTable *requests;
+
+    /* The response itself was already passed along as soon as it came in */
+    message = _libwc_relay_command_finish(LIBWC_RELAY(source_object), res,
+                                          &error);
+    if (message)
+        _libwc_relay_message_free(message);
+    else
+        g_debug("Proxied command failed: %s", error->message);
+    g_clear_error(&error);
+
+    /* Closing the client already took the request out of the table, and the
+     * ID might already belong to a newer request */
+    if (!request->client->closed) {
+        requests = request->client->proxy->requests;
+
+        if (g_hash_table_lookup(requests,
+                                GUINT_TO_POINTER(request->upstream_id)) ==
+            request)
+            g_hash_table_remove(requests,
+                                GUINT_TO_POINTER(request->upstream_id));
+    }
+
+    proxy_request_free(request);
+}
+
+static void
+proxy_client_forward(LibWCProxyClient *client,
+                     const gchar *client_id,
+                     const gchar *command,
+                     const gchar *args) {
+    LibWCRelayProxy *proxy = client->proxy;
+    LibWCProxyRequest *request;
+    LibWCCommandPriority priority = LIBWC_COMMAND_PRIORITY_CONTROL;
+
+    if (g_str_equal(command, "hdata") || g_str_equal(command, "infolist") ||
+        g_str_equal(command, "nicklist"))
+        priority = LIBWC_COMMAND_PRIORITY_BULK;
+
+    request = g_new0(LibWCProxyRequest, 1);
+    request->client = client;
+    request->client_id = g_strdup(client_id ? client_id : "");
+    client->ref_count++;
+
+    request->upstream_id = _libwc_relay_command_async(
+        proxy->relay, LIBWC_TIMEOUT_DEFAULT, LIBWC_COMMAND_FLAG_NONE,
+        priority, NULL, proxy_response_cb, request, "%s%s%s", command,
+        *args ? " " : "", args);
+
+    if (request->upstream_id)
+        g_hash_table_insert(proxy->requests,
+                            GUINT_TO_POINTER(request->upstream_id), request);
+}
+
+/* Takes in the options a client sent with init. Returns FALSE if the client
+ * didn't give the right password */
+static gboolean
+proxy_client_init(LibWCProxyClient *client,
+                  const gchar *args) {
+    LibWCRelayProxy *proxy = client->proxy;
+    gchar **options;
+    gboolean result = !proxy->password;
+
+    options = g_strsplit(args, ",", -1);
+    for (gchar **option = options; *option; option++) {
+        if (g_str_has_prefix(*option, "password=")) {
+            if (proxy->password &&
+                g_str_equal(*option + strlen("password="), proxy->password))
+                result = TRUE;
+        }
+        /* zlib is the only compression we can pass along, anyone who asks for
+         * something else gets none */
+        else if (g_str_has_prefix(*option, "compression=")) {
+            client->compression =
+                g_str_equal(*option + strlen("compression="), "zlib");
+        }
+    }
+    g_strfreev(options);
+
+    return result;
+}
+
+static void
+proxy_client_handle_line(LibWCProxyClient *client,
+                         gchar *line) {
+    LibWCRelayProxy *proxy = client->proxy;
+    gchar *client_id = NULL, *command, *args;
+    GBytes *input;
+
+    if (line[0] == '(') {
+        gchar *end = strchr(line, ')');
+
+        if (!end) {
+            proxy_client_close(client);
+            return;
+        }
+
+        client_id = line + 1;
+        *end = '\0';
+        line = end + 1;
+    }
+
+    while (*line == ' ')
+        line++;
+
+    command = line;
+    args = strchr(line, ' ');
+    if (args)
+        *args++ = '\0';
+    else
+        args = "";
+
+    /* Until a client has sent a good init, it doesn't get to do anything */
+    if (!client->authenticated) {
+        if (g_str_equal(command, "init") && proxy_client_init(client, args))
+            client->authenticated = TRUE;
+        else
+            proxy_client_close(client);
+
+        return;
+    }
+
+    if (g_str_equal(command, "init")) {
+        proxy_client_init(client, args);
+    }
+    else if (g_str_equal(command, "ping")) {
+        proxy_client_send_pong(client, args);
+    }
+    else if (g_str_equal(command, "sync")) {
+        client->synced = TRUE;
+    }
+    else if (g_str_equal(command, "desync")) {
+        client->synced = FALSE;
+    }
+    else if (g_str_equal(command, "quit")) {
+        proxy_client_close(client);
+    }
+    else if (g_str_equal(command, "input")) {
+        /* Nothing comes back for input, so there's no ID to keep track of */
+        input = g_bytes_new_take(g_strdup_printf("input %s\n", args),
+                                 strlen("input \n") + strlen(args));
+        _libwc_relay_connection_queue_command(
+            proxy->relay, input, NULL, 0, LIBWC_TIMEOUT_NONE,
+            LIBWC_COMMAND_FLAG_NONE, LIBWC_COMMAND_PRIORITY_INTERACTIVE, NULL);
+        g_bytes_unref(input);
+    }
+    else {
+        proxy_client_forward(client, client_id, command, args);
+    }
+}
+
+static gboolean
+proxy_client_readable_cb(GSocket *socket,
+                         GIOCondition condition,
+                         LibWCProxyClient *client) {
+    GByteArray *in_buffer = client->in_buffer;
+    GError *error = NULL;
+    gsize line_start = 0;
+    gssize received;
+    guint8 *newline;
+
+    g_byte_array_set_size(in_buffer, in_buffer->len + PROXY_RECEIVE_CHUNK_SIZE);
+    received = g_socket_receive(socket,
+                                (gchar*)in_buffer->data + in_buffer->len -
+                                PROXY_RECEIVE_CHUNK_SIZE,
+                                PROXY_RECEIVE_CHUNK_SIZE, NULL, &error);
+    g_byte_array_set_size(in_buffer, in_buffer->len - PROXY_RECEIVE_CHUNK_SIZE +
+                                     MAX(received, 0));
+
+    if (received < 0 &&
+        g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+        g_error_free(error);
+        return G_SOURCE_CONTINUE;
+    }
+
+    if (received <= 0) {
+        g_clear_error(&error);
+
+        /* Hold onto the source until we're done, closing destroys it */
+        client->ref_count++;
+        proxy_client_close(client);
+        proxy_client_unref(client);
+
+        return G_SOURCE_REMOVE;
+    }
+
+    /* Closing the client from one of the commands can't free it out from
+     * under us */
+    client->ref_count++;
+
+    while (!client->closed &&
+           (newline = memchr(in_buffer->data + line_start, '\n',
+                             in_buffer->len - line_start))) {
+        gchar *line = (gchar*)in_buffer->data + line_start;
+        gsize line_len = newline - (in_buffer->data + line_start);
+
+        *newline = '\0';
+        if (line_len && line[line_len - 1] == '\r')
+            line[line_len - 1] = '\0';
+
+        line_start += line_len + 1;
+        if (*line)
+            proxy_client_handle_line(client, line);
+    }
+
+    g_byte_array_remove_range(in_buffer, 0, line_start);
+
+    if (!client->closed && in_buffer->len > PROXY_MAX_CLIENT_BACKLOG) {
+        g_debug("Proxy client sent a line that's too long, dropping it");
+        proxy_client_close(client);
+    }
+
+    proxy_client_unref(client);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+proxy_accept_cb(GSocket *socket,
+                GIOCondition condition,
+                LibWCRelayProxy *proxy) {
+    LibWCProxyClient *client;
+    GSocket *client_socket;
+    GError *error = NULL;
+
+    while ((client_socket = g_socket_accept(socket, NULL, &error))) {
+        g_socket_set_blocking(client_socket, FALSE);
+
+        client = g_new0(LibWCProxyClient, 1);
+        client->ref_count = 1;
+        client->proxy = proxy;
+        client->socket = client_socket;
+        client->in_buffer = g_byte_array_new();
+        client->out_buffer = g_byte_array_new();
+
+        client->in_source = g_socket_create_source(client_socket, G_IO_IN,
+                                                   NULL);
+        g_source_set_callback(client->in_source,
+                              (GSourceFunc)proxy_client_readable_cb, client,
+                              NULL);
+        g_source_attach(client->in_source, proxy->relay->priv->context);
+
+        proxy->clients = g_list_prepend(proxy->clients, client);
+    }
+
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        g_debug("Failed to accept proxy client: %s", error->message);
+    g_error_free(error);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Works out the ID a frame starts with without decoding the whole thing.
+ * Returns the length of the ID, which is copied into id_buf, or -1 if the
+ * frame doesn't have one we can use */
+static gssize
+proxy_peek_id(LibWCRelayProxy *proxy,
+              gboolean compressed,
+              const void *payload,
+              gsize payload_size,
+              gchar *id_buf) {
+    guint8 peek_buf[PROXY_ID_PEEK_SIZE];
+    const guint8 *data = payload;
+    gsize data_size = payload_size, bytes_read;
+    guint32 id_len;
+
+    /* We only need the start of the frame, so the decompressor can stop as
+     * soon as it's filled up our tiny buffer */
+    if (compressed) {
+        GConverterResult result;
+
+        result = g_converter_convert(proxy->decompressor, payload,
+                                     payload_size, peek_buf, sizeof(peek_buf),
+                                     G_CONVERTER_NO_FLAGS, &bytes_read,
+                                     &data_size, NULL);
+        g_converter_reset(proxy->decompressor);
+
+        if (result == G_CONVERTER_ERROR)
+            return -1;
+
+        data = peek_buf;
+    }
+
+    if (data_size < sizeof(id_len))
+        return -1;
+
+    memcpy(&id_len, data, sizeof(id_len));
+    id_len = GUINT32_FROM_BE(id_len);
+
+    if (id_len == 0 || id_len > data_size - sizeof(id_len) ||
+        id_len >= PROXY_ID_PEEK_SIZE)
+        return -1;
+
+    memcpy(id_buf, data + sizeof(id_len), id_len);
+    id_buf[id_len] = '\0';
+
+    return id_len;
+}
+
+/* Sends a response back to the client that asked for it, with the client's
+ * ID in place of ours */
+static void
+proxy_forward_response(LibWCRelayProxy *proxy,
+                       LibWCProxyRequest *request,
+                       gboolean compressed,
+                       const void *payload,
+                       gsize payload_size,
+                       gsize id_len) {
+    LibWCRelayPrivate *priv = proxy->relay->priv;
+    const guint8 *data = payload;
+    GBytes *inflated = NULL;
+    GByteArray *frame;
+    GError *error = NULL;
+
+    if (compressed) {
+        inflated = _libwc_relay_payload_inflate(proxy->decompressor, payload,
+                                                payload_size,
+                                                priv->max_heap_frame_size,
+                                                priv->max_frame_size, &error);
+        if (!inflated) {
+            g_clear_error(&error);
+            return;
+        }
+
+        data = g_bytes_get_data(inflated, &payload_size);
+    }
+
+    frame = g_byte_array_sized_new(payload_size + LIBWC_RELAY_HEADER_SIZE);
+    g_byte_array_set_size(frame, LIBWC_RELAY_HEADER_SIZE);
+    frame_append_string(frame, request->client_id,
+                        strlen(request->client_id));
+    g_byte_array_append(frame, data + sizeof(guint32) + id_len,
+                        payload_size - sizeof(guint32) - id_len);
+    frame_finish(frame);
+
+    proxy_client_send(request->client, frame->data, frame->len);
+
+    g_byte_array_free(frame, TRUE);
+    if (inflated)
+        g_bytes_unref(inflated);
+}
+
+/* Sends an event to every synced client. If upstream compressed it, clients
+ * that didn't ask for compression get an inflated copy instead, which only
+ * gets made once no matter how many of them there are */
+static void
+proxy_broadcast_event(LibWCRelayProxy *proxy,
+                      const guint8 *header,
+                      gboolean compressed,
+                      const void *payload,
+                      gsize payload_size) {
+    LibWCRelayPrivate *priv = proxy->relay->priv;
+    guint8 plain_header[LIBWC_RELAY_HEADER_SIZE] = { 0 };
+    GBytes *inflated = NULL;
+    gboolean inflate_failed = FALSE;
+    gconstpointer plain_payload = NULL;
+    gsize plain_size = 0;
+    GError *error = NULL;
+    GList *l, *next;
+
+    for (l = proxy->clients; l; l = next) {
+        LibWCProxyClient *client = l->data;
+
+        next = l->next;
+        if (!client->synced)
+            continue;
+
+        if (!compressed || client->compression) {
+            proxy_client_send(client, header, LIBWC_RELAY_HEADER_SIZE);
+            proxy_client_send(client, payload, payload_size);
+            continue;
+        }
+
+        if (!inflated && !inflate_failed) {
+            inflated = _libwc_relay_payload_inflate(
+                proxy->decompressor, payload, payload_size,
+                priv->max_heap_frame_size, priv->max_frame_size, &error);
+            if (!inflated) {
+                g_debug("Couldn't inflate event for proxy clients: %s",
+                        error->message);
+                g_clear_error(&error);
+                inflate_failed = TRUE;
+            }
+            else {
+                guint32 be_len;
+
+                plain_payload = g_bytes_get_data(inflated, &plain_size);
+                be_len = GUINT32_TO_BE(plain_size + LIBWC_RELAY_HEADER_SIZE);
+                memcpy(plain_header, &be_len, sizeof(be_len));
+            }
+        }
+
+        if (inflated) {
+            proxy_client_send(client, plain_header, sizeof(plain_header));
+            proxy_client_send(client, plain_payload, plain_size);
+        }
+    }
+
+    if (inflated)
+        g_bytes_unref(inflated);
+}
+
+/* Runs on the relay's reactor thread with every complete frame received from
+ * upstream, before it gets decoded */
+void
+_libwc_relay_proxy_frame(LibWCRelayProxy *proxy,
+                         const guint8 *header,
+                         const void *payload,
+                         gsize payload_size) {
+    gboolean compressed = header[4] != 0;
+    gchar id[PROXY_ID_PEEK_SIZE];
+    LibWCProxyRequest *request;
+    gssize id_len;
+    guint upstream_id;
+
+    id_len = proxy_peek_id(proxy, compressed, payload, payload_size, id);
+    if (id_len < 0)
+        return;
+
+    /* Events all start with an underscore */
+    if (id[0] == '_') {
+        proxy_broadcast_event(proxy, header, compressed, payload,
+                              payload_size);
+        return;
+    }
+
+    if (!_libwc_command_id_parse(id, id_len, &upstream_id))
+        return;
+
+    request = g_hash_table_lookup(proxy->requests,
+                                  GUINT_TO_POINTER(upstream_id));
+    if (!request)
+        return;
+
+    g_hash_table_remove(proxy->requests, GUINT_TO_POINTER(upstream_id));
+    proxy_forward_response(proxy, request, compressed, payload, payload_size,
+                           id_len);
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+proxy_start_worker(LibWCRelayProxy *proxy) {
+    proxy->listen_source = g_socket_create_source(proxy->listen_socket,
+                                                  G_IO_IN, NULL);
+    g_source_set_callback(proxy->listen_source, (GSourceFunc)proxy_accept_cb,
+                          proxy, NULL);
+    g_source_attach(proxy->listen_source, proxy->relay->priv->context);
+
+    g_atomic_pointer_set(&proxy->relay->priv->proxy, proxy);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs on the relay's reactor thread */
+static gboolean
+proxy_stop_worker(LibWCRelayProxy *proxy) {
+    g_atomic_pointer_set(&proxy->relay->priv->proxy, NULL);
+
+    g_source_destroy(proxy->listen_source);
+    g_source_unref(proxy->listen_source);
+    g_socket_close(proxy->listen_socket, NULL);
+    g_object_unref(proxy->listen_socket);
+
+    /* Requests that are still waiting on a response clean up after themselves
+     * once they get one, closing their clients takes them out of the table */
+    while (proxy->clients)
+        proxy_client_close(proxy->clients->data);
+
+    g_hash_table_unref(proxy->requests);
+    g_object_unref(proxy->decompressor);
+    g_object_unref(proxy->relay);
+    g_free(proxy->password);
+    g_free(proxy);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Starts accepting weechat relay protocol clients on address, and serves all
+ * of them through relay, which must already be initialized. Clients only see
+ * the events relay itself is synced to. If password is NULL, clients don't
+ * need one */
+LibWCRelayProxy *
+libwc_relay_proxy_new(LibWCRelay *relay,
+                      const gchar *password,
+                      GSocketAddress *address,
+                      GError **error) {
+    LibWCRelayProxy *proxy;
+    GSocket *listen_socket;
+
+    g_return_val_if_fail(relay->priv->context != NULL, NULL);
+    g_return_val_if_fail(relay->priv->proxy == NULL, NULL);
+
+    listen_socket = g_socket_new(g_socket_address_get_family(address),
+                                 G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP,
+                                 error);
+    if (!listen_socket)
+        return NULL;
+
+    g_socket_set_blocking(listen_socket, FALSE);
+
+    if (!g_socket_bind(listen_socket, address, TRUE, error) ||
+        !g_socket_listen(listen_socket, error)) {
+        g_object_unref(listen_socket);
+        return NULL;
+    }
+
+    proxy = g_new0(LibWCRelayProxy, 1);
+    proxy->relay = g_object_ref(relay);
+    proxy->password = g_strdup(password);
+    proxy->listen_socket = listen_socket;
+    proxy->requests = g_hash_table_new(NULL, NULL);
+    proxy->decompressor = G_CONVERTER(
+        g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB));
+
+    g_main_context_invoke(relay->priv->context,
+                          (GSourceFunc)proxy_start_worker, proxy);
+
+    return proxy;
+}
+
+/* Stops listening and disconnects every client. The proxy is freed once that's
+ * done, so it can't be used after this */
+void
+libwc_relay_proxy_free(LibWCRelayProxy *proxy) {
+    g_main_context_invoke(proxy->relay->priv->context,
+                          (GSourceFunc)proxy_stop_worker, proxy);
+}
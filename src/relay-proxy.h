@@ -0,0 +1,27 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_PROXY_H
+#define RELAY_PROXY_H
+
+#include "libweechat.h"
+
+#include <glib.h>
+
+void _libwc_relay_proxy_frame(LibWCRelayProxy *proxy,
+                              const guint8 *header,
+                              const void *payload,
+                              gsize payload_size)
+G_GNUC_INTERNAL;
+
+#endif /* !RELAY_PROXY_H */
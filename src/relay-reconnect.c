@@ -0,0 +1,760 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-parser.h"
+#include "relay-command.h"
+#include "relay-connection.h"
+#include "relay-event-source.h"
+#include "relay-reconnect.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+/* When resyncing a buffer, we start off by asking for this many of its most
+ * recent lines, and keep doubling it until we find the last line we saw before
+ * the connection dropped */
+#define RESYNC_INITIAL_LINES (32)
+#define RESYNC_MAX_LINES     (4096)
+
+typedef struct {
+    guint64 pointer;
+
+    /* The newest line we've seen, along with every line we've seen with that
+     * exact date. Weechat's dates only have a resolution of one second, so the
+     * date alone isn't enough to tell which lines at the boundary are new */
+    guint64 last_date;
+    GHashTable *last_date_lines;
+
+    /* Only used while the buffer is being resynced: the boundary from before
+     * the connection dropped, and any lines that showed up live since */
+    guint resync_serial;
+    gboolean resyncing;
+    guint64 resync_date;
+    GHashTable *resync_date_lines;
+    GHashTable *live_lines;
+    guint fetch_count;
+} LibWCBufferSyncState;
+
+typedef struct {
+    guint64 buffer;
+    guint serial;
+} LibWCResyncRequest;
+
+struct _LibWCRelayReconnect {
+    GSocketClient *client;
+    GSocketConnectable *connectable;
+    GCancellable *cancellable;
+    gint enabled;
+
+    /* Delays are in milliseconds */
+    guint min_delay;
+    guint max_delay;
+    guint attempt;
+    gboolean scheduled;
+
+    /* Buffer pointer -> LibWCBufferSyncState. Only touched from the reactor
+     * thread */
+    GHashTable *buffers;
+};
+
+static const gchar * const nicklist_changing_tags[] = {
+    "irc_join", "irc_part", "irc_quit", "irc_nick", "irc_kick", NULL
+};
+
+static void
+pointer_set_add(GHashTable *set,
+                guint64 pointer) {
+    guint64 *key = g_new(guint64, 1);
+
+    *key = pointer;
+    g_hash_table_add(set, key);
+}
+
+static inline gboolean
+pointer_set_contains(GHashTable *set,
+                     guint64 pointer) {
+    return set && g_hash_table_contains(set, &pointer);
+}
+
+static GHashTable *
+pointer_set_new() {
+    return g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+}
+
+static GHashTable *
+pointer_set_copy(GHashTable *set) {
+    GHashTable *copy = pointer_set_new();
+    GHashTableIter iter;
+    guint64 *pointer;
+
+    g_hash_table_iter_init(&iter, set);
+    while (g_hash_table_iter_next(&iter, (void**)&pointer, NULL))
+        pointer_set_add(copy, *pointer);
+
+    return copy;
+}
+
+static void
+buffer_sync_state_resync_end(LibWCBufferSyncState *state) {
+    state->resyncing = FALSE;
+    state->fetch_count = RESYNC_INITIAL_LINES;
+
+    g_clear_pointer(&state->resync_date_lines, g_hash_table_unref);
+    g_clear_pointer(&state->live_lines, g_hash_table_unref);
+}
+
+static void
+buffer_sync_state_free(LibWCBufferSyncState *state) {
+    buffer_sync_state_resync_end(state);
+    g_hash_table_unref(state->last_date_lines);
+    g_free(state);
+}
+
+static LibWCBufferSyncState *
+buffer_sync_state_get(LibWCRelayReconnect *reconnect,
+                      guint64 buffer) {
+    LibWCBufferSyncState *state;
+
+    state = g_hash_table_lookup(reconnect->buffers, &buffer);
+    if (state)
+        return state;
+
+    state = g_new0(LibWCBufferSyncState, 1);
+    state->pointer = buffer;
+    state->last_date_lines = pointer_set_new();
+    state->fetch_count = RESYNC_INITIAL_LINES;
+
+    g_hash_table_insert(reconnect->buffers, &state->pointer, state);
+
+    return state;
+}
+
+static void
+buffer_sync_state_note_line(LibWCBufferSyncState *state,
+                            guint64 line,
+                            guint64 date,
+                            gboolean live) {
+    if (date > state->last_date) {
+        state->last_date = date;
+        g_hash_table_remove_all(state->last_date_lines);
+        pointer_set_add(state->last_date_lines, line);
+    }
+    else if (date == state->last_date) {
+        pointer_set_add(state->last_date_lines, line);
+    }
+
+    if (live && state->resyncing)
+        pointer_set_add(state->live_lines, line);
+}
+
+static GVariant *
+hdata_object_get(LibWCRelayMessage *message) {
+    LibWCRelayMessageObject *object;
+
+    if (!message->objects)
+        return NULL;
+
+    object = message->objects->data;
+    if (object->type != LIBWC_OBJECT_TYPE_HDATA)
+        return NULL;
+
+    return object->value;
+}
+
+/* Gets the p-path and keys of one item in an hdata object. Both have to be
+ * unreffed by the caller */
+static void
+hdata_item_get(GVariant *items,
+               gsize index,
+               GVariant **p_path,
+               GVariant **keys) {
+    GVariant *item, *tuple;
+
+    item = g_variant_get_child_value(items, index);
+    tuple = g_variant_get_variant(item);
+
+    *p_path = g_variant_get_child_value(tuple, 0);
+    *keys = g_variant_get_child_value(tuple, 1);
+
+    g_variant_unref(tuple);
+    g_variant_unref(item);
+}
+
+static void
+track_lines(LibWCRelayReconnect *reconnect,
+            GVariant *hdata) {
+    GVariant *items, *p_path, *keys;
+    LibWCBufferSyncState *state;
+    guint64 line, buffer, date;
+    gsize count;
+
+    items = g_variant_get_child_value(hdata, 2);
+    count = g_variant_n_children(items);
+
+    for (gsize i = 0; i < count; i++) {
+        hdata_item_get(items, i, &p_path, &keys);
+
+        if (g_variant_lookup(p_path, "line_data", "t", &line) &&
+            g_variant_lookup(keys, "buffer", "t", &buffer) &&
+            g_variant_lookup(keys, "date", "t", &date)) {
+            state = buffer_sync_state_get(reconnect, buffer);
+            buffer_sync_state_note_line(state, line, date, TRUE);
+        }
+
+        g_variant_unref(p_path);
+        g_variant_unref(keys);
+    }
+
+    g_variant_unref(items);
+}
+
+static void
+untrack_buffers(LibWCRelayReconnect *reconnect,
+                GVariant *hdata) {
+    GVariant *items, *p_path, *keys;
+    guint64 buffer;
+    gsize count;
+
+    items = g_variant_get_child_value(hdata, 2);
+    count = g_variant_n_children(items);
+
+    for (gsize i = 0; i < count; i++) {
+        hdata_item_get(items, i, &p_path, &keys);
+
+        if (g_variant_lookup(p_path, "buffer", "t", &buffer))
+            g_hash_table_remove(reconnect->buffers, &buffer);
+
+        g_variant_unref(p_path);
+        g_variant_unref(keys);
+    }
+
+    g_variant_unref(items);
+}
+
+/* Runs on the relay's reactor thread, for every event we receive while
+ * reconnecting is enabled */
+void
+_libwc_relay_reconnect_track_event(LibWCRelay *relay,
+                                   LibWCRelayMessage *event) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+    GVariant *hdata = hdata_object_get(event);
+
+    if (!hdata)
+        return;
+
+    switch (event->event_id) {
+        case LIBWC_EVENT_BUFFER_LINE_ADDED:
+            track_lines(reconnect, hdata);
+            break;
+        case LIBWC_EVENT_BUFFER_CLOSING:
+            untrack_buffers(reconnect, hdata);
+            break;
+        default:
+            break;
+    }
+}
+
+static void
+deliver_event(LibWCRelay *relay,
+              LibWCEventIdentifier event_id,
+              GVariant *value) {
+    LibWCRelayMessage *message = g_new0(LibWCRelayMessage, 1);
+    LibWCRelayMessageObject *object = g_slice_new(LibWCRelayMessageObject);
+
+    object->type = LIBWC_OBJECT_TYPE_HDATA;
+    object->value = g_variant_ref_sink(value);
+
+    message->type = LIBWC_RELAY_MESSAGE_TYPE_EVENT;
+    message->event_id = event_id;
+    message->objects = g_list_append(NULL, object);
+
+    if (!_libwc_relay_event_deliver(relay, message))
+        _libwc_relay_message_free(message);
+}
+
+static gboolean
+line_changes_nicklist(GVariant *keys) {
+    GVariant *tags_array, *tags, *tag;
+    const gchar *tag_str;
+    gboolean result = FALSE;
+    gsize count;
+
+    tags_array = g_variant_lookup_value(keys, "tags_array", NULL);
+    if (!tags_array)
+        return FALSE;
+
+    tags = g_variant_get_child_value(tags_array, 1);
+    count = g_variant_n_children(tags);
+
+    for (gsize i = 0; i < count && !result; i++) {
+        tag = g_variant_get_child_value(tags, i);
+        g_variant_get(tag, "m&s", &tag_str);
+
+        if (tag_str && g_strv_contains(nicklist_changing_tags, tag_str))
+            result = TRUE;
+
+        g_variant_unref(tag);
+    }
+
+    g_variant_unref(tags);
+    g_variant_unref(tags_array);
+
+    return result;
+}
+
+static void
+resync_nicklist_cb(GObject *source_object,
+                   GAsyncResult *res,
+                   void *user_data) {
+    LibWCRelay *relay = LIBWC_RELAY(source_object);
+    LibWCRelayMessage *message;
+    GError *error = NULL;
+
+    message = _libwc_relay_command_finish(relay, res, &error);
+    if (!message) {
+        g_debug("Failed to resync nicklist: %s", error->message);
+        g_error_free(error);
+        return;
+    }
+
+    /* The response looks exactly like a _nicklist event, so pass it on as
+     * one */
+    g_free(message->response_id);
+    message->type = LIBWC_RELAY_MESSAGE_TYPE_EVENT;
+    message->event_id = LIBWC_EVENT_NICKLIST;
+
+    if (!_libwc_relay_event_deliver(relay, message))
+        _libwc_relay_message_free(message);
+}
+
+/* Hands every line the application hasn't seen yet over to it as a
+ * _buffer_line_added event, oldest first. Returns whether any of them could've
+ * changed the nicklist */
+static gboolean
+resync_deliver_lines(LibWCRelay *relay,
+                     LibWCBufferSyncState *state,
+                     GVariant *hdata) {
+    GVariant *items, *key_info, *p_path, *keys, *new_p_path;
+    GVariantDict p_path_dict;
+    GPtrArray *new_items;
+    guint64 line, date;
+    gboolean nicklist_changed = FALSE;
+    gsize count;
+
+    items = g_variant_get_child_value(hdata, 2);
+    key_info = g_variant_get_child_value(hdata, 1);
+    count = g_variant_n_children(items);
+    new_items = g_ptr_array_new();
+
+    /* Weechat hands us the lines newest first */
+    for (gsize i = count; i-- > 0;) {
+        hdata_item_get(items, i, &p_path, &keys);
+
+        if (!g_variant_lookup(p_path, "line_data", "t", &line) ||
+            !g_variant_lookup(keys, "date", "t", &date) ||
+            date < state->resync_date ||
+            (date == state->resync_date &&
+             pointer_set_contains(state->resync_date_lines, line)) ||
+            pointer_set_contains(state->live_lines, line))
+            goto next_line;
+
+        buffer_sync_state_note_line(state, line, date, FALSE);
+        nicklist_changed |= line_changes_nicklist(keys);
+
+        g_variant_dict_init(&p_path_dict, NULL);
+        g_variant_dict_insert(&p_path_dict, "line_data", "t", line);
+        new_p_path = g_variant_dict_end(&p_path_dict);
+
+        g_ptr_array_add(new_items, g_variant_new_variant(
+            g_variant_new_tuple((GVariant*[]) { new_p_path, keys }, 2)));
+
+next_line:
+        g_variant_unref(p_path);
+        g_variant_unref(keys);
+    }
+
+    if (new_items->len) {
+        deliver_event(relay, LIBWC_EVENT_BUFFER_LINE_ADDED, g_variant_new_tuple(
+            (GVariant*[]) {
+                g_variant_new_strv((const gchar*[]) { "line_data" }, 1),
+                key_info,
+                g_variant_new_array(G_VARIANT_TYPE_VARIANT,
+                                    (GVariant**)new_items->pdata,
+                                    new_items->len)
+            }, 3));
+    }
+
+    g_ptr_array_free(new_items, TRUE);
+    g_variant_unref(key_info);
+    g_variant_unref(items);
+
+    return nicklist_changed;
+}
+
+/* Whether or not the lines we got back reach far enough into the past to
+ * overlap with what we saw before the connection dropped */
+static gboolean
+resync_reached_boundary(LibWCBufferSyncState *state,
+                        GVariant *hdata) {
+    GVariant *items, *p_path, *keys;
+    guint64 line = 0, date = 0;
+    gboolean result;
+    gsize count;
+
+    items = g_variant_get_child_value(hdata, 2);
+    count = g_variant_n_children(items);
+
+    if (count < state->fetch_count) {
+        g_variant_unref(items);
+        return TRUE;
+    }
+
+    hdata_item_get(items, count - 1, &p_path, &keys);
+    g_variant_lookup(p_path, "line_data", "t", &line);
+    g_variant_lookup(keys, "date", "t", &date);
+
+    result = date < state->resync_date ||
+             pointer_set_contains(state->resync_date_lines, line);
+
+    g_variant_unref(p_path);
+    g_variant_unref(keys);
+    g_variant_unref(items);
+
+    return result;
+}
+
+static void
+resync_fetch(LibWCRelay *relay,
+             LibWCBufferSyncState *state);
+
+static void
+resync_lines_cb(GObject *source_object,
+                GAsyncResult *res,
+                void *user_data) {
+    LibWCRelay *relay = LIBWC_RELAY(source_object);
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+    LibWCResyncRequest *request = user_data;
+    LibWCBufferSyncState *state;
+    LibWCRelayMessage *message;
+    GVariant *hdata;
+    GError *error = NULL;
+
+    message = _libwc_relay_command_finish(relay, res, &error);
+
+    /* The buffer might've been closed, or the connection might've dropped and
+     * come back while we were waiting */
+    state = g_hash_table_lookup(reconnect->buffers, &request->buffer);
+    if (!state || !state->resyncing || state->resync_serial != request->serial)
+        goto out;
+
+    if (!message) {
+        g_debug("Failed to resync buffer 0x%" G_GINT64_MODIFIER "x: %s",
+                request->buffer, error->message);
+        buffer_sync_state_resync_end(state);
+        goto out;
+    }
+
+    hdata = hdata_object_get(message);
+    if (!hdata) {
+        buffer_sync_state_resync_end(state);
+        goto out;
+    }
+
+    if (!resync_reached_boundary(state, hdata) &&
+        state->fetch_count < RESYNC_MAX_LINES) {
+        state->fetch_count = MIN(state->fetch_count * 2, RESYNC_MAX_LINES);
+        resync_fetch(relay, state);
+        goto out;
+    }
+
+    if (resync_deliver_lines(relay, state, hdata)) {
+        _libwc_relay_command_async(relay, LIBWC_TIMEOUT_DEFAULT,
+                                   LIBWC_COMMAND_FLAG_IDEMPOTENT,
+                                   LIBWC_COMMAND_PRIORITY_BULK,
+                                   reconnect->cancellable, resync_nicklist_cb,
+                                   NULL,
+                                   "nicklist 0x%" G_GINT64_MODIFIER "x",
+                                   state->pointer);
+    }
+
+    buffer_sync_state_resync_end(state);
+
+out:
+    if (message)
+        _libwc_relay_message_free(message);
+    g_clear_error(&error);
+    g_free(request);
+}
+
+static void
+resync_fetch(LibWCRelay *relay,
+             LibWCBufferSyncState *state) {
+    LibWCResyncRequest *request;
+    LibWCHdataQuery *query;
+    GError *error = NULL;
+    gchar *arguments;
+
+    /* Only the keys we need to line the lines up with what we've already seen
+     * and to hand them on as _buffer_line_added events */
+    query = libwc_hdata_query_new_pointer("buffer", state->pointer,
+                                          LIBWC_HDATA_COUNT_NONE);
+    libwc_hdata_query_path(query, "own_lines", LIBWC_HDATA_COUNT_NONE);
+    libwc_hdata_query_path(query, "last_line", -(gint)state->fetch_count);
+    libwc_hdata_query_path(query, "data", LIBWC_HDATA_COUNT_NONE);
+    libwc_hdata_query_keys(query, "buffer", "date", "date_printed",
+                           "displayed", "notify_level", "highlight",
+                           "tags_array", "prefix", "message", NULL);
+    arguments = libwc_hdata_query_build(query, &error);
+    libwc_hdata_query_free(query);
+
+    if (!arguments) {
+        g_debug("Can't resync buffer 0x%" G_GINT64_MODIFIER "x: %s",
+                state->pointer, error->message);
+        g_error_free(error);
+        buffer_sync_state_resync_end(state);
+        return;
+    }
+
+    request = g_new(LibWCResyncRequest, 1);
+    request->buffer = state->pointer;
+    request->serial = state->resync_serial;
+
+    _libwc_relay_command_async(relay, LIBWC_TIMEOUT_DEFAULT,
+                               LIBWC_COMMAND_FLAG_IDEMPOTENT,
+                               LIBWC_COMMAND_PRIORITY_BULK,
+                               relay->priv->reconnect->cancellable,
+                               resync_lines_cb, request, "hdata %s",
+                               arguments);
+    g_free(arguments);
+}
+
+/* Runs on the relay's reactor thread, once we're connected again */
+void
+_libwc_relay_reconnect_resync(LibWCRelay *relay) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+    LibWCBufferSyncState *state;
+    GHashTableIter iter;
+
+    g_hash_table_iter_init(&iter, reconnect->buffers);
+    while (g_hash_table_iter_next(&iter, NULL, (void**)&state)) {
+        buffer_sync_state_resync_end(state);
+
+        state->resyncing = TRUE;
+        state->resync_serial++;
+        state->resync_date = state->last_date;
+        state->resync_date_lines = pointer_set_copy(state->last_date_lines);
+        state->live_lines = pointer_set_new();
+
+        resync_fetch(relay, state);
+    }
+}
+
+static void
+reconnect_init_cb(GObject *source_object,
+                  GAsyncResult *res,
+                  void *user_data) {
+    LibWCRelay *relay = LIBWC_RELAY(source_object);
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+    GError *error = NULL;
+
+    if (!libwc_relay_connection_init_finish(relay, res, &error)) {
+        g_debug("Failed to reinitialize relay connection: %s", error->message);
+
+        /* If the connection is still up, this schedules the next attempt. If
+         * it isn't, that's already happened */
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+
+        return;
+    }
+
+    reconnect->attempt = 0;
+    g_signal_emit(relay, _libwc_relay_signals[LIBWC_RELAY_SIGNAL_RECONNECTED],
+                  0);
+
+    _libwc_relay_reconnect_resync(relay);
+}
+
+static void
+reconnect_connected_cb(GObject *source_object,
+                       GAsyncResult *res,
+                       void *user_data) {
+    LibWCRelay *relay = user_data;
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCRelayReconnect *reconnect = priv->reconnect;
+    GSocketConnection *connection;
+    GError *error = NULL;
+
+    connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source_object),
+                                                res, &error);
+    if (!connection) {
+        if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_debug("Failed to reconnect to relay: %s", error->message);
+
+            reconnect->scheduled = FALSE;
+            _libwc_relay_reconnect_schedule(relay);
+        }
+
+        g_error_free(error);
+        g_object_unref(relay);
+        return;
+    }
+
+    reconnect->scheduled = FALSE;
+
+    g_clear_object(&priv->stream);
+    g_clear_object(&priv->socket);
+
+    priv->stream = G_IO_STREAM(connection);
+    priv->input_stream = g_io_stream_get_input_stream(priv->stream);
+    priv->output_stream = g_io_stream_get_output_stream(priv->stream);
+    priv->socket = g_object_ref(g_socket_connection_get_socket(connection));
+
+    libwc_relay_connection_init_async(relay, reconnect->cancellable,
+                                      reconnect_init_cb, NULL);
+
+    g_object_unref(relay);
+}
+
+static gboolean
+reconnect_timeout_cb(LibWCRelay *relay) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+
+    if (!g_atomic_int_get(&reconnect->enabled)) {
+        reconnect->scheduled = FALSE;
+        return G_SOURCE_REMOVE;
+    }
+
+    g_socket_client_connect_async(reconnect->client, reconnect->connectable,
+                                  reconnect->cancellable,
+                                  reconnect_connected_cb, g_object_ref(relay));
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Gets the client and connectable new connections should be made with.
+ * Returns FALSE if reconnecting isn't enabled */
+gboolean
+_libwc_relay_reconnect_get_target(LibWCRelay *relay,
+                                  GSocketClient **client,
+                                  GSocketConnectable **connectable) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+
+    if (!reconnect || !g_atomic_int_get(&reconnect->enabled))
+        return FALSE;
+
+    if (client)
+        *client = reconnect->client;
+    if (connectable)
+        *connectable = reconnect->connectable;
+
+    return TRUE;
+}
+
+/* Runs on the relay's reactor thread, after the connection has been ended */
+void
+_libwc_relay_reconnect_schedule(LibWCRelay *relay) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+    GSource *source;
+    guint64 backoff;
+    guint delay;
+
+    if (!reconnect || !g_atomic_int_get(&reconnect->enabled) ||
+        reconnect->scheduled)
+        return;
+
+    /* Exponential backoff with jitter, so that a relay that goes down doesn't
+     * get hit by every client at once when it comes back */
+    backoff = (guint64)reconnect->min_delay << MIN(reconnect->attempt, 16);
+    delay = MIN(backoff, reconnect->max_delay);
+    delay = g_random_int_range(delay / 2, delay + 1);
+
+    reconnect->attempt++;
+    reconnect->scheduled = TRUE;
+
+    g_signal_emit(relay, _libwc_relay_signals[LIBWC_RELAY_SIGNAL_RECONNECTING],
+                  0, reconnect->attempt, delay);
+
+    source = g_timeout_source_new(delay);
+    g_source_set_callback(source, (GSourceFunc)reconnect_timeout_cb,
+                          g_object_ref(relay), g_object_unref);
+    g_source_attach(source, relay->priv->context);
+    g_source_unref(source);
+}
+
+/* Must be called before the connection is initialized. Once enabled, the relay
+ * reconnects through client to connectable whenever the connection is lost,
+ * waiting anywhere from min_delay to max_delay milliseconds between attempts.
+ * Any lines that were missed on buffers we've seen lines from are fetched once
+ * the connection is back, and handed over as _buffer_line_added events */
+void
+libwc_relay_reconnect_enable(LibWCRelay *relay,
+                             GSocketClient *client,
+                             GSocketConnectable *connectable,
+                             guint min_delay,
+                             guint max_delay) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+
+    g_assert_false(relay->priv->connected);
+    g_return_if_fail(min_delay > 0 && min_delay <= max_delay);
+
+    if (!reconnect) {
+        reconnect = g_new0(LibWCRelayReconnect, 1);
+        reconnect->buffers = g_hash_table_new_full(
+            g_int64_hash, g_int64_equal, NULL,
+            (GDestroyNotify)buffer_sync_state_free);
+
+        relay->priv->reconnect = reconnect;
+    }
+    else {
+        g_clear_object(&reconnect->client);
+        g_clear_object(&reconnect->connectable);
+        g_clear_object(&reconnect->cancellable);
+    }
+
+    reconnect->client = g_object_ref(client);
+    reconnect->connectable = g_object_ref(connectable);
+    reconnect->cancellable = g_cancellable_new();
+    reconnect->min_delay = min_delay;
+    reconnect->max_delay = max_delay;
+    reconnect->attempt = 0;
+    reconnect->scheduled = FALSE;
+
+    g_atomic_int_set(&reconnect->enabled, TRUE);
+}
+
+void
+_libwc_relay_reconnect_free(LibWCRelayReconnect *reconnect) {
+    g_clear_object(&reconnect->client);
+    g_clear_object(&reconnect->connectable);
+    g_clear_object(&reconnect->cancellable);
+    g_hash_table_unref(reconnect->buffers);
+    g_free(reconnect);
+}
+
+/* Can be called from any thread. Any reconnection attempt that's in progress
+ * is cancelled */
+void
+libwc_relay_reconnect_disable(LibWCRelay *relay) {
+    LibWCRelayReconnect *reconnect = relay->priv->reconnect;
+
+    if (!reconnect)
+        return;
+
+    g_atomic_int_set(&reconnect->enabled, FALSE);
+    g_cancellable_cancel(reconnect->cancellable);
+}
@@ -0,0 +1,42 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_RECONNECT_H
+#define RELAY_RECONNECT_H
+
+#include "relay.h"
+#include "relay-parser.h"
+
+#include <glib.h>
+
+typedef struct _LibWCRelayReconnect LibWCRelayReconnect;
+
+void _libwc_relay_reconnect_schedule(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_reconnect_track_event(LibWCRelay *relay,
+                                        LibWCRelayMessage *event)
+G_GNUC_INTERNAL;
+
+gboolean _libwc_relay_reconnect_get_target(LibWCRelay *relay,
+                                           GSocketClient **client,
+                                           GSocketConnectable **connectable)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_reconnect_resync(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_reconnect_free(LibWCRelayReconnect *reconnect)
+G_GNUC_INTERNAL;
+
+#endif /* !RELAY_RECONNECT_H */
@@ -0,0 +1,286 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* For memfd_create() and sealing */
+#define _GNU_SOURCE
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-parser.h"
+#include "relay-shm.h"
+#include "shm-ring.h"
+#include "shm-subscriber.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+/* Publishes every event the relay dispatches into a shared memory ring, so
+ * any number of local processes can follow the relay's events without each of
+ * them needing their own connection and their own copy of the parsing. The
+ * publisher never waits on subscribers: if one falls more than a ring's worth
+ * behind, it gets lapped and finds out through libwc_shm_subscriber_release()
+ * and libwc_shm_subscriber_get_lost(). Events too big for the ring are counted
+ * as lost the same way */
+
+struct _LibWCShmPublisher {
+    gint fd;
+    guint8 *map;
+    gsize map_size;
+
+    LibWCShmHeader *header;
+    guint8 *data;
+
+    /* Subscribers can write to the whole mapping, so we never trust anything
+     * we'd read back out of it. These are the real values, the header only
+     * gets copies */
+    guint64 capacity;
+    guint64 mask;
+    guint64 head;
+    guint64 tail;
+
+    guint64 sequence;
+};
+
+static void
+shm_publisher_free(LibWCShmPublisher *publisher) {
+    LibWCShmHeader *header = publisher->header;
+
+    /* Wake up anyone still waiting, so they see that we're gone */
+    atomic_store(&header->closed, 1);
+    atomic_fetch_add(&header->seq, 1);
+    syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    munmap(publisher->map, publisher->map_size);
+    close(publisher->fd);
+    g_free(publisher);
+}
+
+/* Moves tail past every record that would get overwritten by writing up to
+ * end. Subscribers check tail after reading a record, so it needs to be
+ * visible before any of the overwriting is. Record lengths have to be read
+ * back out of the ring, so if one doesn't add up, everything gets dropped
+ * instead */
+static void
+shm_publisher_make_room(LibWCShmPublisher *publisher,
+                        guint64 end) {
+    guint64 tail = publisher->tail;
+    guint64 capacity = publisher->capacity;
+
+    if (end - tail <= capacity)
+        return;
+
+    do {
+        guint64 pos = tail & publisher->mask;
+        guint32 length =
+            ((volatile LibWCShmRecordHeader*)(publisher->data + pos))->length;
+        guint64 size;
+
+        if (length == LIBWC_SHM_PAD_LENGTH)
+            size = capacity - pos;
+        else
+            size = LIBWC_SHM_RECORD_SIZE((guint64)length);
+
+        if (size > capacity - pos || size > publisher->head - tail) {
+            tail = publisher->head;
+            break;
+        }
+
+        tail += size;
+    } while (end - tail > capacity);
+
+    publisher->tail = tail;
+    atomic_store_explicit(&publisher->header->tail, tail,
+                          memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/* Runs on the relay's reactor thread */
+static void
+shm_publisher_write(LibWCShmPublisher *publisher,
+                    GVariant *record) {
+    LibWCShmHeader *header = publisher->header;
+    guint64 head = publisher->head;
+    guint64 pos = head & publisher->mask;
+    guint64 pad = 0;
+    gsize length = g_variant_get_size(record);
+    gsize size = LIBWC_SHM_RECORD_SIZE(length);
+    LibWCShmRecordHeader *record_header;
+
+    /* Anything this big would leave subscribers with next to no time to read
+     * it before it got overwritten. Its sequence number still gets used up,
+     * so subscribers count it as lost */
+    if (size > publisher->capacity / 2) {
+        g_debug("Event too large for the shared memory ring, not publishing "
+                "it");
+        publisher->sequence++;
+        return;
+    }
+
+    if (publisher->capacity - pos < size)
+        pad = publisher->capacity - pos;
+
+    shm_publisher_make_room(publisher, head + pad + size);
+
+    if (pad) {
+        record_header = (LibWCShmRecordHeader*)(publisher->data + pos);
+        record_header->length = LIBWC_SHM_PAD_LENGTH;
+        record_header->sequence = publisher->sequence;
+        pos = 0;
+    }
+
+    /* Serializing straight into the ring saves a copy */
+    record_header = (LibWCShmRecordHeader*)(publisher->data + pos);
+    record_header->length = length;
+    record_header->reserved = 0;
+    record_header->sequence = publisher->sequence++;
+    g_variant_store(record, record_header + 1);
+
+    publisher->head = head + pad + size;
+    atomic_store_explicit(&header->head, publisher->head,
+                          memory_order_release);
+
+    atomic_fetch_add(&header->seq, 1);
+    if (atomic_load(&header->waiters))
+        syscall(SYS_futex, &header->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static GVariant *
+shm_record_new(LibWCRelayMessage *message) {
+    GVariantBuilder builder;
+
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a(uv)"));
+
+    for (GList *l = message->objects; l; l = l->next) {
+        LibWCRelayMessageObject *object = l->data;
+
+        g_variant_builder_add(&builder, "(uv)", object->type, object->value);
+    }
+
+    return g_variant_ref_sink(g_variant_new(LIBWC_SHM_RECORD_VARIANT_TYPE_STR,
+                                            message->event_id, &builder));
+}
+
+/* Runs on the relay's reactor thread, with every event before it gets
+ * dispatched */
+void
+_libwc_relay_shm_publish(LibWCRelay *relay,
+                         LibWCRelayMessage *message) {
+    GVariant *record;
+
+    if (message->type != LIBWC_RELAY_MESSAGE_TYPE_EVENT)
+        return;
+
+    record = shm_record_new(message);
+
+    g_mutex_lock(&relay->priv->shm_mutex);
+
+    if (relay->priv->shm_publisher)
+        shm_publisher_write(relay->priv->shm_publisher, record);
+
+    g_mutex_unlock(&relay->priv->shm_mutex);
+
+    g_variant_unref(record);
+}
+
+/* Starts publishing every event received from the relay into a new shared
+ * memory ring, with room for at least size bytes of records. Returns a memfd
+ * for the ring, which stays owned by the relay and is closed once publishing
+ * stops. Pass it (or a dup() of it) to other processes however is convenient,
+ * and have them open it with libwc_shm_subscriber_new(). Returns -1 on error */
+gint
+libwc_relay_shm_publish_start(LibWCRelay *relay,
+                              gsize size,
+                              GError **error) {
+    LibWCShmPublisher *publisher, *old_publisher;
+    LibWCShmHeader *header;
+    gsize page_size = sysconf(_SC_PAGESIZE);
+    gsize capacity = LIBWC_SHM_MIN_CAPACITY;
+    gint fd, saved_errno;
+    guint8 *map;
+
+    while (capacity < size)
+        capacity <<= 1;
+
+    fd = memfd_create("libweechat-events", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        goto error;
+
+    /* Subscribers map the whole thing, so it can never be allowed to shrink
+     * out from under them */
+    if (ftruncate(fd, page_size + capacity) < 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        goto error;
+
+    map = mmap(NULL, page_size + capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    if (map == MAP_FAILED)
+        goto error;
+
+    header = (LibWCShmHeader*)map;
+    memcpy(header->magic, LIBWC_SHM_MAGIC, sizeof(header->magic));
+    header->version = LIBWC_SHM_VERSION;
+    header->data_offset = page_size;
+    header->capacity = capacity;
+
+    publisher = g_new0(LibWCShmPublisher, 1);
+    publisher->fd = fd;
+    publisher->map = map;
+    publisher->map_size = page_size + capacity;
+    publisher->header = header;
+    publisher->data = map + page_size;
+    publisher->capacity = capacity;
+    publisher->mask = capacity - 1;
+
+    g_mutex_lock(&relay->priv->shm_mutex);
+    old_publisher = relay->priv->shm_publisher;
+    g_atomic_pointer_set(&relay->priv->shm_publisher, publisher);
+    g_mutex_unlock(&relay->priv->shm_mutex);
+
+    if (old_publisher)
+        shm_publisher_free(old_publisher);
+
+    return fd;
+
+error:
+    saved_errno = errno;
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                "Couldn't create shared memory ring: %s",
+                g_strerror(saved_errno));
+
+    if (fd >= 0)
+        close(fd);
+
+    return -1;
+}
+
+void
+libwc_relay_shm_publish_stop(LibWCRelay *relay) {
+    LibWCShmPublisher *publisher;
+
+    g_mutex_lock(&relay->priv->shm_mutex);
+    publisher = relay->priv->shm_publisher;
+    g_atomic_pointer_set(&relay->priv->shm_publisher, NULL);
+    g_mutex_unlock(&relay->priv->shm_mutex);
+
+    if (publisher)
+        shm_publisher_free(publisher);
+}
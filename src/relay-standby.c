@@ -0,0 +1,257 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-connection.h"
+#include "relay-reconnect.h"
+#include "relay-standby.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/* How many keepalive intervals can go by without a pong before we give up on
+ * the standby connection */
+#define KEEPALIVE_MAX_MISSED (3)
+
+static const gchar keepalive_command[] = "ping " LIBWC_STANDBY_KEEPALIVE "\n";
+
+/* The standby connection is a second, hidden relay that has already been
+ * through init, and otherwise just sits there answering keepalive pings. It
+ * lives on the same reactor as the relay it belongs to, so everything here
+ * happens on that reactor's thread */
+struct _LibWCRelayStandby {
+    guint interval;
+
+    /* Only set once the standby has finished initializing */
+    LibWCRelay *relay;
+    gboolean connecting;
+
+    GSource *keepalive_source;
+    GCancellable *cancellable;
+};
+
+static void
+standby_discard(LibWCRelay *standby_relay) {
+    _libwc_relay_connection_end_on_error(standby_relay, NULL);
+    _libwc_relay_connection_detach(standby_relay);
+
+    g_object_unref(standby_relay);
+}
+
+static void
+standby_init_cb(GObject *source_object,
+                GAsyncResult *res,
+                void *user_data) {
+    LibWCRelay *standby_relay = LIBWC_RELAY(source_object);
+    LibWCRelay *relay = user_data;
+    LibWCRelayStandby *standby = relay->priv->standby;
+    GError *error = NULL;
+
+    standby->connecting = FALSE;
+
+    if (!libwc_relay_connection_init_finish(standby_relay, res, &error)) {
+        g_debug("Failed to initialize standby connection: %s",
+                error->message);
+        g_error_free(error);
+
+        standby_discard(standby_relay);
+    }
+    else {
+        standby_relay->priv->last_keepalive = g_get_monotonic_time();
+        standby->relay = standby_relay;
+    }
+
+    g_object_unref(relay);
+}
+
+static void
+standby_connected_cb(GObject *source_object,
+                     GAsyncResult *res,
+                     void *user_data) {
+    LibWCRelay *relay = user_data;
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCRelayStandby *standby = priv->standby;
+    LibWCRelay *standby_relay;
+    GSocketConnection *connection;
+    GError *error = NULL;
+
+    connection = g_socket_client_connect_finish(G_SOCKET_CLIENT(source_object),
+                                                res, &error);
+    if (!connection) {
+        g_debug("Failed to open standby connection: %s", error->message);
+        g_error_free(error);
+
+        standby->connecting = FALSE;
+        g_object_unref(relay);
+        return;
+    }
+
+    standby_relay = libwc_relay_new();
+    if (priv->password)
+        libwc_relay_password_set(standby_relay, priv->password);
+
+    libwc_relay_reactor_pool_set(standby_relay, priv->reactor_pool);
+    libwc_relay_connection_set(standby_relay, G_IO_STREAM(connection),
+                               g_socket_connection_get_socket(connection));
+    g_object_unref(connection);
+
+    /* Keep the standby on our own reactor, so that promoting it never involves
+     * another thread */
+    standby_relay->priv->reactor = priv->reactor;
+    standby_relay->priv->context = g_main_context_ref(priv->context);
+
+    libwc_relay_connection_init_async(standby_relay, standby->cancellable,
+                                      standby_init_cb, relay);
+}
+
+static void
+standby_connect(LibWCRelay *relay) {
+    LibWCRelayStandby *standby = relay->priv->standby;
+    GSocketClient *client;
+    GSocketConnectable *connectable;
+
+    if (standby->connecting ||
+        !_libwc_relay_reconnect_get_target(relay, &client, &connectable))
+        return;
+
+    standby->connecting = TRUE;
+    g_socket_client_connect_async(client, connectable, standby->cancellable,
+                                  standby_connected_cb, g_object_ref(relay));
+}
+
+static gboolean
+standby_keepalive_cb(LibWCRelay *relay) {
+    LibWCRelayStandby *standby = relay->priv->standby;
+    LibWCRelayPrivate *standby_priv;
+    GBytes *keepalive;
+    gint64 deadline;
+
+    if (!standby->relay) {
+        if (relay->priv->connected)
+            standby_connect(relay);
+
+        return G_SOURCE_CONTINUE;
+    }
+
+    standby_priv = standby->relay->priv;
+    deadline = standby_priv->last_keepalive +
+               (gint64)standby->interval * 1000 * KEEPALIVE_MAX_MISSED;
+
+    if (!standby_priv->connected || g_get_monotonic_time() > deadline) {
+        g_debug("Standby connection went away, replacing it");
+
+        standby_discard(g_steal_pointer(&standby->relay));
+        standby_connect(relay);
+
+        return G_SOURCE_CONTINUE;
+    }
+
+    keepalive = g_bytes_new_static(keepalive_command,
+                                   sizeof(keepalive_command) - 1);
+    _libwc_relay_connection_queue_command(standby->relay, keepalive, NULL, 0,
+                                          LIBWC_TIMEOUT_NONE,
+                                          LIBWC_COMMAND_FLAG_NONE,
+                                          LIBWC_COMMAND_PRIORITY_CONTROL, NULL);
+    g_bytes_unref(keepalive);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/* Runs on the relay's reactor thread whenever its connection has finished
+ * initializing */
+void
+_libwc_relay_standby_start(LibWCRelay *relay) {
+    LibWCRelayStandby *standby = relay->priv->standby;
+
+    if (!standby->keepalive_source) {
+        standby->keepalive_source = g_timeout_source_new(standby->interval);
+        g_source_set_callback(standby->keepalive_source,
+                              (GSourceFunc)standby_keepalive_cb,
+                              g_object_ref(relay), g_object_unref);
+        g_source_attach(standby->keepalive_source, relay->priv->context);
+    }
+
+    if (!standby->relay)
+        standby_connect(relay);
+}
+
+/* Runs on the relay's reactor thread when its connection dies. Returns TRUE if
+ * we had a standby to take its place */
+gboolean
+_libwc_relay_standby_failover(LibWCRelay *relay,
+                              const GError *error) {
+    LibWCRelayStandby *standby = relay->priv->standby;
+    LibWCRelay *standby_relay;
+
+    if (!standby || !standby->relay || !standby->relay->priv->connected ||
+        !_libwc_relay_reconnect_get_target(relay, NULL, NULL))
+        return FALSE;
+
+    standby_relay = g_steal_pointer(&standby->relay);
+
+    g_debug("Connection to relay lost, failing over to standby");
+    _libwc_relay_connection_failover(relay, standby_relay, error);
+    g_object_unref(standby_relay);
+
+    /* The standby was never synced, so as far as everyone else is concerned
+     * this is a reconnect */
+    g_signal_emit(relay, _libwc_relay_signals[LIBWC_RELAY_SIGNAL_RECONNECTED],
+                  0);
+    _libwc_relay_subscriptions_replay(relay);
+    _libwc_relay_reconnect_resync(relay);
+
+    standby_connect(relay);
+
+    return TRUE;
+}
+
+void
+_libwc_relay_standby_free(LibWCRelayStandby *standby) {
+    g_cancellable_cancel(standby->cancellable);
+    g_object_unref(standby->cancellable);
+
+    if (standby->keepalive_source) {
+        g_source_destroy(standby->keepalive_source);
+        g_source_unref(standby->keepalive_source);
+    }
+
+    if (standby->relay)
+        standby_discard(standby->relay);
+
+    g_free(standby);
+}
+
+/* Must be called before the connection is initialized, and only works with
+ * reconnecting enabled. Keeps a second connection to the relay initialized
+ * and ready to take over the moment the main one dies, pinging it every
+ * interval milliseconds to keep it alive. Commands that only read from the
+ * relay and were still waiting on a response get sent again once the standby
+ * has taken over */
+void
+libwc_relay_standby_enable(LibWCRelay *relay,
+                           guint interval) {
+    LibWCRelayStandby *standby;
+
+    g_assert_false(relay->priv->connected);
+    g_return_if_fail(relay->priv->reconnect != NULL);
+    g_return_if_fail(relay->priv->standby == NULL);
+    g_return_if_fail(interval > 0);
+
+    standby = g_new0(LibWCRelayStandby, 1);
+    standby->interval = interval;
+    standby->cancellable = g_cancellable_new();
+
+    relay->priv->standby = standby;
+}
@@ -0,0 +1,38 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_STANDBY_H
+#define RELAY_STANDBY_H
+
+#include "relay.h"
+
+#include <glib.h>
+
+/* Sent as the argument to keepalive pings on standby connections. Since it
+ * isn't a valid command ID, the pongs never get mistaken for a response to
+ * anything else, even if they end up arriving after a failover */
+#define LIBWC_STANDBY_KEEPALIVE "libwc-keepalive"
+
+typedef struct _LibWCRelayStandby LibWCRelayStandby;
+
+void _libwc_relay_standby_start(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+gboolean _libwc_relay_standby_failover(LibWCRelay *relay,
+                                       const GError *error)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_standby_free(LibWCRelayStandby *standby)
+G_GNUC_INTERNAL;
+
+#endif /* !RELAY_STANDBY_H */
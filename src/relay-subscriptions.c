@@ -0,0 +1,302 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-command.h"
+#include "relay-subscriptions.h"
+
+#include <glib.h>
+#include <string.h>
+
+/* In the same order as the bits in LibWCSyncFlags */
+static const gchar *const sync_option_names[] = {
+    "buffer", "nicklist", "buffers", "upgrade"
+};
+
+#define SYNC_FLAG_SETS (LIBWC_SYNC_ALL + 1)
+
+void
+_libwc_relay_subscriptions_init(LibWCRelaySubscriptions *subscriptions) {
+    g_mutex_init(&subscriptions->mutex);
+    subscriptions->wanted = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+    subscriptions->synced = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, NULL);
+}
+
+void
+_libwc_relay_subscriptions_clear(LibWCRelaySubscriptions *subscriptions) {
+    g_hash_table_unref(subscriptions->wanted);
+    g_hash_table_unref(subscriptions->synced);
+    g_mutex_clear(&subscriptions->mutex);
+}
+
+static gchar *
+sync_options(LibWCSyncFlags flags) {
+    GString *options = g_string_new(NULL);
+
+    for (guint i = 0; i < G_N_ELEMENTS(sync_option_names); i++) {
+        if (!(flags & (1 << i)))
+            continue;
+
+        if (options->len)
+            g_string_append_c(options, ',');
+
+        g_string_append(options, sync_option_names[i]);
+    }
+
+    return g_string_free(options, FALSE);
+}
+
+static void
+group_buffer(GPtrArray **groups,
+             gchar *buffer,
+             LibWCSyncFlags flags) {
+    if (!flags)
+        return;
+
+    if (!groups[flags])
+        groups[flags] = g_ptr_array_new();
+
+    g_ptr_array_add(groups[flags], buffer);
+}
+
+/* Sends a single sync or desync for every buffer in the group, and updates
+ * what we think the relay has synced if it went out. Must be called with the
+ * mutex held */
+static void
+send_group(LibWCRelay *relay,
+           GPtrArray *buffers,
+           LibWCSyncFlags flags,
+           gboolean sync,
+           LibWCCommandPriority priority) {
+    GHashTable *synced = relay->priv->subscriptions.synced;
+    gchar *buffer_list,
+          *options;
+    const gchar *args[2];
+    GError *error = NULL;
+    gboolean sent;
+    guint n_buffers;
+
+    if (!buffers)
+        return;
+
+    n_buffers = buffers->len;
+    g_ptr_array_add(buffers, NULL);
+    buffer_list = g_strjoinv(",", (gchar**)buffers->pdata);
+    options = sync_options(flags);
+
+    args[0] = buffer_list;
+    args[1] = options;
+    sent = _libwc_relay_command_send(relay, priority, &error,
+                                     sync ? "sync" : "desync", args,
+                                     G_N_ELEMENTS(args));
+
+    if (sent) {
+        for (guint i = 0; i < n_buffers; i++) {
+            gchar *buffer = buffers->pdata[i];
+            LibWCSyncFlags synced_flags =
+                GPOINTER_TO_UINT(g_hash_table_lookup(synced, buffer));
+
+            if (sync)
+                synced_flags |= flags;
+            else
+                synced_flags &= ~flags;
+
+            /* buffer might be the key we're about to free, so this has to be
+             * the last thing we do with it */
+            if (synced_flags)
+                g_hash_table_insert(synced, g_strdup(buffer),
+                                    GUINT_TO_POINTER(synced_flags));
+            else
+                g_hash_table_remove(synced, buffer);
+        }
+    }
+    else {
+        g_debug("Failed to %s %s: %s",
+                sync ? "sync" : "desync", buffer_list, error->message);
+        g_error_free(error);
+    }
+
+    g_free(buffer_list);
+    g_free(options);
+    g_ptr_array_unref(buffers);
+}
+
+/* Works out what changed since the last flush, and sends one command for each
+ * distinct set of flags being added or taken away, covering every buffer that
+ * set applies to. Must be called with the mutex held */
+static void
+subscriptions_flush(LibWCRelay *relay,
+                    LibWCCommandPriority priority) {
+    LibWCRelaySubscriptions *subscriptions = &relay->priv->subscriptions;
+    GPtrArray *added[SYNC_FLAG_SETS] = { NULL },
+              *removed[SYNC_FLAG_SETS] = { NULL };
+    GHashTableIter iter;
+    void *buffer,
+         *flags;
+
+    /* Whatever's left gets sent by _libwc_relay_subscriptions_replay() once
+     * we're connected again */
+    if (!relay->priv->connected)
+        return;
+
+    g_hash_table_iter_init(&iter, subscriptions->wanted);
+    while (g_hash_table_iter_next(&iter, &buffer, &flags)) {
+        LibWCSyncFlags synced_flags =
+            GPOINTER_TO_UINT(g_hash_table_lookup(subscriptions->synced,
+                                                 buffer));
+
+        group_buffer(added, buffer, GPOINTER_TO_UINT(flags) & ~synced_flags);
+    }
+
+    g_hash_table_iter_init(&iter, subscriptions->synced);
+    while (g_hash_table_iter_next(&iter, &buffer, &flags)) {
+        LibWCSyncFlags wanted_flags =
+            GPOINTER_TO_UINT(g_hash_table_lookup(subscriptions->wanted,
+                                                 buffer));
+
+        group_buffer(removed, buffer, GPOINTER_TO_UINT(flags) & ~wanted_flags);
+    }
+
+    for (guint i = 1; i < SYNC_FLAG_SETS; i++) {
+        send_group(relay, removed[i], i, FALSE, priority);
+        send_group(relay, added[i], i, TRUE, priority);
+    }
+}
+
+/* Runs on the relay's reactor thread, batching up whatever was subscribed to
+ * or unsubscribed from since the last time */
+static gboolean
+subscriptions_flush_cb(LibWCRelay *relay) {
+    LibWCRelaySubscriptions *subscriptions = &relay->priv->subscriptions;
+
+    g_mutex_lock(&subscriptions->mutex);
+
+    subscriptions->flush_scheduled = FALSE;
+    subscriptions_flush(relay, LIBWC_COMMAND_PRIORITY_CONTROL);
+
+    g_mutex_unlock(&subscriptions->mutex);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Must be called with the mutex held. Changes made before the relay's
+ * connected don't get sent until _libwc_relay_subscriptions_replay() */
+static void
+schedule_flush(LibWCRelay *relay) {
+    LibWCRelaySubscriptions *subscriptions = &relay->priv->subscriptions;
+    GSource *source;
+
+    if (subscriptions->flush_scheduled || !relay->priv->context)
+        return;
+
+    source = g_idle_source_new();
+    g_source_set_callback(source, (GSourceFunc)subscriptions_flush_cb,
+                          g_object_ref(relay), g_object_unref);
+    g_source_attach(source, relay->priv->context);
+    g_source_unref(source);
+
+    subscriptions->flush_scheduled = TRUE;
+}
+
+/* Called whenever the relay's been connected to something that isn't synced
+ * to anything yet, so everything we want gets sent over again. This has to
+ * happen before the reconnect code asks for the lines we missed: anything
+ * posted between that snapshot and a late sync would never reach us. The syncs
+ * are queued right away, and in the bulk lane along with the backfill, so
+ * they're guaranteed to go out ahead of it */
+void
+_libwc_relay_subscriptions_replay(LibWCRelay *relay) {
+    LibWCRelaySubscriptions *subscriptions = &relay->priv->subscriptions;
+
+    g_mutex_lock(&subscriptions->mutex);
+
+    g_hash_table_remove_all(subscriptions->synced);
+    subscriptions_flush(relay, LIBWC_COMMAND_PRIORITY_BULK);
+
+    g_mutex_unlock(&subscriptions->mutex);
+}
+
+static void
+subscriptions_update(LibWCRelay *relay,
+                     const gchar *buffer,
+                     LibWCSyncFlags add,
+                     LibWCSyncFlags remove) {
+    LibWCRelaySubscriptions *subscriptions = &relay->priv->subscriptions;
+    LibWCSyncFlags old_flags,
+                   new_flags;
+
+    /* Buffers get sent to the relay as a comma separated list */
+    g_return_if_fail(buffer && *buffer && !strpbrk(buffer, ", \r\n"));
+    g_return_if_fail(strcmp(buffer, "*") == 0 ||
+                     !((add | remove) &
+                       (LIBWC_SYNC_BUFFERS | LIBWC_SYNC_UPGRADE)));
+
+    g_mutex_lock(&subscriptions->mutex);
+
+    old_flags = GPOINTER_TO_UINT(g_hash_table_lookup(subscriptions->wanted,
+                                                     buffer));
+    new_flags = (old_flags | add) & ~remove & LIBWC_SYNC_ALL;
+
+    if (new_flags != old_flags) {
+        if (new_flags)
+            g_hash_table_insert(subscriptions->wanted, g_strdup(buffer),
+                                GUINT_TO_POINTER(new_flags));
+        else
+            g_hash_table_remove(subscriptions->wanted, buffer);
+
+        schedule_flush(relay);
+    }
+
+    g_mutex_unlock(&subscriptions->mutex);
+}
+
+/* Adds flags to what gets synced for buffer, which is a buffer's full name or
+ * pointer, or "*" for every buffer. Can be called from any thread. Changes made
+ * close together get sent to the relay as one batch of sync and desync
+ * commands, and everything that's subscribed to gets synced again after a
+ * reconnect */
+void
+libwc_relay_subscribe(LibWCRelay *relay,
+                      const gchar *buffer,
+                      LibWCSyncFlags flags) {
+    subscriptions_update(relay, buffer, flags, LIBWC_SYNC_NONE);
+}
+
+/* Takes flags away from what gets synced for buffer, see
+ * libwc_relay_subscribe() */
+void
+libwc_relay_unsubscribe(LibWCRelay *relay,
+                        const gchar *buffer,
+                        LibWCSyncFlags flags) {
+    subscriptions_update(relay, buffer, LIBWC_SYNC_NONE, flags);
+}
+
+/* Returns what the application's subscribed to for buffer, which might not
+ * have made it to the relay yet */
+LibWCSyncFlags
+libwc_relay_subscription_get(LibWCRelay *relay,
+                             const gchar *buffer) {
+    LibWCRelaySubscriptions *subscriptions = &relay->priv->subscriptions;
+    LibWCSyncFlags flags;
+
+    g_mutex_lock(&subscriptions->mutex);
+    flags = GPOINTER_TO_UINT(g_hash_table_lookup(subscriptions->wanted,
+                                                 buffer));
+    g_mutex_unlock(&subscriptions->mutex);
+
+    return flags;
+}
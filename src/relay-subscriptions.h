@@ -0,0 +1,42 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+
+#ifndef RELAY_SUBSCRIPTIONS_H
+#define RELAY_SUBSCRIPTIONS_H
+
+#include "relay.h"
+
+#include <glib.h>
+
+/* What the application wants synced for each buffer, and what we've actually
+ * asked the relay to sync. Changes to wanted get turned into as few sync and
+ * desync commands as possible on the relay's reactor thread, and wanted gets
+ * sent again in full whenever the relay forgets what we were synced to */
+typedef struct {
+    GMutex mutex;
+    GHashTable *wanted;
+    GHashTable *synced;
+    gboolean flush_scheduled;
+} LibWCRelaySubscriptions;
+
+void _libwc_relay_subscriptions_init(LibWCRelaySubscriptions *subscriptions)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_subscriptions_clear(LibWCRelaySubscriptions *subscriptions)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_subscriptions_replay(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+#endif /* !RELAY_SUBSCRIPTIONS_H */
@@ -0,0 +1,106 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "relay.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Local relays don't need to go through the whole TCP stack, but the default
+ * buffer sizes for Unix sockets are small enough that a relay sending us a lot
+ * at once ends up waiting on us far more often than it would over loopback.
+ * How much can be in flight towards us is mostly up to the relay's own send
+ * buffer, so this only makes sure we're never the bottleneck */
+#define UNIX_SOCKET_BUFFER_SIZE (1024 * 1024)
+
+static gboolean
+unix_socket_check_peer(GSocket *socket,
+                       GError **error) {
+    GCredentials *credentials;
+    uid_t peer_uid;
+
+    credentials = g_socket_get_credentials(socket, error);
+    if (!credentials)
+        return FALSE;
+
+    peer_uid = g_credentials_get_unix_user(credentials, error);
+    g_object_unref(credentials);
+
+    if (peer_uid == (uid_t)-1)
+        return FALSE;
+
+    if (peer_uid != getuid()) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_PERMISSION_DENIED,
+                    "The relay is running as uid %u, not as us",
+                    (guint)peer_uid);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Connects to a relay listening on the Unix socket at path, and sets the relay
+ * up to use the connection. With LIBWC_UNIX_SOCKET_FLAG_ABSTRACT, path is a
+ * name in the abstract namespace instead. With
+ * LIBWC_UNIX_SOCKET_FLAG_SAME_USER, the connection is refused unless the
+ * process on the other end runs as the same user we do. The relay still needs
+ * to be initialized afterwards */
+gboolean
+libwc_relay_connection_set_unix(LibWCRelay *relay,
+                                const gchar *path,
+                                LibWCUnixSocketFlags flags,
+                                GCancellable *cancellable,
+                                GError **error) {
+    GSocketAddress *address;
+    GSocket *socket;
+    GSocketConnection *connection;
+    gboolean result = FALSE;
+
+    address = g_unix_socket_address_new_with_type(
+        path, -1,
+        flags & LIBWC_UNIX_SOCKET_FLAG_ABSTRACT ?
+            G_UNIX_SOCKET_ADDRESS_ABSTRACT : G_UNIX_SOCKET_ADDRESS_PATH);
+
+    socket = g_socket_new(G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+                          G_SOCKET_PROTOCOL_DEFAULT, error);
+    if (!socket) {
+        g_object_unref(address);
+        return FALSE;
+    }
+
+    /* Not being able to grow the buffers isn't worth failing over */
+    if (!g_socket_set_option(socket, SOL_SOCKET, SO_RCVBUF,
+                             UNIX_SOCKET_BUFFER_SIZE, NULL) ||
+        !g_socket_set_option(socket, SOL_SOCKET, SO_SNDBUF,
+                             UNIX_SOCKET_BUFFER_SIZE, NULL))
+        g_debug("Couldn't grow Unix socket buffers");
+
+    if (g_socket_connect(socket, address, cancellable, error) &&
+        (!(flags & LIBWC_UNIX_SOCKET_FLAG_SAME_USER) ||
+         unix_socket_check_peer(socket, error))) {
+        connection = g_socket_connection_factory_create_connection(socket);
+        libwc_relay_connection_set(relay, G_IO_STREAM(connection), socket);
+        g_object_unref(connection);
+
+        result = TRUE;
+    }
+
+    g_object_unref(socket);
+    g_object_unref(address);
+
+    return result;
+}
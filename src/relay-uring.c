@@ -0,0 +1,527 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "config.h"
+
+#include "libweechat.h"
+#include "relay.h"
+#include "relay-private.h"
+#include "relay-connection.h"
+#include "relay-uring.h"
+#include "reactor-pool-private.h"
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <gio/gio.h>
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define URING_QUEUE_DEPTH  (256)
+
+/* Receive buffers are shared between every relay on a reactor. The count must
+ * be a power of two */
+#define URING_BUFFER_COUNT (256)
+#define URING_BUFFER_SIZE  ((gsize)16384)
+#define URING_BUFFER_GROUP (0)
+
+/* Once a chain of sends has at least this many bytes in it, nothing else gets
+ * added to it */
+#define URING_MAX_CHAIN_SIZE ((gsize)65536)
+
+typedef struct {
+    struct io_uring ring;
+    struct io_uring_buf_ring *buf_ring;
+    guint8 *buffers;
+
+    /* Completions get signalled through event_fd, which we watch from the
+     * reactor's main context like any other source */
+    gint event_fd;
+    GSource *source;
+} LibWCReactorUring;
+
+typedef enum {
+    URING_OP_RECV,
+    URING_OP_SEND
+} LibWCUringOpType;
+
+typedef struct {
+    LibWCUringOpType type;
+    LibWCRelayUring *state;
+
+    /* Only used for sends */
+    LibWCQueuedWrite *queued_write;
+    guint chain_pos;
+} LibWCUringOp;
+
+/* Per-connection state. This can outlive the relay's connection: once the
+ * connection is stopped, it sticks around until every operation that was
+ * still in flight has completed */
+struct _LibWCRelayUring {
+    LibWCRelay *relay;
+    LibWCReactorUring *reactor_uring;
+
+    /* Our own duplicate of the socket's fd, so that the socket stays valid
+     * until the kernel is done with it */
+    gint fd;
+
+    gboolean stopped;
+    guint ops_in_flight;
+
+    /* Sends are submitted as a single linked chain, so that they hit the wire
+     * in order. Anything that doesn't go out completely gets resumed, in chain
+     * order, once the chain finishes */
+    guint sends_in_flight;
+    GQueue retry_queue;
+
+    /* How much of the relay's command window the writes we're holding onto
+     * account for */
+    gsize window_bytes;
+};
+
+static GError *
+uring_error_new(gint res,
+                const gchar *what) {
+    return g_error_new(G_IO_ERROR, g_io_error_from_errno(-res), "%s: %s", what,
+                       g_strerror(-res));
+}
+
+static struct io_uring_sqe *
+uring_get_sqe(LibWCReactorUring *reactor_uring) {
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&reactor_uring->ring);
+    if (G_UNLIKELY(!sqe)) {
+        io_uring_submit(&reactor_uring->ring);
+        sqe = io_uring_get_sqe(&reactor_uring->ring);
+    }
+
+    return sqe;
+}
+
+static void
+relay_uring_free(LibWCRelayUring *state) {
+    close(state->fd);
+    g_object_unref(state->relay);
+    g_free(state);
+}
+
+static void
+relay_uring_op_done(LibWCRelayUring *state,
+                    LibWCUringOp *op) {
+    g_free(op);
+
+    if (--state->ops_in_flight == 0 && state->stopped)
+        relay_uring_free(state);
+}
+
+static void
+relay_uring_arm_recv(LibWCRelayUring *state) {
+    struct io_uring_sqe *sqe;
+    LibWCUringOp *op;
+
+    op = g_new0(LibWCUringOp, 1);
+    op->type = URING_OP_RECV;
+    op->state = state;
+
+    /* A multishot receive keeps completing for as long as there's data and
+     * free buffers, so we only have to rearm it when the kernel says so */
+    sqe = uring_get_sqe(state->reactor_uring);
+    io_uring_prep_recv_multishot(sqe, state->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    io_uring_sqe_set_data(sqe, op);
+
+    state->ops_in_flight++;
+}
+
+static void
+reactor_uring_recycle_buffer(LibWCReactorUring *reactor_uring,
+                             guint16 buffer_id) {
+    io_uring_buf_ring_add(reactor_uring->buf_ring,
+                          reactor_uring->buffers +
+                          (buffer_id * URING_BUFFER_SIZE),
+                          URING_BUFFER_SIZE, buffer_id,
+                          io_uring_buf_ring_mask(URING_BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(reactor_uring->buf_ring, 1);
+}
+
+static void
+handle_recv_completion(LibWCReactorUring *reactor_uring,
+                       LibWCUringOp *op,
+                       gint res,
+                       guint32 flags) {
+    LibWCRelayUring *state = op->state;
+    LibWCRelay *relay = state->relay;
+    guint16 buffer_id;
+    GError *error;
+
+    if (flags & IORING_CQE_F_BUFFER) {
+        buffer_id = flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if (res > 0 && !state->stopped)
+            _libwc_relay_connection_feed(
+                relay, reactor_uring->buffers + (buffer_id * URING_BUFFER_SIZE),
+                res);
+
+        reactor_uring_recycle_buffer(reactor_uring, buffer_id);
+    }
+
+    if (flags & IORING_CQE_F_MORE)
+        return;
+
+    /* Running out of buffers just means everyone else on this reactor was
+     * busy, the buffers have been recycled by now */
+    if (!state->stopped && (res > 0 || res == -ENOBUFS)) {
+        relay_uring_arm_recv(state);
+        io_uring_submit(&reactor_uring->ring);
+    }
+    else if (!state->stopped) {
+        if (res == 0)
+            error = g_error_new_literal(G_IO_ERROR,
+                                        G_IO_ERROR_CONNECTION_CLOSED,
+                                        "The relay closed the connection");
+        else
+            error = uring_error_new(res, "Couldn't receive from the relay");
+
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+    }
+
+    relay_uring_op_done(state, op);
+}
+
+static gint
+compare_chain_pos(gconstpointer a,
+                  gconstpointer b,
+                  void *user_data) {
+    const LibWCUringOp *op_a = a,
+                       *op_b = b;
+
+    return (gint)op_a->chain_pos - (gint)op_b->chain_pos;
+}
+
+static void
+handle_send_completion(LibWCReactorUring *reactor_uring,
+                       LibWCUringOp *op,
+                       gint res) {
+    LibWCRelayUring *state = op->state;
+    LibWCRelay *relay = state->relay;
+    LibWCQueuedWrite *queued_write = op->queued_write;
+    gsize data_size = g_bytes_get_size(queued_write->data);
+    GBytes *new_data;
+    GError *error;
+
+    state->sends_in_flight--;
+
+    if (state->stopped) {
+        _libwc_queued_write_free(queued_write);
+    }
+    else if (res == data_size) {
+        state->window_bytes -= queued_write->size;
+        _libwc_relay_connection_write_done(relay, queued_write);
+    }
+    else if (res == -ECANCELED || (res > 0 && res < data_size)) {
+        /* Either we got a short send, or a send before us in the chain did */
+        if (res > 0) {
+            new_data = g_bytes_new_from_bytes(queued_write->data, res,
+                                              data_size - res);
+
+            g_bytes_unref(queued_write->data);
+            queued_write->data = new_data;
+
+            /* The part that made it out no longer takes up the window */
+            queued_write->size -= res;
+            state->window_bytes -= res;
+            _libwc_relay_window_adjust(relay, 0, -res);
+        }
+
+        g_queue_insert_sorted(&state->retry_queue, op, compare_chain_pos,
+                              NULL);
+        op = NULL;
+    }
+    else {
+        /* The write still counts as ours until the connection is stopped, so
+         * that whoever stops it knows to account for it */
+        error = uring_error_new(res, "Couldn't send to the relay");
+        _libwc_relay_connection_end_on_error(relay, error);
+        g_error_free(error);
+
+        _libwc_queued_write_free(queued_write);
+    }
+
+    if (state->sends_in_flight == 0 && !state->stopped) {
+        LibWCUringOp *retry_op;
+
+        while ((retry_op = g_queue_pop_head(&state->retry_queue))) {
+            state->window_bytes -= retry_op->queued_write->size;
+            _libwc_write_scheduler_push_resume(&relay->priv->write_queue,
+                                               retry_op->queued_write);
+            g_free(retry_op);
+        }
+
+        _libwc_relay_uring_flush(relay);
+    }
+
+    if (op)
+        relay_uring_op_done(state, op);
+    else
+        state->ops_in_flight--;
+}
+
+static gboolean
+reactor_uring_event_cb(gint fd,
+                       GIOCondition condition,
+                       LibWCReactorUring *reactor_uring) {
+    struct io_uring_cqe *cqe;
+    LibWCUringOp *op;
+    guint head, count = 0;
+    guint64 value;
+
+    if (read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        g_warning("Failed to read from io_uring eventfd: %s",
+                  g_strerror(errno));
+
+    io_uring_for_each_cqe(&reactor_uring->ring, head, cqe) {
+        op = io_uring_cqe_get_data(cqe);
+        count++;
+
+        /* Cancellations don't carry an op */
+        if (!op)
+            continue;
+
+        if (op->type == URING_OP_RECV)
+            handle_recv_completion(reactor_uring, op, cqe->res, cqe->flags);
+        else
+            handle_send_completion(reactor_uring, op, cqe->res);
+    }
+
+    io_uring_cq_advance(&reactor_uring->ring, count);
+
+    return G_SOURCE_CONTINUE;
+}
+
+static LibWCReactorUring *
+reactor_uring_get(LibWCReactor *reactor,
+                  GError **error) {
+    LibWCReactorUring *reactor_uring;
+    gint ret;
+
+    if (reactor->uring)
+        return reactor->uring;
+
+    reactor_uring = g_new0(LibWCReactorUring, 1);
+
+    ret = io_uring_queue_init(URING_QUEUE_DEPTH, &reactor_uring->ring, 0);
+    if (ret < 0) {
+        g_propagate_error(error, uring_error_new(ret, "Couldn't set up io_uring"));
+        g_free(reactor_uring);
+
+        return NULL;
+    }
+
+    reactor_uring->buf_ring = io_uring_setup_buf_ring(&reactor_uring->ring,
+                                                      URING_BUFFER_COUNT,
+                                                      URING_BUFFER_GROUP, 0,
+                                                      &ret);
+    if (!reactor_uring->buf_ring) {
+        g_propagate_error(error, uring_error_new(
+            ret, "Couldn't register io_uring receive buffers"));
+        io_uring_queue_exit(&reactor_uring->ring);
+        g_free(reactor_uring);
+
+        return NULL;
+    }
+
+    reactor_uring->buffers = g_malloc(URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+    for (guint i = 0; i < URING_BUFFER_COUNT; i++) {
+        io_uring_buf_ring_add(reactor_uring->buf_ring,
+                              reactor_uring->buffers + (i * URING_BUFFER_SIZE),
+                              URING_BUFFER_SIZE, i,
+                              io_uring_buf_ring_mask(URING_BUFFER_COUNT), i);
+    }
+    io_uring_buf_ring_advance(reactor_uring->buf_ring, URING_BUFFER_COUNT);
+
+    reactor_uring->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    io_uring_register_eventfd(&reactor_uring->ring, reactor_uring->event_fd);
+
+    reactor_uring->source = g_unix_fd_source_new(reactor_uring->event_fd,
+                                                 G_IO_IN);
+    g_source_set_callback(reactor_uring->source,
+                          (GSourceFunc)reactor_uring_event_cb, reactor_uring,
+                          NULL);
+    g_source_attach(reactor_uring->source, reactor->context);
+
+    reactor->uring = reactor_uring;
+
+    return reactor_uring;
+}
+
+void
+_libwc_reactor_uring_free(gpointer data) {
+    LibWCReactorUring *reactor_uring = data;
+
+    g_source_destroy(reactor_uring->source);
+    g_source_unref(reactor_uring->source);
+
+    io_uring_free_buf_ring(&reactor_uring->ring, reactor_uring->buf_ring,
+                           URING_BUFFER_COUNT, URING_BUFFER_GROUP);
+    io_uring_queue_exit(&reactor_uring->ring);
+
+    close(reactor_uring->event_fd);
+    g_free(reactor_uring->buffers);
+    g_free(reactor_uring);
+}
+
+/* Runs on the relay's reactor thread */
+gboolean
+_libwc_relay_uring_start(LibWCRelay *relay,
+                         GError **error) {
+    LibWCRelayPrivate *priv = relay->priv;
+    LibWCReactorUring *reactor_uring;
+    LibWCRelayUring *state;
+    gint fd;
+
+    /* Anything layered on top of the socket, like TLS, has to go through GIO */
+    if (!G_IS_SOCKET_CONNECTION(priv->stream)) {
+        g_set_error_literal(error, LIBWC_ERROR_RELAY,
+                            LIBWC_ERROR_RELAY_NOT_SUPPORTED,
+                            "io_uring can only be used with plain sockets");
+        return FALSE;
+    }
+
+    reactor_uring = reactor_uring_get(priv->reactor, error);
+    if (!reactor_uring)
+        return FALSE;
+
+    fd = fcntl(g_socket_get_fd(priv->socket), F_DUPFD_CLOEXEC, 0);
+    if (fd < 0) {
+        g_propagate_error(error, uring_error_new(-errno,
+                                                 "Couldn't duplicate socket"));
+        return FALSE;
+    }
+
+    state = g_new0(LibWCRelayUring, 1);
+    state->relay = g_object_ref(relay);
+    state->reactor_uring = reactor_uring;
+    state->fd = fd;
+    g_queue_init(&state->retry_queue);
+
+    priv->uring = state;
+
+    relay_uring_arm_recv(state);
+    io_uring_submit(&reactor_uring->ring);
+
+    return TRUE;
+}
+
+void
+_libwc_relay_uring_flush(LibWCRelay *relay) {
+    LibWCRelayUring *state = relay->priv->uring;
+    LibWCReactorUring *reactor_uring;
+    LibWCQueuedWrite *queued_write;
+    LibWCUringOp *op;
+    struct io_uring_sqe *sqe = NULL;
+    gconstpointer data;
+    gsize data_size, chain_size = 0;
+    guint chain_len = 0;
+
+    if (!state || state->stopped || state->sends_in_flight)
+        return;
+
+    reactor_uring = state->reactor_uring;
+    if (io_uring_sq_space_left(&reactor_uring->ring) == 0)
+        io_uring_submit(&reactor_uring->ring);
+
+    /* Once a send is in the ring, anything that gets queued up after it has to
+     * wait for it. Keeping chains short means a big batch of bulk commands
+     * can't hold up interactive ones for long */
+    while (io_uring_sq_space_left(&reactor_uring->ring) &&
+           chain_size < URING_MAX_CHAIN_SIZE &&
+           (queued_write =
+            _libwc_relay_connection_next_write(relay))) {
+        op = g_new0(LibWCUringOp, 1);
+        op->type = URING_OP_SEND;
+        op->state = state;
+        op->queued_write = queued_write;
+        op->chain_pos = chain_len++;
+
+        data = g_bytes_get_data(queued_write->data, &data_size);
+
+        state->window_bytes += queued_write->size;
+        chain_size += data_size;
+
+        sqe = io_uring_get_sqe(&reactor_uring->ring);
+        io_uring_prep_send(sqe, state->fd, data, data_size,
+                           MSG_NOSIGNAL | MSG_WAITALL);
+        sqe->flags |= IOSQE_IO_LINK;
+        io_uring_sqe_set_data(sqe, op);
+    }
+
+    if (!sqe)
+        return;
+
+    /* The last send ends the chain */
+    sqe->flags &= ~IOSQE_IO_LINK;
+
+    state->sends_in_flight = chain_len;
+    state->ops_in_flight += chain_len;
+
+    io_uring_submit(&reactor_uring->ring);
+}
+
+/* Runs on the relay's reactor thread. The connection's state is cleaned up
+ * once all of its in-flight operations have completed, and any writes it was
+ * holding onto get dropped without touching the relay's command window.
+ * Returns how many bytes of the window those writes accounted for */
+gsize
+_libwc_relay_uring_stop(LibWCRelay *relay) {
+    LibWCRelayUring *state = relay->priv->uring;
+    LibWCReactorUring *reactor_uring;
+    struct io_uring_sqe *sqe;
+    LibWCUringOp *op;
+    gsize window_bytes;
+
+    if (!state)
+        return 0;
+
+    relay->priv->uring = NULL;
+    state->stopped = TRUE;
+    window_bytes = state->window_bytes;
+
+    while ((op = g_queue_pop_head(&state->retry_queue))) {
+        _libwc_queued_write_free(op->queued_write);
+        g_free(op);
+    }
+
+    if (state->ops_in_flight == 0) {
+        relay_uring_free(state);
+        return window_bytes;
+    }
+
+    /* Shutting down the socket ends the multishot receive, the cancellation
+     * takes care of any sends that are stuck waiting for buffer space */
+    reactor_uring = state->reactor_uring;
+    shutdown(state->fd, SHUT_RDWR);
+
+    sqe = uring_get_sqe(reactor_uring);
+    io_uring_prep_cancel_fd(sqe, state->fd, IORING_ASYNC_CANCEL_ALL);
+    io_uring_sqe_set_data(sqe, NULL);
+
+    io_uring_submit(&reactor_uring->ring);
+
+    return window_bytes;
+}
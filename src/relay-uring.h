@@ -0,0 +1,39 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef RELAY_URING_H
+#define RELAY_URING_H
+
+#include "relay.h"
+#include "reactor-pool-private.h"
+
+#include <glib.h>
+
+/* These are only available when libweechat is built with HAVE_LIBURING */
+
+typedef struct _LibWCRelayUring LibWCRelayUring;
+
+gboolean _libwc_relay_uring_start(LibWCRelay *relay,
+                                  GError **error)
+G_GNUC_INTERNAL;
+
+void _libwc_relay_uring_flush(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+gsize _libwc_relay_uring_stop(LibWCRelay *relay)
+G_GNUC_INTERNAL;
+
+void _libwc_reactor_uring_free(gpointer reactor_uring)
+G_GNUC_INTERNAL;
+
+#endif /* !RELAY_URING_H */
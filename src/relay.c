@@ -11,16 +11,21 @@
  * details.
  */
 
+#include "config.h"
+
 #include "relay.h"
 #include "relay-private.h"
 #include "relay-parser.h"
 #include "relay-connection.h"
+#include "relay-command.h"
 #include "libweechat.h"
 
 #include <glib.h>
 #include <gio/gio.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 /* TODO:
  * - Eventually implement a synchronous version of initializing the relay. We're
@@ -47,8 +52,92 @@ G_DEFINE_TYPE_WITH_CODE(LibWCRelay, libwc_relay, G_TYPE_OBJECT,
                         G_IMPLEMENT_INTERFACE(G_TYPE_ASYNC_INITABLE,
                                               libwc_relay_init_async_initable));
 
+guint _libwc_relay_signals[LIBWC_RELAY_SIGNAL_COUNT];
+
+/* Statically allocated, so its mutex doesn't need initializing, and it
+ * starts out with no limits */
+LibWCRateLimit _libwc_global_rate_limit;
+
+/* Everything that gets queued up or attached somewhere on the relay's behalf
+ * holds a reference to it, so by the time we get here nothing is pending and
+ * only what the connection leaves attached to the reactor needs tearing down */
 static void
-libwc_relay_class_init(LibWCRelayClass *klass) { }
+libwc_relay_finalize(GObject *object) {
+    LibWCRelay *relay = LIBWC_RELAY(object);
+    LibWCRelayPrivate *priv = relay->priv;
+
+    if (!priv->connected)
+        _libwc_relay_connection_detach(relay);
+
+    libwc_relay_capture_stop(relay);
+    libwc_relay_shm_publish_stop(relay);
+
+    g_clear_pointer(&priv->standby, _libwc_relay_standby_free);
+    g_clear_pointer(&priv->reconnect, _libwc_relay_reconnect_free);
+    g_clear_pointer(&priv->decoder, _libwc_relay_decoder_free);
+    g_clear_pointer(&priv->adopted_ids, g_hash_table_unref);
+
+    g_clear_pointer(&priv->spilled_frame, g_bytes_unref);
+    g_clear_pointer(&priv->spill, _libwc_spill_file_free);
+    g_clear_pointer(&priv->rx_buffer, g_byte_array_unref);
+    g_clear_pointer(&priv->receive_buffer, g_free);
+    g_clear_object(&priv->decompressor);
+
+    g_clear_object(&priv->stream);
+    g_clear_object(&priv->socket);
+    g_clear_object(&priv->input_stream_cancellable);
+    g_clear_pointer(&priv->context, g_main_context_unref);
+    g_clear_object(&priv->reactor_pool);
+
+    if (priv->wakeup_fd >= 0)
+        close(priv->wakeup_fd);
+
+    _libwc_command_slab_clear(&priv->pending_commands);
+    _libwc_command_pool_clear(&priv->command_pool);
+    _libwc_rate_limit_clear(&priv->rate_limit);
+    _libwc_relay_subscriptions_clear(&priv->subscriptions);
+
+    g_mutex_clear(&priv->event_mutex);
+    g_mutex_clear(&priv->window_mutex);
+    g_mutex_clear(&priv->capture_mutex);
+    g_mutex_clear(&priv->shm_mutex);
+
+    if (priv->password) {
+        munlock(priv->password, strlen(priv->password) + 1);
+        g_free(priv->password);
+    }
+
+    G_OBJECT_CLASS(libwc_relay_parent_class)->finalize(object);
+}
+
+static void
+libwc_relay_class_init(LibWCRelayClass *klass) {
+    GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+    object_class->finalize = libwc_relay_finalize;
+
+    /* Emitted whenever the relay's in-flight command window fills up or drains
+     * enough to accept more commands. Note that this may be emitted from the
+     * libweechat thread */
+    _libwc_relay_signals[LIBWC_RELAY_SIGNAL_WRITABLE_CHANGED] =
+        g_signal_new("writable-changed", G_TYPE_FROM_CLASS(klass),
+                     G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 1,
+                     G_TYPE_BOOLEAN);
+
+    /* Emitted from the libweechat thread when the connection to the relay was
+     * lost and reconnecting is enabled, with the number of the upcoming
+     * attempt and how many milliseconds we'll wait before making it */
+    _libwc_relay_signals[LIBWC_RELAY_SIGNAL_RECONNECTING] =
+        g_signal_new("reconnecting", G_TYPE_FROM_CLASS(klass),
+                     G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 2,
+                     G_TYPE_UINT, G_TYPE_UINT);
+
+    /* Emitted from the libweechat thread once a reconnection attempt succeeds,
+     * before we start resyncing buffers */
+    _libwc_relay_signals[LIBWC_RELAY_SIGNAL_RECONNECTED] =
+        g_signal_new("reconnected", G_TYPE_FROM_CLASS(klass),
+                     G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+}
 
 static void
 libwc_relay_init(LibWCRelay *self) {
@@ -62,14 +151,28 @@ libwc_relay_new() {
     relay = LIBWC_RELAY(g_object_new(LIBWC_TYPE_RELAY, NULL));
 
     relay->priv->input_stream_cancellable = g_cancellable_new();
-    relay->priv->pending_writes = g_async_queue_new();
-    relay->priv->pending_tasks =
-        g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
-                              g_object_unref);
+    _libwc_command_slab_init(&relay->priv->pending_commands);
+    _libwc_relay_deadlines_init(relay);
     relay->priv->decompressor =
         g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
 
-    g_mutex_init(&relay->priv->pending_tasks_mutex);
+    relay->priv->rx_buffer = g_byte_array_new();
+    relay->priv->max_heap_frame_size = LIBWC_DEFAULT_MAX_HEAP_FRAME_SIZE;
+    relay->priv->max_frame_size = LIBWC_DEFAULT_MAX_FRAME_SIZE;
+
+    _libwc_mpsc_queue_init(&relay->priv->submit_queue);
+    _libwc_write_scheduler_init(&relay->priv->write_queue);
+    relay->priv->wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    g_mutex_init(&relay->priv->event_mutex);
+    g_mutex_init(&relay->priv->window_mutex);
+    g_mutex_init(&relay->priv->capture_mutex);
+    g_mutex_init(&relay->priv->shm_mutex);
+    _libwc_rate_limit_init(&relay->priv->rate_limit);
+    _libwc_command_pool_init(&relay->priv->command_pool);
+    _libwc_relay_subscriptions_init(&relay->priv->subscriptions);
+    g_queue_init(&relay->priv->writable_waiters);
+    relay->priv->writable = TRUE;
 
     return relay;
 }
@@ -110,6 +213,163 @@ libwc_relay_password_set(LibWCRelay *relay,
     strcpy(relay->priv->password, password);
 }
 
+/* Must be called before the connection is initialized. If no pool is set, the
+ * relay gets put on the default pool */
+void
+libwc_relay_reactor_pool_set(LibWCRelay *relay,
+                             LibWCReactorPool *pool) {
+    g_assert_false(relay->priv->connected);
+
+    if (relay->priv->reactor_pool)
+        g_object_unref(relay->priv->reactor_pool);
+
+    relay->priv->reactor_pool = pool ? g_object_ref(pool) : NULL;
+}
+
+/* Must be called before the connection is initialized */
+gboolean
+libwc_relay_backend_set(LibWCRelay *relay,
+                        LibWCRelayBackend backend,
+                        GError **error) {
+    g_assert_false(relay->priv->connected);
+
+#ifndef HAVE_LIBURING
+    if (backend == LIBWC_RELAY_BACKEND_IO_URING) {
+        g_set_error_literal(error, LIBWC_ERROR_RELAY,
+                            LIBWC_ERROR_RELAY_NOT_SUPPORTED,
+                            "libweechat was built without io_uring support");
+        return FALSE;
+    }
+#endif
+
+    relay->priv->backend = backend;
+
+    return TRUE;
+}
+
+/* Turns on timestamping messages as they go through the relay, see
+ * LibWCRelayMessageTimestamps. Kernel receive timestamps are only available
+ * with the GIO backend on connections that aren't wrapped in TLS */
+void
+libwc_relay_timestamps_set(LibWCRelay *relay,
+                           gboolean enabled) {
+    g_assert_false(relay->priv->connected);
+
+    relay->priv->timestamps = enabled;
+}
+
+/* Once the relay runs out of data to read, it spins on the socket waiting for
+ * more, spending up to budget microseconds in total each time it wakes up
+ * before going back to waiting on the main loop. This saves the time it takes for the reactor thread to get woken back
+ * up when data arrives, at the cost of burning CPU while spinning, and of
+ * holding up everything else on the same reactor for up to budget
+ * microseconds at a time. Where the kernel allows it, the socket is also set
+ * up to busy poll the network device. Only works with the GIO backend, and
+ * must be set before connecting. 0, the default, turns it off */
+void
+libwc_relay_busy_poll_set(LibWCRelay *relay,
+                          guint budget) {
+    g_assert_false(relay->priv->connected);
+
+    relay->priv->busy_poll = budget;
+}
+
+/* In tolerant mode, a frame that can't be decoded only fails the command it
+ * was a response to, if any, and the connection keeps going. Since every
+ * frame says exactly how long it is, one bad frame can't throw off the ones
+ * after it. Only errors from the connection itself end it. Skipped frames get
+ * counted in LibWCRelayStats.frames_dropped */
+void
+libwc_relay_tolerant_set(LibWCRelay *relay,
+                         gboolean tolerant) {
+    g_atomic_int_set(&relay->priv->tolerant, tolerant);
+}
+
+void
+libwc_relay_stats_get(LibWCRelay *relay,
+                      LibWCRelayStats *stats) {
+    LibWCRelayStatCounters *counters = &relay->priv->stats;
+
+    *stats = (LibWCRelayStats) {
+        .frames_received = atomic_load_explicit(&counters->frames_received,
+                                                memory_order_relaxed),
+        .frames_dropped = atomic_load_explicit(&counters->frames_dropped,
+                                               memory_order_relaxed),
+        .busy_poll_time = atomic_load_explicit(&counters->busy_poll_time,
+                                               memory_order_relaxed),
+        .busy_poll_hits = atomic_load_explicit(&counters->busy_poll_hits,
+                                               memory_order_relaxed),
+        .busy_poll_misses = atomic_load_explicit(&counters->busy_poll_misses,
+                                                 memory_order_relaxed),
+        .commands_written = atomic_load_explicit(&counters->commands_written,
+                                                 memory_order_relaxed),
+        .queue_delay_total = atomic_load_explicit(&counters->queue_delay_total,
+                                                  memory_order_relaxed),
+        .queue_delay_max = atomic_load_explicit(&counters->queue_delay_max,
+                                                memory_order_relaxed),
+        .commands_shaped = atomic_load_explicit(&counters->commands_shaped,
+                                                memory_order_relaxed)
+    };
+}
+
+/* Limits how fast commands go out to the relay, in commands and in bytes per
+ * second, with bursts of up to command_burst commands and byte_burst bytes. A
+ * rate of 0 means no limit, and a burst of 0 means a second's worth. Commands
+ * over the limit wait in the relay's queue without holding up whoever
+ * submitted them, and still go out in priority order. Can be changed at any
+ * time, from any thread */
+void
+libwc_relay_rate_limit_set(LibWCRelay *relay,
+                           guint command_rate,
+                           guint command_burst,
+                           gsize byte_rate,
+                           gsize byte_burst) {
+    _libwc_rate_limit_set(&relay->priv->rate_limit, command_rate,
+                          command_burst, byte_rate, byte_burst);
+}
+
+/* Like libwc_relay_rate_limit_set(), but shared between every relay in the
+ * process. Commands have to fit within both limits to go out */
+void
+libwc_relay_global_rate_limit_set(guint command_rate,
+                                  guint command_burst,
+                                  gsize byte_rate,
+                                  gsize byte_burst) {
+    _libwc_rate_limit_set(&_libwc_global_rate_limit, command_rate,
+                          command_burst, byte_rate, byte_burst);
+}
+
+/* Frames with payloads bigger than max_heap_size get received into a temporary
+ * file instead of memory, and are decoded from a mapping of it. The same goes
+ * for compressed payloads that inflate to more than that. Frames bigger than
+ * max_size, or that inflate to more than it, are treated as invalid before
+ * anything gets allocated for them. Must be set before connecting */
+void
+libwc_relay_frame_limits_set(LibWCRelay *relay,
+                             gsize max_heap_size,
+                             gsize max_size) {
+    g_assert_false(relay->priv->connected);
+    g_return_if_fail(max_heap_size > 0 && max_heap_size <= max_size);
+
+    relay->priv->max_heap_frame_size = max_heap_size;
+    relay->priv->max_frame_size = max_size;
+}
+
+/* Spreads inflating and parsing the relay's messages out over n_threads worker
+ * threads. Messages still get dispatched one by one in the order the relay
+ * sent them. Setting it to 0, the default, does all of the decoding on the
+ * relay's reactor thread */
+void
+libwc_relay_decode_threads_set(LibWCRelay *relay,
+                               guint n_threads) {
+    g_assert_false(relay->priv->connected);
+
+    g_clear_pointer(&relay->priv->decoder, _libwc_relay_decoder_free);
+
+    if (n_threads)
+        relay->priv->decoder = _libwc_relay_decoder_new(relay, n_threads);
+}
+
 void
 libwc_relay_connection_set(LibWCRelay *relay,
                            GIOStream *stream,
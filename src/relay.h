@@ -17,6 +17,10 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include "reactor-pool.h"
+#include "relay-parser.h"
+#include "hdata-query.h"
+
 #define LIBWC_TYPE_RELAY            (libwc_relay_get_type())
 #define LIBWC_RELAY(obj)            (G_TYPE_CHECK_INSTANCE_CAST((obj), LIBWC_TYPE_RELAY, LibWCRelay))
 #define LIBWC_IS_RELAY(obj)         (G_TYPE_CHECK_INSTANCE_TYPE((obj), LIBWC_TYPE_RELAY))
@@ -24,9 +28,65 @@
 #define LIBWC_IS_RELAY_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), LIBWC_TYPE_RELAY))
 #define LIBWC_RELAY_GET_CLASS       (G_TYPE_INSTANCE_GET_CLASS((obj), LIBWC_TYPE_RELAY, LibWCRelayClass));
 
+/* Timeouts for commands are given in milliseconds. LIBWC_TIMEOUT_DEFAULT uses
+ * whatever was set with libwc_relay_command_timeout_set() */
+#define LIBWC_TIMEOUT_DEFAULT (0)
+#define LIBWC_TIMEOUT_NONE    (G_MAXUINT)
+
+/* The I/O backend used for the relay's socket. The io_uring backend is only
+ * available if libweechat was built with liburing, and only works on plain
+ * (non-TLS) connections. If it can't be used once the connection is
+ * initialized, the relay falls back to GIO */
+typedef enum {
+    LIBWC_RELAY_BACKEND_GIO,
+    LIBWC_RELAY_BACKEND_IO_URING
+} LibWCRelayBackend;
+
+typedef enum {
+    LIBWC_UNIX_SOCKET_FLAG_NONE      = 0,
+    /* The path is a name in the abstract socket namespace */
+    LIBWC_UNIX_SOCKET_FLAG_ABSTRACT  = 1 << 0,
+    /* Only connect to relays running as the same user we are */
+    LIBWC_UNIX_SOCKET_FLAG_SAME_USER = 1 << 1
+} LibWCUnixSocketFlags;
+
+/* What can be synced for a buffer with libwc_relay_subscribe().
+ * LIBWC_SYNC_BUFFERS (buffers being opened, closed, renamed and so on) and
+ * LIBWC_SYNC_UPGRADE only apply to "*" */
+typedef enum {
+    LIBWC_SYNC_NONE     = 0,
+    LIBWC_SYNC_BUFFER   = 1 << 0,
+    LIBWC_SYNC_NICKLIST = 1 << 1,
+    LIBWC_SYNC_BUFFERS  = 1 << 2,
+    LIBWC_SYNC_UPGRADE  = 1 << 3,
+    LIBWC_SYNC_ALL      = (1 << 4) - 1
+} LibWCSyncFlags;
+
+/* Counters kept over the relay's whole lifetime, across reconnects */
+typedef struct {
+    /* Complete frames received from the relay */
+    guint64 frames_received;
+    /* Frames that couldn't be decoded and were skipped in tolerant mode */
+    guint64 frames_dropped;
+    /* CPU time spent busy polling, in nanoseconds, and how many times busy
+     * polling did and didn't end with data to read */
+    guint64 busy_poll_time;
+    guint64 busy_poll_hits;
+    guint64 busy_poll_misses;
+    /* Commands written out to the relay, and how long they sat in the queue
+     * before going out, in microseconds, in total and at most. Time spent held
+     * back by rate limits counts */
+    guint64 commands_written;
+    guint64 queue_delay_total;
+    guint64 queue_delay_max;
+    /* How many times a rate limit held back the next command */
+    guint64 commands_shaped;
+} LibWCRelayStats;
+
 typedef struct _LibWCRelay        LibWCRelay;
 typedef struct _LibWCRelayClass   LibWCRelayClass;
 typedef struct _LibWCRelayPrivate LibWCRelayPrivate;
+typedef struct _LibWCRelayProxy   LibWCRelayProxy;
 
 struct _LibWCRelay {
     GObject parent_instance;
@@ -38,6 +98,13 @@ struct _LibWCRelayClass {
     GObjectClass parent_class;
 };
 
+/* Called with every event received since the last call. The events are owned
+ * by libweechat, and are only valid until the callback returns */
+typedef void (*LibWCRelayEventFunc)(LibWCRelay *relay,
+                                    LibWCRelayMessage **events,
+                                    guint n_events,
+                                    void *user_data);
+
 GType libwc_relay_get_type();
 
 LibWCRelay * libwc_relay_new()
@@ -46,10 +113,100 @@ G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
 void libwc_relay_password_set(LibWCRelay *relay,
                               const gchar *password);
 
+void libwc_relay_reactor_pool_set(LibWCRelay *relay,
+                                  LibWCReactorPool *pool);
+
+gboolean libwc_relay_backend_set(LibWCRelay *relay,
+                                 LibWCRelayBackend backend,
+                                 GError **error);
+
+void libwc_relay_timestamps_set(LibWCRelay *relay,
+                                gboolean enabled);
+
+void libwc_relay_tolerant_set(LibWCRelay *relay,
+                              gboolean tolerant);
+
+void libwc_relay_busy_poll_set(LibWCRelay *relay,
+                               guint budget);
+
+void libwc_relay_stats_get(LibWCRelay *relay,
+                           LibWCRelayStats *stats);
+
+void libwc_relay_rate_limit_set(LibWCRelay *relay,
+                                guint command_rate,
+                                guint command_burst,
+                                gsize byte_rate,
+                                gsize byte_burst);
+
+void libwc_relay_global_rate_limit_set(guint command_rate,
+                                       guint command_burst,
+                                       gsize byte_rate,
+                                       gsize byte_burst);
+
+void libwc_relay_frame_limits_set(LibWCRelay *relay,
+                                  gsize max_heap_size,
+                                  gsize max_size);
+
+void libwc_relay_decode_threads_set(LibWCRelay *relay,
+                                    guint n_threads);
+
+void libwc_relay_reconnect_enable(LibWCRelay *relay,
+                                  GSocketClient *client,
+                                  GSocketConnectable *connectable,
+                                  guint min_delay,
+                                  guint max_delay);
+
+void libwc_relay_reconnect_disable(LibWCRelay *relay);
+
+void libwc_relay_standby_enable(LibWCRelay *relay,
+                                guint interval);
+
+gboolean libwc_relay_capture_start(LibWCRelay *relay,
+                                   const gchar *path,
+                                   GError **error);
+
+void libwc_relay_capture_stop(LibWCRelay *relay);
+
+void libwc_relay_replay_async(LibWCRelay *relay,
+                              GCancellable *cancellable,
+                              GAsyncReadyCallback callback,
+                              void *user_data,
+                              const gchar *path,
+                              gboolean realtime);
+
+gboolean libwc_relay_replay_finish(LibWCRelay *relay,
+                                   GAsyncResult *res,
+                                   GError **error);
+
+gboolean libwc_relay_replay(LibWCRelay *relay,
+                            GCancellable *cancellable,
+                            GError **error,
+                            const gchar *path,
+                            gboolean realtime);
+
+gint libwc_relay_shm_publish_start(LibWCRelay *relay,
+                                   gsize size,
+                                   GError **error);
+
+void libwc_relay_shm_publish_stop(LibWCRelay *relay);
+
+LibWCRelayProxy * libwc_relay_proxy_new(LibWCRelay *relay,
+                                        const gchar *password,
+                                        GSocketAddress *address,
+                                        GError **error);
+
+void libwc_relay_proxy_free(LibWCRelayProxy *proxy);
+
 void libwc_relay_connection_set(LibWCRelay *relay,
                                 GIOStream *stream,
                                 GSocket *socket);
 
+gboolean libwc_relay_connection_set_unix(LibWCRelay *relay,
+                                         const gchar *path,
+                                         LibWCUnixSocketFlags flags,
+                                         GCancellable *cancellable,
+                                         GError **error);
+
 void libwc_relay_connection_init_async(LibWCRelay *relay,
                                        GCancellable *cancellable,
                                        GAsyncReadyCallback callback,
@@ -63,6 +220,71 @@ gboolean libwc_relay_connection_init(LibWCRelay *relay,
                                      GCancellable *cancellable,
                                      GError **error);
 
+void libwc_relay_handoff_send_async(LibWCRelay *relay,
+                                    GCancellable *cancellable,
+                                    GAsyncReadyCallback callback,
+                                    void *user_data,
+                                    GSocket *channel);
+
+gboolean libwc_relay_handoff_send_finish(LibWCRelay *relay,
+                                         GAsyncResult *res,
+                                         GError **error);
+
+gboolean libwc_relay_handoff_send(LibWCRelay *relay,
+                                  GCancellable *cancellable,
+                                  GError **error,
+                                  GSocket *channel);
+
+void libwc_relay_handoff_receive_async(LibWCRelay *relay,
+                                       GCancellable *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       void *user_data,
+                                       GSocket *channel);
+
+gboolean libwc_relay_handoff_receive_finish(LibWCRelay *relay,
+                                            GAsyncResult *res,
+                                            GError **error);
+
+gboolean libwc_relay_handoff_receive(LibWCRelay *relay,
+                                     GCancellable *cancellable,
+                                     GError **error,
+                                     GSocket *channel);
+
+void libwc_relay_event_handler_set(LibWCRelay *relay,
+                                   GMainContext *context,
+                                   LibWCRelayEventFunc func,
+                                   void *user_data,
+                                   GDestroyNotify notify);
+
+void libwc_relay_window_set(LibWCRelay *relay,
+                            guint max_commands,
+                            gsize max_bytes);
+
+gboolean libwc_relay_is_writable(LibWCRelay *relay);
+
+void libwc_relay_wait_writable_async(LibWCRelay *relay,
+                                     GCancellable *cancellable,
+                                     GAsyncReadyCallback callback,
+                                     void *user_data);
+
+gboolean libwc_relay_wait_writable_finish(LibWCRelay *relay,
+                                          GAsyncResult *res,
+                                          GError **error);
+
+gboolean libwc_relay_wait_writable(LibWCRelay *relay,
+                                   GCancellable *cancellable,
+                                   GError **error);
+
+void libwc_relay_command_timeout_set(LibWCRelay *relay,
+                                     guint timeout);
+
+void libwc_relay_ping_full_async(LibWCRelay *relay,
+                                 guint timeout,
+                                 GCancellable *cancellable,
+                                 GAsyncReadyCallback callback,
+                                 void *user_data,
+                                 const gchar *ping_string);
+
 void libwc_relay_ping_async(LibWCRelay *relay,
                             GCancellable *cancellable,
                             GAsyncReadyCallback callback,
@@ -106,4 +328,110 @@ gchar * libwc_relay_pingv(LibWCRelay *relay,
                           const gchar *format_string,
                           va_list args);
 
+LibWCRelayMessage * libwc_relay_command_finish(LibWCRelay *relay,
+                                               GAsyncResult *res,
+                                               GError **error);
+
+void libwc_relay_message_free(LibWCRelayMessage *message);
+
+void libwc_relay_hdata_async(LibWCRelay *relay,
+                             GCancellable *cancellable,
+                             GAsyncReadyCallback callback,
+                             void *user_data,
+                             const gchar *path,
+                             const gchar *keys);
+
+LibWCRelayMessage * libwc_relay_hdata(LibWCRelay *relay,
+                                      GCancellable *cancellable,
+                                      GError **error,
+                                      const gchar *path,
+                                      const gchar *keys);
+
+void libwc_relay_hdata_query_async(LibWCRelay *relay,
+                                   GCancellable *cancellable,
+                                   GAsyncReadyCallback callback,
+                                   void *user_data,
+                                   LibWCHdataQuery *query);
+
+LibWCRelayMessage * libwc_relay_hdata_query(LibWCRelay *relay,
+                                            GCancellable *cancellable,
+                                            GError **error,
+                                            LibWCHdataQuery *query);
+
+void libwc_relay_info_async(LibWCRelay *relay,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            void *user_data,
+                            const gchar *name,
+                            const gchar *arguments);
+
+LibWCRelayMessage * libwc_relay_info(LibWCRelay *relay,
+                                     GCancellable *cancellable,
+                                     GError **error,
+                                     const gchar *name,
+                                     const gchar *arguments);
+
+void libwc_relay_infolist_async(LibWCRelay *relay,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                void *user_data,
+                                const gchar *name,
+                                guint64 pointer,
+                                const gchar *arguments);
+
+LibWCRelayMessage * libwc_relay_infolist(LibWCRelay *relay,
+                                         GCancellable *cancellable,
+                                         GError **error,
+                                         const gchar *name,
+                                         guint64 pointer,
+                                         const gchar *arguments);
+
+void libwc_relay_nicklist_async(LibWCRelay *relay,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                void *user_data,
+                                const gchar *buffer);
+
+LibWCRelayMessage * libwc_relay_nicklist(LibWCRelay *relay,
+                                         GCancellable *cancellable,
+                                         GError **error,
+                                         const gchar *buffer);
+
+void libwc_relay_test_async(LibWCRelay *relay,
+                            GCancellable *cancellable,
+                            GAsyncReadyCallback callback,
+                            void *user_data);
+
+LibWCRelayMessage * libwc_relay_test(LibWCRelay *relay,
+                                     GCancellable *cancellable,
+                                     GError **error);
+
+gboolean libwc_relay_input(LibWCRelay *relay,
+                           const gchar *buffer,
+                           const gchar *data,
+                           GError **error);
+
+gboolean libwc_relay_sync(LibWCRelay *relay,
+                          const gchar *buffers,
+                          const gchar *options,
+                          GError **error);
+
+gboolean libwc_relay_desync(LibWCRelay *relay,
+                            const gchar *buffers,
+                            const gchar *options,
+                            GError **error);
+
+void libwc_relay_quit(LibWCRelay *relay);
+
+void libwc_relay_subscribe(LibWCRelay *relay,
+                           const gchar *buffer,
+                           LibWCSyncFlags flags);
+
+void libwc_relay_unsubscribe(LibWCRelay *relay,
+                             const gchar *buffer,
+                             LibWCSyncFlags flags);
+
+LibWCSyncFlags libwc_relay_subscription_get(LibWCRelay *relay,
+                                            const gchar *buffer);
+
 #endif /* !RELAY_H */
@@ -0,0 +1,70 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <glib.h>
+#include <stdatomic.h>
+
+/* The layout of the shared memory ring events get published into, see
+ * relay-shm.c. The ring lives in a memfd: one page holding LibWCShmHeader,
+ * followed by capacity bytes of records. Each record is a
+ * LibWCShmRecordHeader followed by the record's data, padded out to
+ * LIBWC_SHM_ALIGN. A record that would run past the end of the ring is
+ * preceded by a padding record that fills up the rest of it instead.
+ *
+ * head and tail are byte offsets that only ever go up, so they need to be
+ * masked by capacity - 1 to get a position in the ring. Everything from tail
+ * up to head holds complete records. The publisher moves tail forward before
+ * it overwrites anything, so a subscriber whose cursor is still past tail
+ * after reading a record knows it read it whole */
+#define LIBWC_SHM_MAGIC   "LWCSHM\0\0"
+#define LIBWC_SHM_VERSION (1)
+
+#define LIBWC_SHM_ALIGN        ((guint64)16)
+#define LIBWC_SHM_PAD_LENGTH   (G_MAXUINT32)
+#define LIBWC_SHM_MIN_CAPACITY ((gsize)65536)
+
+#define LIBWC_SHM_RECORD_SIZE(length_) \
+    (((sizeof(LibWCShmRecordHeader) + (length_)) + LIBWC_SHM_ALIGN - 1) & \
+     ~(LIBWC_SHM_ALIGN - 1))
+
+typedef struct {
+    gchar magic[8];
+    guint32 version;
+    /* Where the records start, from the start of the memfd */
+    guint32 data_offset;
+    guint64 capacity;
+
+    _Atomic guint64 head;
+    _Atomic guint64 tail;
+
+    /* Bumped after every record, subscribers sleep on it with a futex.
+     * waiters is the only thing subscribers ever write to */
+    _Atomic guint32 seq;
+    _Atomic guint32 waiters;
+    _Atomic guint32 closed;
+} LibWCShmHeader;
+
+typedef struct {
+    guint32 length;
+    guint32 reserved;
+    /* Counts up by one for every record, so subscribers can tell how many
+     * they missed if the publisher lapped them */
+    guint64 sequence;
+} LibWCShmRecordHeader;
+
+G_STATIC_ASSERT(sizeof(LibWCShmRecordHeader) == LIBWC_SHM_ALIGN);
+
+#endif /* !SHM_RING_H */
@@ -0,0 +1,243 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "libweechat.h"
+#include "shm-ring.h"
+#include "shm-subscriber.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/* Reads events out of a ring published with libwc_relay_shm_publish_start(),
+ * see shm-ring.h for how it's laid out. Records are handed out in place, with
+ * no copying, which means they can get overwritten while they're being read if
+ * the publisher laps us. libwc_shm_subscriber_release() says whether that
+ * happened. A subscriber is meant to be used from one thread at a time */
+
+struct _LibWCShmSubscriber {
+    guint8 *map;
+    gsize map_size;
+
+    LibWCShmHeader *header;
+    const guint8 *data;
+    guint64 capacity;
+    guint64 mask;
+
+    guint64 cursor;
+    /* The size of the record handed out by libwc_shm_subscriber_next() that
+     * hasn't been released yet, 0 if there isn't one */
+    guint64 held_size;
+    guint64 held_sequence;
+
+    gboolean have_sequence;
+    guint64 next_sequence;
+    guint64 lost;
+};
+
+/* Opens the ring behind fd, and starts following it from whatever record gets
+ * published next. fd isn't needed after this returns */
+LibWCShmSubscriber *
+libwc_shm_subscriber_new(gint fd,
+                         GError **error) {
+    LibWCShmSubscriber *subscriber;
+    LibWCShmHeader header;
+    gsize page_size = sysconf(_SC_PAGESIZE);
+    struct stat stat_buf;
+    guint8 *map;
+
+    if (fstat(fd, &stat_buf) < 0 ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        gint saved_errno = errno;
+
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Couldn't read shared memory ring: %s",
+                    g_strerror(saved_errno));
+        return NULL;
+    }
+
+    if (memcmp(header.magic, LIBWC_SHM_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != LIBWC_SHM_VERSION ||
+        header.data_offset != page_size ||
+        header.capacity < LIBWC_SHM_MIN_CAPACITY ||
+        (header.capacity & (header.capacity - 1)) != 0 ||
+        (guint64)stat_buf.st_size < header.data_offset + header.capacity) {
+        g_set_error(error, LIBWC_ERROR_RELAY, LIBWC_ERROR_RELAY_INVALID_DATA,
+                    "Not a libweechat shared memory ring");
+        return NULL;
+    }
+
+    /* The records are read only, but we need to be able to write to the
+     * header to let the publisher know when we're waiting */
+    map = mmap(NULL, header.data_offset + header.capacity, PROT_READ,
+               MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED ||
+        mprotect(map, header.data_offset, PROT_READ | PROT_WRITE) < 0) {
+        gint saved_errno = errno;
+
+        if (map != MAP_FAILED)
+            munmap(map, header.data_offset + header.capacity);
+
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                    "Couldn't map shared memory ring: %s",
+                    g_strerror(saved_errno));
+        return NULL;
+    }
+
+    subscriber = g_new0(LibWCShmSubscriber, 1);
+    subscriber->map = map;
+    subscriber->map_size = header.data_offset + header.capacity;
+    subscriber->header = (LibWCShmHeader*)map;
+    subscriber->data = map + header.data_offset;
+    subscriber->capacity = header.capacity;
+    subscriber->mask = header.capacity - 1;
+    subscriber->cursor = atomic_load_explicit(&subscriber->header->head,
+                                              memory_order_acquire);
+
+    return subscriber;
+}
+
+void
+libwc_shm_subscriber_free(LibWCShmSubscriber *subscriber) {
+    munmap(subscriber->map, subscriber->map_size);
+    g_free(subscriber);
+}
+
+/* Returns the next record in the ring as a LIBWC_SHM_RECORD_VARIANT_TYPE, or
+ * NULL if there isn't one yet. The record points straight into the ring: it
+ * has to be unreffed, and everything taken out of it either copied or thrown
+ * away, before calling libwc_shm_subscriber_release() */
+GVariant *
+libwc_shm_subscriber_next(LibWCShmSubscriber *subscriber) {
+    LibWCShmHeader *header = subscriber->header;
+    const LibWCShmRecordHeader *record;
+    guint64 head, tail, pos, size;
+    guint32 length;
+
+    g_return_val_if_fail(subscriber->held_size == 0, NULL);
+
+    for (;;) {
+        head = atomic_load_explicit(&header->head, memory_order_acquire);
+        if (subscriber->cursor == head)
+            return NULL;
+
+        tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+        if (subscriber->cursor < tail)
+            subscriber->cursor = tail;
+
+        pos = subscriber->cursor & subscriber->mask;
+        record = (const LibWCShmRecordHeader*)(subscriber->data + pos);
+        length = ((volatile const LibWCShmRecordHeader*)record)->length;
+
+        if (length == LIBWC_SHM_PAD_LENGTH) {
+            subscriber->cursor += subscriber->capacity - pos;
+            continue;
+        }
+
+        /* The record is being overwritten as we read it, the next time around
+         * tail will have moved past it */
+        size = LIBWC_SHM_RECORD_SIZE((guint64)length);
+        if (size > subscriber->capacity - pos)
+            continue;
+
+        subscriber->held_size = size;
+        subscriber->held_sequence =
+            ((volatile const LibWCShmRecordHeader*)record)->sequence;
+
+        return g_variant_new_from_data(LIBWC_SHM_RECORD_VARIANT_TYPE,
+                                       record + 1, length, FALSE, NULL, NULL);
+    }
+}
+
+/* Moves on past the record returned by libwc_shm_subscriber_next(). Returns
+ * FALSE if the publisher started overwriting the record before we got here,
+ * in which case anything read out of it can't be trusted */
+gboolean
+libwc_shm_subscriber_release(LibWCShmSubscriber *subscriber) {
+    guint64 tail;
+
+    g_return_val_if_fail(subscriber->held_size != 0, FALSE);
+
+    atomic_thread_fence(memory_order_acquire);
+    tail = atomic_load_explicit(&subscriber->header->tail,
+                                memory_order_relaxed);
+
+    if (subscriber->cursor < tail) {
+        subscriber->held_size = 0;
+        return FALSE;
+    }
+
+    if (subscriber->have_sequence &&
+        subscriber->held_sequence > subscriber->next_sequence)
+        subscriber->lost +=
+            subscriber->held_sequence - subscriber->next_sequence;
+
+    subscriber->have_sequence = TRUE;
+    subscriber->next_sequence = subscriber->held_sequence + 1;
+
+    subscriber->cursor += subscriber->held_size;
+    subscriber->held_size = 0;
+
+    return TRUE;
+}
+
+/* Sleeps until there's a record to read, the publisher goes away, or timeout
+ * milliseconds pass. A negative timeout waits forever. Returns whether there's
+ * a record to read */
+gboolean
+libwc_shm_subscriber_wait(LibWCShmSubscriber *subscriber,
+                          gint timeout) {
+    LibWCShmHeader *header = subscriber->header;
+    struct timespec timeout_spec = {
+        .tv_sec = timeout / 1000,
+        .tv_nsec = (timeout % 1000) * 1000000
+    };
+    guint32 seq;
+
+    for (;;) {
+        seq = atomic_load(&header->seq);
+
+        if (atomic_load(&header->head) != subscriber->cursor)
+            return TRUE;
+        if (atomic_load(&header->closed) || timeout == 0)
+            return FALSE;
+
+        atomic_fetch_add(&header->waiters, 1);
+        if (atomic_load(&header->head) == subscriber->cursor &&
+            syscall(SYS_futex, &header->seq, FUTEX_WAIT, seq,
+                    timeout < 0 ? NULL : &timeout_spec, NULL, 0) < 0 &&
+            errno == ETIMEDOUT)
+            timeout = 0;
+        atomic_fetch_sub(&header->waiters, 1);
+    }
+}
+
+/* How many records were overwritten before we got to read them, or were too
+ * big to be published at all */
+guint64
+libwc_shm_subscriber_get_lost(LibWCShmSubscriber *subscriber) {
+    return subscriber->lost;
+}
+
+/* Whether the publisher has stopped publishing to the ring. Records that were
+ * already published can still be read */
+gboolean
+libwc_shm_subscriber_is_closed(LibWCShmSubscriber *subscriber) {
+    return atomic_load(&subscriber->header->closed);
+}
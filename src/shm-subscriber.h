@@ -0,0 +1,46 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef SHM_SUBSCRIBER_H
+#define SHM_SUBSCRIBER_H
+
+#include <glib.h>
+
+/* Every record in a ring started with libwc_relay_shm_publish_start() is one
+ * event: the event's LibWCEventIdentifier, followed by each of its objects as
+ * its LibWCRelayObjectType and value */
+#define LIBWC_SHM_RECORD_VARIANT_TYPE_STR "(ia(uv))"
+#define LIBWC_SHM_RECORD_VARIANT_TYPE \
+    (G_VARIANT_TYPE(LIBWC_SHM_RECORD_VARIANT_TYPE_STR))
+
+typedef struct _LibWCShmSubscriber LibWCShmSubscriber;
+
+LibWCShmSubscriber * libwc_shm_subscriber_new(gint fd,
+                                              GError **error)
+G_GNUC_WARN_UNUSED_RESULT G_GNUC_MALLOC;
+
+void libwc_shm_subscriber_free(LibWCShmSubscriber *subscriber);
+
+GVariant * libwc_shm_subscriber_next(LibWCShmSubscriber *subscriber)
+G_GNUC_WARN_UNUSED_RESULT;
+
+gboolean libwc_shm_subscriber_release(LibWCShmSubscriber *subscriber);
+
+gboolean libwc_shm_subscriber_wait(LibWCShmSubscriber *subscriber,
+                                   gint timeout);
+
+guint64 libwc_shm_subscriber_get_lost(LibWCShmSubscriber *subscriber);
+
+gboolean libwc_shm_subscriber_is_closed(LibWCShmSubscriber *subscriber);
+
+#endif /* !SHM_SUBSCRIBER_H */
@@ -0,0 +1,148 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+/* For O_TMPFILE and memfd_create() */
+#define _GNU_SOURCE
+
+#include "spill-file.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+struct _LibWCSpillFile {
+    gint fd;
+    gsize size;
+};
+
+typedef struct {
+    void *map;
+    gsize size;
+} LibWCSpillMapping;
+
+static void
+spill_set_error(GError **error,
+                const gchar *action) {
+    gint saved_errno = errno;
+
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(saved_errno),
+                "Couldn't %s spill file: %s", action,
+                g_strerror(saved_errno));
+}
+
+LibWCSpillFile *
+_libwc_spill_file_new(GError **error) {
+    LibWCSpillFile *spill;
+    gint fd;
+
+    fd = open(g_get_tmp_dir(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0)
+        fd = memfd_create("libweechat-spill", MFD_CLOEXEC);
+
+    if (fd < 0) {
+        spill_set_error(error, "create");
+        return NULL;
+    }
+
+    spill = g_new0(LibWCSpillFile, 1);
+    spill->fd = fd;
+
+    return spill;
+}
+
+gboolean
+_libwc_spill_file_append(LibWCSpillFile *spill,
+                         const void *data,
+                         gsize size,
+                         GError **error) {
+    const guint8 *pos = data;
+    gssize written;
+
+    while (size) {
+        written = write(spill->fd, pos, size);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            spill_set_error(error, "write to");
+            return FALSE;
+        }
+
+        pos += written;
+        size -= written;
+        spill->size += written;
+    }
+
+    return TRUE;
+}
+
+gsize
+_libwc_spill_file_get_size(LibWCSpillFile *spill) {
+    return spill->size;
+}
+
+/* The file still belongs to spill, and everything that was appended is at
+ * the start of it */
+gint
+_libwc_spill_file_get_fd(LibWCSpillFile *spill) {
+    return spill->fd;
+}
+
+static void
+spill_mapping_free(LibWCSpillMapping *mapping) {
+    munmap(mapping->map, mapping->size);
+    g_free(mapping);
+}
+
+/* Maps everything that was appended and frees the spill file, even if mapping
+ * it fails. The mapping is private, so anything that writes to it gets its own
+ * copy of the pages it touches */
+GBytes *
+_libwc_spill_file_finish(LibWCSpillFile *spill,
+                         GError **error) {
+    LibWCSpillMapping *mapping;
+    void *map;
+    gsize size = spill->size;
+
+    if (!size) {
+        _libwc_spill_file_free(spill);
+        return g_bytes_new(NULL, 0);
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, spill->fd, 0);
+    if (map == MAP_FAILED) {
+        spill_set_error(error, "map");
+        _libwc_spill_file_free(spill);
+        return NULL;
+    }
+
+    /* The mapping keeps the file around on its own */
+    _libwc_spill_file_free(spill);
+
+    mapping = g_new(LibWCSpillMapping, 1);
+    mapping->map = map;
+    mapping->size = size;
+
+    return g_bytes_new_with_free_func(map, size,
+                                      (GDestroyNotify)spill_mapping_free,
+                                      mapping);
+}
+
+void
+_libwc_spill_file_free(LibWCSpillFile *spill) {
+    close(spill->fd);
+    g_free(spill);
+}
@@ -0,0 +1,50 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef SPILL_FILE_H
+#define SPILL_FILE_H
+
+#include <glib.h>
+
+/* Somewhere to put data too big to keep on the heap. Data gets appended to an
+ * unlinked temporary file, and once it's all there the file gets mapped and
+ * handed back as a GBytes. The pages behind it belong to the file, so the
+ * kernel can write them back and drop them whenever it needs the memory. If
+ * the temporary directory doesn't support unnamed files, a memfd is used
+ * instead */
+
+typedef struct _LibWCSpillFile LibWCSpillFile;
+
+LibWCSpillFile * _libwc_spill_file_new(GError **error)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+gboolean _libwc_spill_file_append(LibWCSpillFile *spill,
+                                  const void *data,
+                                  gsize size,
+                                  GError **error)
+G_GNUC_INTERNAL;
+
+gsize _libwc_spill_file_get_size(LibWCSpillFile *spill)
+G_GNUC_INTERNAL;
+
+gint _libwc_spill_file_get_fd(LibWCSpillFile *spill)
+G_GNUC_INTERNAL;
+
+GBytes * _libwc_spill_file_finish(LibWCSpillFile *spill,
+                                  GError **error)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+void _libwc_spill_file_free(LibWCSpillFile *spill)
+G_GNUC_INTERNAL;
+
+#endif /* !SPILL_FILE_H */
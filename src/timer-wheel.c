@@ -0,0 +1,226 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "timer-wheel.h"
+
+#include <glib.h>
+
+#define SLOT_MASK   ((guint64)LIBWC_TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level_) ((level_) * LIBWC_TIMER_WHEEL_BITS)
+
+/* The furthest out we can place a timer without it wrapping all the way around
+ * the top level */
+#define MAX_DELTA \
+    (((guint64)1 << LEVEL_SHIFT(LIBWC_TIMER_WHEEL_LEVELS)) - 1)
+
+static inline void
+list_init(LibWCTimer *head) {
+    head->prev = head->next = head;
+}
+
+static inline gboolean
+list_is_empty(const LibWCTimer *head) {
+    return head->next == head;
+}
+
+static inline void
+list_append(LibWCTimer *head,
+            LibWCTimer *timer) {
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static inline void
+list_unlink(LibWCTimer *timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+/* Moves every timer in src onto the end of dest, leaving src empty */
+static inline void
+list_splice(LibWCTimer *dest,
+            LibWCTimer *src) {
+    if (list_is_empty(src))
+        return;
+
+    src->next->prev = dest->prev;
+    src->prev->next = dest;
+    dest->prev->next = src->next;
+    dest->prev = src->prev;
+
+    list_init(src);
+}
+
+/* Puts a timer into the lowest level where it shares every bit above that
+ * level with the current tick. That way the slot it goes into is guaranteed
+ * to come around exactly once before it expires. Timers that are already due
+ * get put in the slot for earliest_tick */
+static void
+place_timer(LibWCTimerWheel *wheel,
+            LibWCTimer *timer,
+            guint64 earliest_tick) {
+    guint64 expires = timer->expires;
+    guint level;
+
+    if (expires < earliest_tick)
+        expires = earliest_tick;
+    else if (expires - wheel->current_tick > MAX_DELTA)
+        expires = wheel->current_tick + MAX_DELTA;
+
+    for (level = 0; level < LIBWC_TIMER_WHEEL_LEVELS - 1; level++) {
+        if (((expires ^ wheel->current_tick) >> LEVEL_SHIFT(level + 1)) == 0)
+            break;
+    }
+
+    list_append(&wheel->slots[level][(expires >> LEVEL_SHIFT(level)) &
+                                     SLOT_MASK],
+                timer);
+}
+
+void
+_libwc_timer_wheel_init(LibWCTimerWheel *wheel,
+                        guint64 current_tick,
+                        LibWCTimerFunc func,
+                        void *user_data) {
+    for (int i = 0; i < LIBWC_TIMER_WHEEL_LEVELS; i++) {
+        for (int j = 0; j < LIBWC_TIMER_WHEEL_SLOTS; j++)
+            list_init(&wheel->slots[i][j]);
+    }
+
+    wheel->current_tick = current_tick;
+    wheel->count = 0;
+    wheel->func = func;
+    wheel->user_data = user_data;
+}
+
+/* now is only used when the wheel is empty. Nothing needs to be processed
+ * between the last tick we saw and now in that case, so we jump straight to it
+ * instead of making the next advance walk over every tick we sat idle for */
+void
+_libwc_timer_wheel_add(LibWCTimerWheel *wheel,
+                       LibWCTimer *timer,
+                       guint64 now,
+                       guint64 expires) {
+    if (_libwc_timer_is_armed(timer))
+        _libwc_timer_wheel_remove(wheel, timer);
+
+    if (!wheel->count && now > wheel->current_tick)
+        wheel->current_tick = now;
+
+    timer->expires = expires;
+    place_timer(wheel, timer, wheel->current_tick + 1);
+    wheel->count++;
+}
+
+void
+_libwc_timer_wheel_remove(LibWCTimerWheel *wheel,
+                          LibWCTimer *timer) {
+    if (!_libwc_timer_is_armed(timer))
+        return;
+
+    list_unlink(timer);
+    wheel->count--;
+}
+
+static void
+cascade(LibWCTimerWheel *wheel,
+        guint level) {
+    LibWCTimer pending;
+
+    list_init(&pending);
+    list_splice(&pending,
+                &wheel->slots[level][(wheel->current_tick >>
+                                      LEVEL_SHIFT(level)) & SLOT_MASK]);
+
+    while (!list_is_empty(&pending)) {
+        LibWCTimer *timer = pending.next;
+
+        list_unlink(timer);
+
+        /* The current tick hasn't been processed yet, so timers that are due
+         * right now can still go in its slot */
+        place_timer(wheel, timer, wheel->current_tick);
+    }
+}
+
+static void
+process_tick(LibWCTimerWheel *wheel) {
+    LibWCTimer expired;
+
+    /* Cascade from the top down, since timers coming out of a higher level
+     * can land in the slot of the level below that we're about to cascade */
+    for (guint level = LIBWC_TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+        if ((wheel->current_tick &
+             (((guint64)1 << LEVEL_SHIFT(level)) - 1)) == 0)
+            cascade(wheel, level);
+    }
+
+    list_init(&expired);
+    list_splice(&expired, &wheel->slots[0][wheel->current_tick & SLOT_MASK]);
+
+    /* Timers are unlinked before their callbacks run, so it's safe for a
+     * callback to remove or re-add any timer, including its own */
+    while (!list_is_empty(&expired)) {
+        LibWCTimer *timer = expired.next;
+
+        list_unlink(timer);
+        wheel->count--;
+
+        /* Timers that were clamped to the edge of the wheel still have time
+         * left on them */
+        if (timer->expires > wheel->current_tick) {
+            place_timer(wheel, timer, wheel->current_tick + 1);
+            wheel->count++;
+            continue;
+        }
+
+        wheel->func(timer, wheel->user_data);
+    }
+}
+
+void
+_libwc_timer_wheel_advance(LibWCTimerWheel *wheel,
+                           guint64 now) {
+    while (wheel->current_tick < now) {
+        guint64 next = _libwc_timer_wheel_next_tick(wheel);
+
+        if (next > now) {
+            wheel->current_tick = now;
+            break;
+        }
+
+        wheel->current_tick = next;
+        process_tick(wheel);
+    }
+}
+
+/* Returns the next tick where anything could happen, either because a timer is
+ * expiring or because we need to cascade timers down from a higher level. If
+ * there's nothing in the wheel, returns G_MAXUINT64 */
+guint64
+_libwc_timer_wheel_next_tick(LibWCTimerWheel *wheel) {
+    guint64 tick;
+
+    if (!wheel->count)
+        return G_MAXUINT64;
+
+    for (tick = wheel->current_tick + 1; tick & SLOT_MASK; tick++) {
+        if (!list_is_empty(&wheel->slots[0][tick & SLOT_MASK]))
+            return tick;
+    }
+
+    return tick;
+}
@@ -0,0 +1,82 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <glib.h>
+
+/* A hierarchical timer wheel. Adding, removing and expiring a timer are all
+ * O(1), no matter how many timers are pending. Each level has
+ * LIBWC_TIMER_WHEEL_SLOTS slots, and each slot on a level spans all of the
+ * slots on the level below it. Timers are cascaded down a level whenever the
+ * wheel below them wraps around.
+ *
+ * Time is measured in ticks, it's up to the user of the wheel to decide how
+ * long a tick is. Timers are intrusive, so they can be embedded in whatever
+ * they're timing. */
+
+#define LIBWC_TIMER_WHEEL_BITS   6
+#define LIBWC_TIMER_WHEEL_SLOTS  (1 << LIBWC_TIMER_WHEEL_BITS)
+#define LIBWC_TIMER_WHEEL_LEVELS 4
+
+typedef struct _LibWCTimer      LibWCTimer;
+typedef struct _LibWCTimerWheel LibWCTimerWheel;
+
+typedef void (*LibWCTimerFunc)(LibWCTimer *timer,
+                               void *user_data);
+
+struct _LibWCTimer {
+    LibWCTimer *prev,
+               *next;
+    guint64 expires;
+};
+
+struct _LibWCTimerWheel {
+    LibWCTimer slots[LIBWC_TIMER_WHEEL_LEVELS][LIBWC_TIMER_WHEEL_SLOTS];
+    guint64 current_tick;
+    guint count;
+
+    LibWCTimerFunc func;
+    void *user_data;
+};
+
+void _libwc_timer_wheel_init(LibWCTimerWheel *wheel,
+                             guint64 current_tick,
+                             LibWCTimerFunc func,
+                             void *user_data)
+G_GNUC_INTERNAL;
+
+void _libwc_timer_wheel_add(LibWCTimerWheel *wheel,
+                            LibWCTimer *timer,
+                            guint64 now,
+                            guint64 expires)
+G_GNUC_INTERNAL;
+
+void _libwc_timer_wheel_remove(LibWCTimerWheel *wheel,
+                               LibWCTimer *timer)
+G_GNUC_INTERNAL;
+
+void _libwc_timer_wheel_advance(LibWCTimerWheel *wheel,
+                                guint64 now)
+G_GNUC_INTERNAL;
+
+guint64 _libwc_timer_wheel_next_tick(LibWCTimerWheel *wheel)
+G_GNUC_INTERNAL G_GNUC_PURE;
+
+static inline gboolean
+_libwc_timer_is_armed(const LibWCTimer *timer) {
+    return timer->next != NULL;
+}
+
+#endif /* !TIMER_WHEEL_H */
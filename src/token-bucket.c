@@ -0,0 +1,152 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "token-bucket.h"
+
+#include <glib.h>
+
+#define TOKEN_SCALE G_GINT64_CONSTANT(1000000)
+
+/* Anything bigger would overflow once it's scaled */
+#define TOKEN_MAX (G_MAXINT64 / TOKEN_SCALE / 2)
+
+void
+_libwc_rate_limit_init(LibWCRateLimit *limit) {
+    *limit = (LibWCRateLimit) { 0 };
+    g_mutex_init(&limit->mutex);
+}
+
+void
+_libwc_rate_limit_clear(LibWCRateLimit *limit) {
+    g_mutex_clear(&limit->mutex);
+}
+
+static void
+token_bucket_set(LibWCTokenBucket *bucket,
+                 gint64 rate,
+                 gint64 burst,
+                 gint64 now) {
+    bucket->rate = MIN(rate, TOKEN_MAX);
+
+    /* Without a burst size, allow a second's worth */
+    bucket->burst = MIN(burst ? burst : rate, TOKEN_MAX);
+    bucket->burst = MAX(bucket->burst, 1);
+
+    /* Start out full, so the limit only kicks in once we're actually busy */
+    bucket->level = bucket->burst * TOKEN_SCALE;
+    bucket->last_refill = now;
+}
+
+static void
+token_bucket_refill(LibWCTokenBucket *bucket,
+                    gint64 now) {
+    gint64 capacity = bucket->burst * TOKEN_SCALE,
+           elapsed = now - bucket->last_refill;
+
+    if (elapsed <= 0)
+        return;
+
+    bucket->last_refill = now;
+
+    /* Compare before multiplying, after a long enough idle period the product
+     * wouldn't fit */
+    if (elapsed >= (capacity - bucket->level) / bucket->rate)
+        bucket->level = capacity;
+    else
+        bucket->level += elapsed * bucket->rate;
+}
+
+/* How long until amount can be taken out of the bucket, in microseconds */
+static gint64
+token_bucket_wait_time(LibWCTokenBucket *bucket,
+                       gint64 amount) {
+    gint64 needed = MIN(amount, bucket->burst) * TOKEN_SCALE;
+
+    if (bucket->level >= needed)
+        return 0;
+
+    return (needed - bucket->level + bucket->rate - 1) / bucket->rate;
+}
+
+/* Sets the limits, a rate of 0 turns that half of the limit off. A burst of 0
+ * means a second's worth at the given rate */
+void
+_libwc_rate_limit_set(LibWCRateLimit *limit,
+                      guint command_rate,
+                      guint command_burst,
+                      gsize byte_rate,
+                      gsize byte_burst) {
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&limit->mutex);
+
+    token_bucket_set(&limit->commands, command_rate, command_burst, now);
+    token_bucket_set(&limit->bytes, MIN(byte_rate, TOKEN_MAX),
+                     MIN(byte_burst, TOKEN_MAX), now);
+    g_atomic_int_set(&limit->enabled, command_rate || byte_rate);
+
+    g_mutex_unlock(&limit->mutex);
+}
+
+/* Checks whether a command of size bytes can go out now under all of the given
+ * limits. If it can, it's charged against all of them and 0 is returned.
+ * Otherwise nothing gets charged, and the number of microseconds until it can
+ * go out is returned instead. Limits always have to be passed in the same
+ * order, since they're locked in that order */
+gint64
+_libwc_rate_limit_admit(LibWCRateLimit **limits,
+                        guint n_limits,
+                        gsize size,
+                        gint64 now) {
+    LibWCRateLimit *limit;
+    gint64 wait = 0;
+    guint locked = 0;
+
+    for (guint i = 0; i < n_limits; i++) {
+        limit = limits[i];
+        if (!g_atomic_int_get(&limit->enabled))
+            continue;
+
+        g_mutex_lock(&limit->mutex);
+        locked |= 1 << i;
+
+        if (limit->commands.rate) {
+            token_bucket_refill(&limit->commands, now);
+            wait = MAX(wait, token_bucket_wait_time(&limit->commands, 1));
+        }
+
+        if (limit->bytes.rate) {
+            token_bucket_refill(&limit->bytes, now);
+            wait = MAX(wait, token_bucket_wait_time(&limit->bytes,
+                                                    MIN(size, TOKEN_MAX)));
+        }
+    }
+
+    for (guint i = 0; i < n_limits; i++) {
+        if (!(locked & (1 << i)))
+            continue;
+
+        limit = limits[i];
+
+        if (!wait) {
+            if (limit->commands.rate)
+                limit->commands.level -= TOKEN_SCALE;
+            if (limit->bytes.rate)
+                limit->bytes.level -= MIN(size, TOKEN_MAX) * TOKEN_SCALE;
+        }
+
+        g_mutex_unlock(&limit->mutex);
+    }
+
+    return wait;
+}
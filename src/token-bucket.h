@@ -0,0 +1,65 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef TOKEN_BUCKET_H
+#define TOKEN_BUCKET_H
+
+#include <glib.h>
+
+/* Token buckets for shaping what we send to the relay. A bucket fills up at
+ * rate tokens per second, up to burst tokens, and sending something takes
+ * tokens out of it. Something bigger than the whole bucket can still go out
+ * once the bucket is full, it just leaves the bucket in debt afterwards.
+ *
+ * A rate limit is a pair of buckets, one counting commands and one counting
+ * bytes, and can be shared between threads */
+
+typedef struct {
+    /* Tokens per second, 0 means there's no limit */
+    gint64 rate;
+    gint64 burst;
+
+    /* In millionths of a token, so that refilling it every microsecond never
+     * has to round anything off. Goes negative when in debt */
+    gint64 level;
+    gint64 last_refill;
+} LibWCTokenBucket;
+
+typedef struct {
+    GMutex mutex;
+    gint enabled;
+
+    LibWCTokenBucket commands;
+    LibWCTokenBucket bytes;
+} LibWCRateLimit;
+
+void _libwc_rate_limit_init(LibWCRateLimit *limit)
+G_GNUC_INTERNAL;
+
+void _libwc_rate_limit_clear(LibWCRateLimit *limit)
+G_GNUC_INTERNAL;
+
+void _libwc_rate_limit_set(LibWCRateLimit *limit,
+                           guint command_rate,
+                           guint command_burst,
+                           gsize byte_rate,
+                           gsize byte_burst)
+G_GNUC_INTERNAL;
+
+gint64 _libwc_rate_limit_admit(LibWCRateLimit **limits,
+                               guint n_limits,
+                               gsize size,
+                               gint64 now)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+#endif /* !TOKEN_BUCKET_H */
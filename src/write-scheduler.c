@@ -0,0 +1,151 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "write-scheduler.h"
+
+#include <glib.h>
+
+/* How many quanta each lane gets per round. Interactive commands are things
+ * the user is sitting there waiting on, while bulk commands tend to come in
+ * huge batches that nobody is watching go out */
+static const gsize lane_weights[LIBWC_COMMAND_PRIORITY_COUNT] = {
+    [LIBWC_COMMAND_PRIORITY_INTERACTIVE] = 16,
+    [LIBWC_COMMAND_PRIORITY_CONTROL]     = 4,
+    [LIBWC_COMMAND_PRIORITY_BULK]        = 1
+};
+
+void
+_libwc_write_scheduler_init(LibWCWriteScheduler *scheduler) {
+    *scheduler = (LibWCWriteScheduler) { 0 };
+
+    g_queue_init(&scheduler->resume);
+    for (guint i = 0; i < LIBWC_COMMAND_PRIORITY_COUNT; i++)
+        g_queue_init(&scheduler->lanes[i]);
+}
+
+void
+_libwc_write_scheduler_push(LibWCWriteScheduler *scheduler,
+                            LibWCQueuedWrite *queued_write) {
+    g_queue_push_tail(&scheduler->lanes[queued_write->priority],
+                      queued_write);
+    scheduler->length++;
+}
+
+/* For writes that need to go out before anything else in their lane, but
+ * haven't been sent at all yet */
+void
+_libwc_write_scheduler_push_head(LibWCWriteScheduler *scheduler,
+                                 LibWCQueuedWrite *queued_write) {
+    g_queue_push_head(&scheduler->lanes[queued_write->priority],
+                      queued_write);
+    scheduler->length++;
+}
+
+/* For writes that were already handed to the socket and need to be sent again,
+ * either because only part of them made it onto the wire or because something
+ * before them didn't. Has to be called in the order they were first sent */
+void
+_libwc_write_scheduler_push_resume(LibWCWriteScheduler *scheduler,
+                                   LibWCQueuedWrite *queued_write) {
+    g_queue_push_tail(&scheduler->resume, queued_write);
+    scheduler->length++;
+}
+
+static inline void
+next_lane(LibWCWriteScheduler *scheduler) {
+    scheduler->current_lane =
+        (scheduler->current_lane + 1) % LIBWC_COMMAND_PRIORITY_COUNT;
+    scheduler->current_lane_topped_up = FALSE;
+}
+
+/* Picks whichever write goes out next, without taking it off the queue. Until
+ * something else gets pushed, popping returns the same write */
+LibWCQueuedWrite *
+_libwc_write_scheduler_peek(LibWCWriteScheduler *scheduler) {
+    LibWCQueuedWrite *queued_write;
+    GQueue *lane;
+    gsize *deficit;
+
+    if (scheduler->length == 0)
+        return NULL;
+
+    /* Resumed writes don't count against any lane's share, they already got
+     * charged for the first time around */
+    if (!g_queue_is_empty(&scheduler->resume))
+        return g_queue_peek_head(&scheduler->resume);
+
+    while (TRUE) {
+        lane = &scheduler->lanes[scheduler->current_lane];
+        deficit = &scheduler->deficits[scheduler->current_lane];
+
+        /* Idle lanes don't get to save up their turns */
+        if (g_queue_is_empty(lane)) {
+            *deficit = 0;
+            next_lane(scheduler);
+            continue;
+        }
+
+        if (!scheduler->current_lane_topped_up) {
+            *deficit += lane_weights[scheduler->current_lane] *
+                        LIBWC_WRITE_SCHEDULER_QUANTUM;
+            scheduler->current_lane_topped_up = TRUE;
+        }
+
+        queued_write = g_queue_peek_head(lane);
+        if (queued_write->size > *deficit) {
+            next_lane(scheduler);
+            continue;
+        }
+
+        return queued_write;
+    }
+}
+
+LibWCQueuedWrite *
+_libwc_write_scheduler_pop(LibWCWriteScheduler *scheduler) {
+    LibWCQueuedWrite *queued_write;
+    GQueue *lane;
+    gsize *deficit;
+
+    queued_write = _libwc_write_scheduler_peek(scheduler);
+    if (!queued_write)
+        return NULL;
+
+    if (!g_queue_is_empty(&scheduler->resume))
+        return _libwc_write_scheduler_pop_resume(scheduler);
+
+    lane = &scheduler->lanes[scheduler->current_lane];
+    deficit = &scheduler->deficits[scheduler->current_lane];
+
+    g_queue_pop_head(lane);
+    scheduler->length--;
+    *deficit -= queued_write->size;
+
+    if (g_queue_is_empty(lane)) {
+        *deficit = 0;
+        next_lane(scheduler);
+    }
+
+    return queued_write;
+}
+
+/* Only takes writes off the resume queue, returns NULL once it's empty */
+LibWCQueuedWrite *
+_libwc_write_scheduler_pop_resume(LibWCWriteScheduler *scheduler) {
+    LibWCQueuedWrite *queued_write = g_queue_pop_head(&scheduler->resume);
+
+    if (queued_write)
+        scheduler->length--;
+
+    return queued_write;
+}
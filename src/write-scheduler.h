@@ -0,0 +1,79 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#ifndef WRITE_SCHEDULER_H
+#define WRITE_SCHEDULER_H
+
+#include "relay-connection.h"
+
+#include <glib.h>
+
+/* Holds the commands that are ready to go out on the wire, one queue for each
+ * priority lane. Lanes are served with deficit round robin: every time a lane
+ * gets its turn it's allowed to send another quantum's worth of bytes, and its
+ * quantum is its weight times LIBWC_WRITE_SCHEDULER_QUANTUM. Commands are
+ * never split, so a lane that's sent its share only gives up the wire once the
+ * command it's on is done.
+ *
+ * Writes that were already handed to the socket but didn't go out completely
+ * are put in the resume queue instead of their lanes. It's always drained
+ * first, in the order the writes were originally sent, so nothing else can end
+ * up on the wire in the middle of them.
+ *
+ * Only ever touched from the relay's reactor thread */
+
+#define LIBWC_WRITE_SCHEDULER_QUANTUM ((gsize)4096)
+
+typedef struct _LibWCWriteScheduler LibWCWriteScheduler;
+
+struct _LibWCWriteScheduler {
+    GQueue resume;
+    GQueue lanes[LIBWC_COMMAND_PRIORITY_COUNT];
+    gsize deficits[LIBWC_COMMAND_PRIORITY_COUNT];
+
+    guint current_lane;
+    gboolean current_lane_topped_up;
+    guint length;
+};
+
+void _libwc_write_scheduler_init(LibWCWriteScheduler *scheduler)
+G_GNUC_INTERNAL;
+
+void _libwc_write_scheduler_push(LibWCWriteScheduler *scheduler,
+                                 LibWCQueuedWrite *queued_write)
+G_GNUC_INTERNAL;
+
+void _libwc_write_scheduler_push_head(LibWCWriteScheduler *scheduler,
+                                      LibWCQueuedWrite *queued_write)
+G_GNUC_INTERNAL;
+
+void _libwc_write_scheduler_push_resume(LibWCWriteScheduler *scheduler,
+                                        LibWCQueuedWrite *queued_write)
+G_GNUC_INTERNAL;
+
+LibWCQueuedWrite * _libwc_write_scheduler_peek(LibWCWriteScheduler *scheduler)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+LibWCQueuedWrite * _libwc_write_scheduler_pop(LibWCWriteScheduler *scheduler)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+LibWCQueuedWrite * _libwc_write_scheduler_pop_resume(
+    LibWCWriteScheduler *scheduler)
+G_GNUC_INTERNAL G_GNUC_WARN_UNUSED_RESULT;
+
+static inline gboolean
+_libwc_write_scheduler_is_empty(LibWCWriteScheduler *scheduler) {
+    return scheduler->length == 0;
+}
+
+#endif /* !WRITE_SCHEDULER_H */
@@ -0,0 +1,84 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "../src/libweechat.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Replays a capture made with libwc_relay_capture_start() through a relay
+ * that isn't connected to anything, and reports how fast it went */
+
+static guint64 event_count;
+static GMainLoop *main_loop;
+
+static void
+count_events_cb(LibWCRelay *relay,
+                LibWCRelayMessage **events,
+                guint n_events,
+                void *user_data) {
+    event_count += n_events;
+}
+
+static void
+replay_done_cb(GObject *source_object,
+               GAsyncResult *res,
+               void *user_data) {
+    GError *error = NULL;
+
+    if (!libwc_relay_replay_finish(LIBWC_RELAY(source_object), res, &error)) {
+        fprintf(stderr, "Replay failed: %s\n", error->message);
+        exit(1);
+    }
+
+    g_main_loop_quit(main_loop);
+}
+
+int main(int argc, char *argv[]) {
+    LibWCRelay *relay = libwc_relay_new();
+    gboolean realtime = FALSE;
+    const gchar *path;
+    gint64 start_time, elapsed;
+
+    if (argc == 3 && g_str_equal(argv[1], "--realtime")) {
+        realtime = TRUE;
+        path = argv[2];
+    }
+    else if (argc == 2) {
+        path = argv[1];
+    }
+    else {
+        fprintf(stderr, "Usage: replay-capture [--realtime] <capture file>\n");
+        exit(1);
+    }
+
+    main_loop = g_main_loop_new(NULL, FALSE);
+    libwc_relay_event_handler_set(relay, NULL, count_events_cb, NULL, NULL);
+
+    start_time = g_get_monotonic_time();
+    libwc_relay_replay_async(relay, NULL, replay_done_cb, NULL, path,
+                             realtime);
+    g_main_loop_run(main_loop);
+
+    /* Events can still be on their way to us */
+    while (g_main_context_iteration(NULL, FALSE));
+
+    elapsed = MAX(g_get_monotonic_time() - start_time, 1);
+
+    printf("Replayed %" G_GUINT64_FORMAT " events in %.3f seconds "
+           "(%.0f events/s)\n", event_count, elapsed / 1e6,
+           event_count / (elapsed / 1e6));
+}
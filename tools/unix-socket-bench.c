@@ -0,0 +1,262 @@
+/* ©2015 Stephen Chandler Paul <thatslyude@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ */
+
+#include "../src/libweechat.h"
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+
+/* Compares a relay connected over a Unix socket with one connected over
+ * loopback TCP. A thread in this process plays weechat's part, answering every
+ * ping with a pong, while the relay keeps PING_WINDOW pings in flight at once.
+ * Since both ends live in this process, the CPU time reported covers both
+ * sides of the transport */
+
+#define PING_COUNT  (200000)
+#define PING_WINDOW (64)
+#define PING_SIZE   (256)
+
+static gchar ping_string[PING_SIZE + 1];
+static guint pings_sent, pings_done;
+static GMainLoop *main_loop;
+
+static void
+frame_append_string(GByteArray *frame,
+                    const gchar *str,
+                    gsize len) {
+    guint32 be_len = GUINT32_TO_BE(len);
+
+    g_byte_array_append(frame, (guint8*)&be_len, sizeof(be_len));
+    g_byte_array_append(frame, (guint8*)str, len);
+}
+
+static void
+append_pong(GByteArray *out,
+            const gchar *args) {
+    gsize start = out->len;
+    guint32 be_len;
+
+    g_byte_array_set_size(out, start + 5);
+    frame_append_string(out, "_pong", strlen("_pong"));
+    g_byte_array_append(out, (guint8*)"str", 3);
+    frame_append_string(out, args, strlen(args));
+
+    be_len = GUINT32_TO_BE(out->len - start);
+    memcpy(out->data + start, &be_len, sizeof(be_len));
+    out->data[start + 4] = 0;
+}
+
+/* Answers pings, then hangs up once it's answered the one init sends along
+ * with every one of ours. Anything else, like init itself, gets ignored */
+static void *
+fake_relay_thread(GSocket *listen_socket) {
+    GSocket *socket;
+    GByteArray *in = g_byte_array_new(),
+               *out = g_byte_array_new();
+    gchar buf[65536];
+    gssize received;
+    guint pongs_left = PING_COUNT + 1;
+
+    socket = g_socket_accept(listen_socket, NULL, NULL);
+    g_assert_nonnull(socket);
+
+    if (g_socket_get_family(socket) != G_SOCKET_FAMILY_UNIX)
+        g_socket_set_option(socket, IPPROTO_TCP, TCP_NODELAY, 1, NULL);
+
+    while (pongs_left &&
+           (received = g_socket_receive(socket, buf, sizeof(buf), NULL,
+                                        NULL)) > 0) {
+        gsize line_start = 0;
+        guint8 *newline;
+
+        g_byte_array_append(in, (guint8*)buf, received);
+
+        while ((newline = memchr(in->data + line_start, '\n',
+                                 in->len - line_start))) {
+            gchar *line = (gchar*)in->data + line_start;
+
+            *newline = '\0';
+            line_start = newline - in->data + 1;
+
+            if (g_str_has_prefix(line, "ping ") && pongs_left) {
+                append_pong(out, line + strlen("ping "));
+                pongs_left--;
+            }
+        }
+
+        g_byte_array_remove_range(in, 0, line_start);
+
+        if (out->len) {
+            g_assert_true(g_socket_send_all(socket, (gchar*)out->data,
+                                            out->len, NULL, NULL));
+            g_byte_array_set_size(out, 0);
+        }
+    }
+
+    g_socket_close(socket, NULL);
+    g_object_unref(socket);
+    g_byte_array_free(in, TRUE);
+    g_byte_array_free(out, TRUE);
+
+    return NULL;
+}
+
+static void send_ping(LibWCRelay *relay);
+
+static void
+ping_cb(GObject *source_object,
+        GAsyncResult *res,
+        void *user_data) {
+    LibWCRelay *relay = LIBWC_RELAY(source_object);
+    GError *error = NULL;
+    gchar *result;
+
+    result = libwc_relay_ping_finish(relay, res, &error);
+    if (!result) {
+        fprintf(stderr, "Ping failed: %s\n", error->message);
+        exit(1);
+    }
+    g_free(result);
+
+    if (++pings_done == PING_COUNT)
+        g_main_loop_quit(main_loop);
+    else if (pings_sent < PING_COUNT)
+        send_ping(relay);
+}
+
+static void
+send_ping(LibWCRelay *relay) {
+    pings_sent++;
+    libwc_relay_ping_async(relay, NULL, ping_cb, NULL, ping_string);
+}
+
+static gint64
+cpu_time_us() {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void
+run_bench(const gchar *name,
+          GSocketAddress *address) {
+    LibWCRelay *relay = libwc_relay_new();
+    GSocket *listen_socket, *socket = NULL;
+    GSocketAddress *bound_address;
+    GSocketConnection *connection;
+    GThread *thread;
+    GError *error = NULL;
+    gint64 start_time, start_cpu, elapsed, cpu;
+
+    listen_socket = g_socket_new(g_socket_address_get_family(address),
+                                 G_SOCKET_TYPE_STREAM,
+                                 G_SOCKET_PROTOCOL_DEFAULT, &error);
+    if (!listen_socket ||
+        !g_socket_bind(listen_socket, address, TRUE, &error) ||
+        !g_socket_listen(listen_socket, &error)) {
+        fprintf(stderr, "Couldn't listen for %s: %s\n", name, error->message);
+        exit(1);
+    }
+
+    thread = g_thread_new("fake relay", (GThreadFunc)fake_relay_thread,
+                          listen_socket);
+
+    if (G_IS_UNIX_SOCKET_ADDRESS(address)) {
+        if (!libwc_relay_connection_set_unix(
+                relay,
+                g_unix_socket_address_get_path(
+                    G_UNIX_SOCKET_ADDRESS(address)),
+                LIBWC_UNIX_SOCKET_FLAG_ABSTRACT |
+                LIBWC_UNIX_SOCKET_FLAG_SAME_USER,
+                NULL, &error)) {
+            fprintf(stderr, "Couldn't connect over %s: %s\n", name,
+                    error->message);
+            exit(1);
+        }
+    }
+    else {
+        bound_address = g_socket_get_local_address(listen_socket, &error);
+        socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_STREAM,
+                              G_SOCKET_PROTOCOL_TCP, &error);
+        g_socket_set_option(socket, IPPROTO_TCP, TCP_NODELAY, 1, NULL);
+
+        if (!g_socket_connect(socket, bound_address, NULL, &error)) {
+            fprintf(stderr, "Couldn't connect over %s: %s\n", name,
+                    error->message);
+            exit(1);
+        }
+
+        connection = g_socket_connection_factory_create_connection(socket);
+        libwc_relay_connection_set(relay, G_IO_STREAM(connection), socket);
+        g_object_unref(connection);
+        g_object_unref(bound_address);
+    }
+
+    if (!libwc_relay_connection_init(relay, NULL, &error)) {
+        fprintf(stderr, "Couldn't initialize relay over %s: %s\n", name,
+                error->message);
+        exit(1);
+    }
+
+    pings_sent = pings_done = 0;
+    start_time = g_get_monotonic_time();
+    start_cpu = cpu_time_us();
+
+    for (guint i = 0; i < PING_WINDOW; i++)
+        send_ping(relay);
+    g_main_loop_run(main_loop);
+
+    elapsed = MAX(g_get_monotonic_time() - start_time, 1);
+    cpu = cpu_time_us() - start_cpu;
+
+    printf("%-13s %8.0f round trips/s, %6.2f us of CPU per round trip\n",
+           name, PING_COUNT / (elapsed / 1e6), (gdouble)cpu / PING_COUNT);
+
+    g_thread_join(thread);
+    g_object_unref(listen_socket);
+    g_clear_object(&socket);
+}
+
+int main(int argc, char *argv[]) {
+    GInetAddress *loopback;
+    GSocketAddress *address;
+    gchar *unix_name;
+
+    memset(ping_string, 'x', PING_SIZE);
+    main_loop = g_main_loop_new(NULL, FALSE);
+
+    unix_name = g_strdup_printf("libweechat-bench-%d", getpid());
+    address = g_unix_socket_address_new_with_type(
+        unix_name, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    run_bench("Unix socket", address);
+    g_object_unref(address);
+    g_free(unix_name);
+
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, 0);
+    run_bench("Loopback TCP", address);
+    g_object_unref(address);
+    g_object_unref(loopback);
+}